@@ -5,12 +5,19 @@
 #include <filesystem>
 #include <cmath>
 #include <algorithm>
+#include <numeric>
 #include <cstring> // memcpy
+#include <thread>
 #include "icon.h"
+#include "shm.h"
 
 #include "tinyfiledialogs.h"
 #include "clip.h"
 
+#ifdef __linux__
+#include <unistd.h> // close
+#endif
+
 namespace fs = std::filesystem;
 
 constexpr float MAX_ZOOM = 256.0f;
@@ -19,6 +26,25 @@ constexpr float KEYBOARD_ZOOM_SPEED = 0.8f;
 constexpr float PAN_SPEED = 500.0f;
 constexpr int SIDEBAR_WIDTH = 100;
 constexpr int SIDEBAR_BORDER = SIDEBAR_WIDTH / 10;
+constexpr float GRID_MIN_SCALE = 2.0f; // The grid is hidden below this zoom
+constexpr float GRID_OPAQUE_SCALE = 8.0f; // and fully opaque above this one
+constexpr int TEXT_PADDING = 4;
+constexpr float PIXEL_VALUES_MIN_SCALE = 32.0f; // Pixel values are drawn in their cells above this zoom
+constexpr double HUD_PERIOD = 0.25; // Seconds between updates of the performance HUD
+constexpr int STATS_HISTOGRAM_HEIGHT = 64;
+constexpr uint64_t FLICKER_PERIOD = 500; // Milliseconds each image is shown for when comparing
+constexpr int DIVIDER_GRAB_DISTANCE = 6;
+constexpr int LEVELS_STEP = 8;
+constexpr int THUMBNAIL_SIZE = 2 * SIDEBAR_WIDTH; // Allow for high dpi displays
+constexpr size_t RESIDENT_NEIGHBOURS = 2; // Images either side of the active image that keep full textures
+constexpr size_t LOAD_ERRORS_SHOWN = 10; // Failures listed in the error panel, the rest are only counted
+constexpr int CLIPBOARD_BAND_ROWS = 64; // Rows of the copied pixels transformed per job
+constexpr int IO_THREADS = 4; // Paths resolved at once, these threads mostly wait on the file system
+constexpr uint32_t WATCH_POLL_MS = 100; // Longest sleep between checks for changed files while idle
+
+static const SDL_Colour TEXT_BACKGROUND = { 0, 0, 0, 180 };
+static const SDL_Colour TEXT_FOREGROUND = { 230, 230, 230, 255 };
+static const SDL_Colour ERROR_FOREGROUND = { 255, 120, 110, 255 };
 
 static const char* const HELP_TITLE = "imgnow v1.0.0 Help";
 static const char* const HELP_TEXT = R"(
@@ -31,8 +57,10 @@ Ctrl+O            -    Open File
 Ctrl+W            -    Close File
 Ctrl+R            -    Reload From Disk
 Ctrl+C            -    Copy Selection
+Ctrl+S            -    Save Selection
 Ctrl+K            -    Copy Colour
 Ctrl+Shift+T      -    Reopen Closed File
+Ctrl+Q            -    Quit
 Space             -    Pause GIF
 Tab               -    Next Image
 Shift+Tab         -    Previous Image
@@ -47,6 +75,18 @@ V                 -    Flip Vertically
 Z                 -    Reset Transform
 G                 -    Toggle Grid
 S                 -    Toggle Sidebar
+D                 -    Group Duplicates in Sidebar
+B                 -    Toggle Status Bar
+H                 -    Toggle Performance HUD
+I                 -    Toggle Selection Statistics
+X                 -    Compare Other Images With This One
+M                 -    Switch Compare View
+L                 -    Cycle Channel View
+Shift+L           -    Reset Channel View and Levels
+,/.               -    Move Black Point
+Shift+,/.         -    Move White Point
+N                 -    Toggle Auto Levels
+U                 -    Toggle False Colour
 K                 -    Switch Colour Format
 A                 -    Toggle Colour Format Alpha
 P                 -    Toggle Antialiasing
@@ -54,16 +94,15 @@ P                 -    Toggle Antialiasing
 LMB/Arrow Keys    -    Pan
 Scroll/]/[        -    Zoom
 RMB               -    Select Area
-Escape            -    Deselect Area
+Escape            -    Dismiss Errors/Deselect Area
 ==================================
 )";
 
-// Since std::future blocks when destroyed, we need to keep it
-// alive until the image is loaded. We do this by moving the future into
-// a heap allocated future which is periodically checked for completion.
-// Being heap allocated means that the destructor does not have to
-// be called when the program exits. This leak allows for quick termination.
-static std::vector<std::future<Image>*> discardedFutures;
+// Futures of deleted images are kept until their decode finishes
+// so that the number of busy loader threads can be tracked.
+static std::vector<std::future<Image>> discardedFutures;
+// Paths still resolving when their image was closed, which may be watched once they finish
+static std::vector<std::future<ResolvedFile>> discardedResolves;
 
 static SDL_Point ClampPoint(const SDL_Point& p, const SDL_Rect& rc) {
 	return {
@@ -81,18 +120,64 @@ static SDL_Rect RectFromPoints(const SDL_Point& p, const SDL_Point& q) {
 	};
 }
 
-SDL_Texture* ImageEntity::GetTexture() const {
-	if (textures.empty()) {
-		return nullptr;
-	} else {
-		return textures[currentTextureIndex];
-	}
+static SDL_Colour GetDuplicateColour(uint32_t group) {
+	static const SDL_Colour COLOURS[] = {
+		{ 200, 60, 60, 255 },
+		{ 60, 150, 220, 255 },
+		{ 70, 170, 70, 255 },
+		{ 210, 140, 30, 255 },
+		{ 150, 80, 200, 255 },
+		{ 30, 170, 160, 255 },
+		{ 200, 70, 150, 255 },
+		{ 130, 130, 60, 255 },
+	};
+	return COLOURS[(group - 1) % std::size(COLOURS)];
+}
+
+// Native dialogs block until they are closed, so they get their own thread which posts the result back.
+// The thread is detached rather than joined so that quitting doesn't wait for the dialog to be closed.
+template <typename F>
+static auto ShowDialogAsync(F show) -> std::future<decltype(show())> {
+	std::promise<decltype(show())> promise;
+	auto future = promise.get_future();
+	std::thread([show = std::move(show), promise = std::move(promise)]() mutable {
+		promise.set_value(show());
+		Window::Wake();
+		}).detach();
+	return future;
+}
+
+// The content hash covers every frame, the perceptual hash uses the thumbnail so it reads few pixels
+static std::future<ImageHashes> HashAsync(ThreadPool& loader, const Image& image) {
+	const Image* thumbnail = image.GetThumbnail();
+	if (!thumbnail) {
+		thumbnail = &image;
+	}
+	return loader.Submit([
+		pixels = image.SharePixels(), width = image.GetWidth(), height = image.GetHeight(), frames = image.GetFrameCount(),
+		small = thumbnail->SharePixels(), smallWidth = thumbnail->GetWidth(), smallHeight = thumbnail->GetHeight()] {
+		return ComputeImageHashes(pixels.get(), width, height, frames, small.get(), smallWidth, smallHeight);
+		});
+}
+
+bool ImageEntity::Loaded() const {
+	return image.Valid();
 }
 
-App::App(int argc, char** argv, Config cfg, std::unique_ptr<MessageServer> msgServer) :
+App::App(const Options& options, std::vector<PendingImage> pending, Config cfg,
+	std::unique_ptr<MessageServer> msgServer, std::shared_ptr<ThreadPool> loader, std::shared_ptr<Benchmark> bench) :
 	Window(1280, 720),
 	config(std::move(cfg)),
-	msgServer(std::move(msgServer))
+	textures(GetRenderer()),
+	overlays(GetRenderer()),
+	text(GetRenderer()),
+	valueText(GetRenderer()),
+	msgServer(std::move(msgServer)),
+	loader(std::move(loader)),
+	io(IO_THREADS),
+	stats(this->loader),
+	comparer(this->loader),
+	bench(std::move(bench))
 {
 	// Load config
 	if (SDL_Point windowPos{}; config.TryGet("window_x", windowPos.x) && config.TryGet("window_y", windowPos.y)) {
@@ -104,19 +189,52 @@ App::App(int argc, char** argv, Config cfg, std::unique_ptr<MessageServer> msgSe
 	if (config.GetOr("maximized", false)) {
 		SDL_MaximizeWindow(GetWindow());
 	}
-	SDL_ShowWindow(GetWindow());
+	resident = options.resident || config.GetOr("resident", false);
+	if (resident && pending.empty()) {
+		// Started in the background, wait for files to be sent from another instance
+		hidden = true;
+	} else {
+		SDL_ShowWindow(GetWindow());
+	}
+	SDL_RendererInfo info{};
+	SDL_GetRendererInfo(GetRenderer(), &info);
+	if (this->bench) {
+		this->bench->WindowShown(info.name);
+	}
+	softwareRenderer = (info.flags & SDL_RENDERER_SOFTWARE) != 0;
+	if (config.GetOr("software_compositor", softwareRenderer)) {
+		compositor = std::make_unique<Compositor>(GetRenderer(), std::max(1, (int)std::thread::hardware_concurrency()));
+	}
 	sidebarEnabled = config.GetOr("sidebar_enabled", true);
+	statusBarEnabled = config.GetOr("status_bar_enabled", true);
+	text.SetScale(config.GetOr("text_scale", 2));
 	colourFormatter.SetFormat(config.GetOr("colour_format", 0));
 	colourFormatter.alphaEnabled = config.GetOr("colour_format_alpha", true);
 	scrollSpeed = config.GetOr("scroll_speed", 100);
 	
 	antialiasing = config.GetOr("antialiasing", true);
-	SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, antialiasing ? "2" : "0");
 
-	// Load images
-	maxLoadThreads = std::max(1, (int)std::thread::hardware_concurrency() - 1);
-	for (int i = 1; i < argc; i++) {
-		QueueFileLoad(argv[i]);
+	if (this->msgServer) {
+		this->msgServer->SetNotify(&Window::Wake);
+	}
+	// Finished jobs are collected by the next update, which may be asleep
+	this->loader->SetNotify(&Window::Wake);
+	io.SetNotify(&Window::Wake);
+
+	if (config.GetOr("auto_reload", true) || !options.watchDirs.empty()) {
+		watcher = std::make_shared<FileWatcher>();
+		for (const auto& dir : options.watchDirs) {
+			watcher->WatchDirectory(dir);
+		}
+	}
+
+	compare.heatmap.id = nextImageId++;
+	filtered.entity.id = nextImageId++;
+
+	// Pick up images which have been decoding while the window was being created
+	maxLoadThreads = this->loader->GetThreadCount();
+	for (auto& image : pending) {
+		QueueFileLoad(std::move(image.path), (size_t)-1, std::move(image.future));
 	}
 
 #ifndef _WIN32 // Windows uses .rc file instead
@@ -136,7 +254,16 @@ App::App(int argc, char** argv, Config cfg, std::unique_ptr<MessageServer> msgSe
 }
 
 App::~App() {
-	// Save config
+	SaveConfig();
+
+	if (frameTarget) {
+		SDL_DestroyTexture(frameTarget);
+	}
+
+	SDL_HideWindow(GetWindow());
+}
+
+void App::SaveConfig() {
 	if (restoredPos) {
 		config.Set("window_x", restoredPos.value().x);
 		config.Set("window_y", restoredPos.value().y);
@@ -147,47 +274,100 @@ App::~App() {
 	}
 	config.Set("maximized", maximized);
 	config.Set("sidebar_enabled", sidebarEnabled);
+	config.Set("status_bar_enabled", statusBarEnabled);
 	config.Set("colour_format", colourFormatter.GetFormat());
 	config.Set("colour_format_alpha", colourFormatter.alphaEnabled);
 	config.Set("scroll_speed", scrollSpeed);
 	config.Set("antialiasing", antialiasing);
 	config.Save();
+}
+
+void App::CloseRequested() {
+	if (resident) {
+		Hide();
+	} else {
+		Quit();
+	}
+}
+
+uint32_t App::GetSleepTime() const {
+	// While hidden, only new messages need to be handled and those wake the loop up
+	if (hidden)
+		return 1000;
+	// Finished jobs, dialogs and messages wake the loop up, but file changes are only
+	// seen when the watcher is polled
+	if (idle && !bench)
+		return watcher ? WATCH_POLL_MS : 1000;
+	return 0;
+}
 
+void App::Hide() {
+	// The images, their textures and thumbnails are kept, so reopening one of them shows it straight away
+	loadErrors.lines.clear();
+	loadErrors.sequence++;
+	SaveConfig();
 	SDL_HideWindow(GetWindow());
-	for (auto& image : images) {
-		for (SDL_Texture* tex : image.textures) {
-			SDL_DestroyTexture(tex);
-		}
+	hidden = true;
+}
+
+void App::Show() {
+	if (hidden) {
+		SDL_ShowWindow(GetWindow());
+		SDL_RaiseWindow(GetWindow());
+		hidden = false;
 	}
 }
 
 void App::Update() {
 	uint64_t now = SDL_GetTicks64();
+	uint64_t updateStart = SDL_GetPerformanceCounter();
+
+	// Jobs wake the loop when they finish, but progress is only shown by updating while they run
+	bool working = loader->Busy() || io.Busy();
+	idle = false;
 	
 	UpdateImageLoading();
+	UpdateDuplicates();
+
+	// Nothing to draw while running in the background
+	if (hidden)
+		return;
 
 	if (GetCtrlKeyDown()) {
 		// Open file
 		if (GetKeyPressed(SDL_Scancode::SDL_SCANCODE_O)) {
 			ShowOpenFileDialog();
 		}
+
+		// Save file
+		else if (GetKeyPressed(SDL_Scancode::SDL_SCANCODE_S)) {
+			ShowSaveFileDialog();
+		}
 		
 		// Close file
 		else if (GetKeyPressed(SDL_Scancode::SDL_SCANCODE_W)) {
-			if (images.empty()) {
-				SDL_Event quitEvent{};
-				quitEvent.type = SDL_QUIT;
-				SDL_PushEvent(&quitEvent);
+			if (imageOrder.empty()) {
+				CloseRequested();
 				return;
 			} else {
 				ImageEntity* image = nullptr;
 				if (TryGetCurrentImage(&image)) {
 					openFileHistory.push(image->fullPath);
-					DeleteImage(&*image);
+					DeleteImage(image);
+				}
+				if (resident && imageOrder.empty()) {
+					Hide();
+					return;
 				}
 			}
 		}
 
+		// Quit, even when running in the background
+		else if (GetKeyPressed(SDL_Scancode::SDL_SCANCODE_Q)) {
+			Quit();
+			return;
+		}
+
 		// Reopen closed file
 		else if (GetShiftKeyDown() && GetKeyPressed(SDL_Scancode::SDL_SCANCODE_T) && !openFileHistory.empty()) {
 			QueueFileLoad(std::move(openFileHistory.top()));
@@ -232,17 +412,19 @@ void App::Update() {
 		if (!GetMouseDown(SDL_BUTTON_RIGHT)) { // Disable image switching when selecting an area
 			// Switch image
 			for (size_t i = 0; i < 10; i++) {
-				if (GetKeyPressed((SDL_Scancode)(SDL_Scancode::SDL_SCANCODE_1 + i)) && i < images.size()) {
-					activeImageIndex = i;
+				if (GetKeyPressed((SDL_Scancode)(SDL_Scancode::SDL_SCANCODE_1 + i)) && i < imageOrder.size()) {
+					activeImage = imageOrder[i];
 				}
 			}
 
 			// Next/previous image
-			if (!images.empty() && GetKeyPressed(SDL_Scancode::SDL_SCANCODE_TAB)) {
+			if (!imageOrder.empty() && GetKeyPressed(SDL_Scancode::SDL_SCANCODE_TAB)) {
+				size_t count = imageOrder.size();
+				size_t i = GetImagePosition(activeImage);
 				if (GetShiftKeyDown()) {
-					activeImageIndex = (activeImageIndex + images.size() - 1) % images.size();
+					activeImage = imageOrder[(i + count - 1) % count];
 				} else {
-					activeImageIndex = (activeImageIndex + 1) % images.size();
+					activeImage = imageOrder[(i + 1) % count];
 				}
 			}
 		}
@@ -253,8 +435,10 @@ void App::Update() {
 		totalPauseTime += now - lastPauseTime.value();
 		lastPauseTime = now;
 	}
-	for (auto& image : images) {
-		if (image.GetTexture()) {
+	for (uint64_t id : imageOrder) {
+		ImageEntity& image = *images.Get(id);
+		if (image.Loaded()) {
+			textures.SetScaleMode(image.id, GetScaleMode(image));
 			uint64_t delta = (now - image.openTime - totalPauseTime) % image.image.GetGifDuration();
 			for (int i = 0; i < image.image.GetFrameCount(); i++) {
 				if (delta < image.image.GetGifDelay(i)) {
@@ -266,16 +450,434 @@ void App::Update() {
 		}
 	}
 	
-	SDL_SetRenderDrawColor(GetRenderer(), 0, 0, 0, 255);
-	SDL_RenderClear(GetRenderer());
+	UpdateResidency();
 
-	UpdateActiveImage();	
+	UpdateActiveImage();
+	UpdateCompare();
+	UpdateViewFilter();
 	UpdateSidebar();
 	UpdateStatus();
+	UpdateStats();
+	UpdateLoadErrors();
+	UpdateClipboard();
+	UpdateExport();
+
+	// Most frames while idle or hovering change nothing on screen
+	auto damage = CollectDamage();
+	bool drawing = !damage.empty();
+	uint64_t drawStart = SDL_GetPerformanceCounter();
+	if (drawing) {
+		for (const SDL_Rect& rc : damage) {
+			hud.damagedPixels += (uint64_t)rc.w * rc.h;
+		}
+		Draw(std::move(damage));
+		hud.drawTicks += SDL_GetPerformanceCounter() - drawStart;
+		hud.drawnFrames++;
+	}
+	hud.updateTicks += drawStart - updateStart;
+	hud.frames++;
+
+	// Animated images and flicker comparisons advance with the clock rather than with events
+	const ImageEntity* visible = nullptr;
+	const ImageEntity* reference = nullptr;
+	bool playing = TryGetVisibleImage(&visible) && visible->image.GetFrameCount() > 1 && !lastPauseTime;
+	bool flickering = compare.mode == CompareMode::Flicker && TryGetCompareImage(&reference);
+	idle = !drawing && !working && !playing && !flickering;
+
+	if (bench) {
+		UpdateBenchmark();
+	}
+}
+
+void App::Exposed() {
+	damage.Invalidate();
+}
+
+std::vector<SDL_Rect> App::CollectDamage() {
+	auto [cw, ch] = GetClientSize();
+	SDL_Rect window = { 0, 0, cw, ch };
+
+	// Image
+	Fingerprint view;
+	SDL_Rect viewBounds{};
+	const ImageEntity* image = nullptr;
+	if (TryGetVisibleImage(&image)) {
+		const auto& display = image->display;
+		view.Add(image->id)
+			.Add(image->generation)
+			.Add(image->currentTextureIndex)
+			.Add(GetTexture(*image))
+			.Add(display.x)
+			.Add(display.y)
+			.Add(display.scale)
+			.Add(display.animatedRotation)
+			.Add(display.flipHorizontal)
+			.Add(display.flipVertical)
+			.Add(GetScaleMode(*image))
+			.Add(gridEnabled)
+			.Add(colourFormatter.GetFormat()) // Pixel values
+			.Add(colourFormatter.alphaEnabled)
+			.Add(filtered.active)
+			.Add(filtered.entity.generation);
+		const ImageEntity* reference = nullptr;
+		bool comparing = TryGetCompareImage(&reference);
+		if (comparing) {
+			view.Add(reference->id)
+				.Add(reference->generation)
+				.Add(reference->currentTextureIndex)
+				.Add(GetTexture(*reference))
+				.Add(compare.mode)
+				.Add(compare.split)
+				.Add(compare.showReference)
+				.Add(compare.sequence);
+		}
+		// A rotating image isn't bounded by its rect, and neither is the reference or divider when comparing.
+		// Otherwise allow a pixel either side for rounding and the grid's edge lines.
+		if (display.animatedRotation == display.rotation && !comparing) {
+			SDL_Rect rc = GetImageRect();
+			viewBounds = { rc.x - 1, rc.y - 1, rc.w + 2, rc.h + 2 };
+		} else {
+			viewBounds = window;
+		}
+	}
+	damage.Set(DamageTracker::Region::View, view.Get(), viewBounds);
+
+	// Selection, the border is drawn just inside this
+	SDL_Rect selection = GetSelectionScreenRect();
+	if (!SDL_RectEmpty(&selection)) {
+		selection = { selection.x - 1, selection.y - 1, selection.w + 2, selection.h + 2 };
+	}
+	damage.Set(DamageTracker::Region::Selection, Fingerprint().Add(selection).Get(), selection);
+
+	// Sidebar
+	Fingerprint sidebar;
+	sidebar.Add(sidebarRect)
+		.Add(hoverImage)
+		.Add(activeImage)
+		.Add(reorderLineY.value_or(-1));
+	for (size_t i = 0; i < sidebarIcons.size() && i < imageOrder.size(); i++) {
+		const ImageEntity& image = *images.Get(imageOrder[i]);
+		DuplicateInfo duplicates = imageIndex.GetDuplicates(image.id);
+		sidebar.Add(sidebarIcons[i])
+			.Add(image.id)
+			.Add(image.generation)
+			.Add(GetSidebarIcon(image))
+			.Add(duplicates.group)
+			.Add(duplicates.exact);
+	}
+	damage.Set(DamageTracker::Region::Sidebar, sidebar.Get(), sidebarRect);
+
+	// Status bar and HUD
+	SDL_Rect statusRect = GetStatusRect();
+	Fingerprint statusPrint;
+	statusPrint.Add(statusRect).Add(status.colour).AddBytes(status.text, status.length);
+	damage.Set(DamageTracker::Region::Status, statusPrint.Get(), statusRect);
+	SDL_Rect hudRect = GetHudRect();
+	Fingerprint hudPrint;
+	hudPrint.Add(hudRect).AddBytes(hud.text, hud.length);
+	damage.Set(DamageTracker::Region::Hud, hudPrint.Get(), hudRect);
+	SDL_Rect statsRect = GetStatsRect();
+	Fingerprint statsPrint;
+	statsPrint.Add(statsRect).Add(statsPanel.sequence).Add(statsPanel.busy);
+	damage.Set(DamageTracker::Region::Stats, statsPrint.Get(), statsRect);
+	SDL_Rect compareRect = GetCompareRect();
+	Fingerprint comparePrint;
+	comparePrint.Add(compareRect).AddBytes(compare.text, compare.length);
+	damage.Set(DamageTracker::Region::Compare, comparePrint.Get(), compareRect);
+	SDL_Rect errorsRect = GetLoadErrorsRect();
+	Fingerprint errorsPrint;
+	errorsPrint.Add(errorsRect).Add(loadErrors.sequence);
+	damage.Set(DamageTracker::Region::Errors, errorsPrint.Get(), errorsRect);
+	SDL_Rect progressRect = GetProgressRect();
+	Fingerprint progressPrint;
+	progressPrint.Add(progressRect)
+		.AddBytes(clipboardCopy.text, clipboardCopy.length)
+		.AddBytes(exportJob.text, exportJob.length);
+	damage.Set(DamageTracker::Region::Progress, progressPrint.Get(), progressRect);
+
+	return damage.Collect({ cw, ch });
+}
+
+void App::Draw(std::vector<SDL_Rect> rects) {
+	auto drawRects = [&] {
+		for (const SDL_Rect& rc : rects) {
+			SDL_RenderSetClipRect(GetRenderer(), &rc);
+			SDL_SetRenderDrawColor(GetRenderer(), 0, 0, 0, 255);
+			SDL_RenderFillRect(GetRenderer(), &rc);
+			DrawActiveImage(rc);
+			DrawPixelValues(rc);
+			DrawSidebar();
+			DrawStats();
+			DrawStatus();
+			DrawLoadErrors();
+			DrawProgress();
+		}
+		SDL_RenderSetClipRect(GetRenderer(), nullptr);
+	};
 
+	if (softwareRenderer) {
+		// The software renderer draws straight into the window surface,
+		// so only the damaged rects have to be copied to the screen.
+		drawRects();
+		SDL_RenderFlush(GetRenderer());
+		SDL_UpdateWindowSurfaceRects(GetWindow(), rects.data(), (int)rects.size());
+		return;
+	}
+
+	// The back buffer is undefined after a present, so the frame is kept in a
+	// target texture and only its damaged rects are drawn again.
+	auto [cw, ch] = GetClientSize();
+	if (!frameTarget || frameTargetSize.x != cw || frameTargetSize.y != ch) {
+		if (frameTarget) {
+			SDL_DestroyTexture(frameTarget);
+		}
+		frameTarget = SDL_CreateTexture(
+			GetRenderer(),
+			SDL_PixelFormatEnum::SDL_PIXELFORMAT_ARGB8888,
+			SDL_TEXTUREACCESS_TARGET,
+			cw,
+			ch);
+		frameTargetSize = { cw, ch };
+		if (frameTarget) {
+			SDL_SetTextureBlendMode(frameTarget, SDL_BLENDMODE_NONE);
+		}
+		rects = { { 0, 0, cw, ch } };
+	}
+
+	if (!frameTarget || SDL_SetRenderTarget(GetRenderer(), frameTarget) != 0) {
+		// Render targets aren't supported, draw everything every time
+		rects = { { 0, 0, cw, ch } };
+		drawRects();
+		SDL_RenderPresent(GetRenderer());
+		return;
+	}
+	drawRects();
+	SDL_SetRenderTarget(GetRenderer(), nullptr);
+	SDL_RenderCopy(GetRenderer(), frameTarget, nullptr, nullptr);
 	SDL_RenderPresent(GetRenderer());
 }
 
+void App::HandleRequest(Request& request) {
+	if (request.command == Command::Push) {
+		HandlePush(request);
+		return;
+	} else if (request.command != Command::Open) {
+		Reply reply = HandleCommand(request);
+		if (!request.legacy) {
+			msgServer->SendReply(request.client, reply);
+		}
+		return;
+	}
+
+	// Files sent to a hidden window are shown instead of the images left open when it was hidden
+	bool wasHidden = hidden;
+	Show();
+	if (request.legacy) {
+		for (size_t i = 0; i < request.paths.size(); i++) {
+			ImageEntity& image = QueueFileLoad(std::move(request.paths[i]));
+			if (wasHidden && i == 0) {
+				activeImage = image.id;
+			}
+		}
+		return;
+	}
+
+	// Acknowledge once every image in the batch has finished loading
+	PendingAck ack{ request.client, {}, request.paths.size() };
+	ack.reply.id = request.id;
+	ack.reply.entries.resize(request.paths.size(), ReplyEntry{ Result::Loading, {} });
+	if (request.paths.empty()) {
+		msgServer->SendReply(request.client, ack.reply);
+		return;
+	}
+	uint64_t ackId = nextAckId++;
+	pendingAcks.emplace(ackId, std::move(ack));
+	for (size_t i = 0; i < request.paths.size(); i++) {
+		ImageEntity& image = QueueFileLoad(std::move(request.paths[i]));
+		image.ack = { ackId, i };
+		if (wasHidden && i == 0) {
+			activeImage = image.id;
+		}
+	}
+}
+
+Reply App::HandleCommand(const Request& request) {
+	Reply reply;
+	reply.id = request.id;
+	auto fail = [&](const char* text) {
+		reply.entries.push_back({ Result::Failed, text });
+		return reply;
+	};
+	auto resolveIndex = [&](int32_t index) -> ImageEntity* {
+		if (index == CURRENT_IMAGE)
+			return images.Get(GetCurrentImage());
+		if (index >= 0 && (size_t)index < imageOrder.size())
+			return images.Get(imageOrder[index]);
+		return nullptr;
+	};
+
+	switch (request.command) {
+	case Command::Show:
+		Show();
+		break;
+	case Command::Activate:
+		if (request.index < 0 || (size_t)request.index >= imageOrder.size())
+			return fail("Index out of range");
+		activeImage = imageOrder[request.index];
+		break;
+	case Command::Close:
+		if (ImageEntity* image = resolveIndex(request.index)) {
+			openFileHistory.push(image->fullPath);
+			DeleteImage(image);
+			if (resident && imageOrder.empty()) {
+				Hide();
+			}
+		} else {
+			return fail("Index out of range");
+		}
+		break;
+	case Command::Reload:
+		if (ImageEntity* image = resolveIndex(request.index)) {
+			ReloadImage(*image);
+		} else {
+			return fail("Index out of range");
+		}
+		break;
+	case Command::SetZoom: {
+		ImageEntity* image = nullptr;
+		if (!TryGetVisibleImage(&image))
+			return fail("No image is visible");
+		if (!(request.zoom > 0))
+			return fail("Zoom must be positive");
+		SDL_Point cs = GetClientSize();
+		Zoom({ cs.x / 2, cs.y / 2 }, request.zoom / image->display.scale - 1.0f);
+		break;
+	}
+	case Command::Status:
+		for (size_t i = 0; i < imageOrder.size(); i++) {
+			const auto& image = *images.Get(imageOrder[i]);
+			std::string text = std::to_string(i) + "\t" + image.fullPath + "\t"
+				+ std::to_string(image.image.GetWidth()) + "\t" + std::to_string(image.image.GetHeight()) + "\t"
+				+ (image.id == activeImage ? "1" : "0");
+			reply.entries.push_back({ image.Loaded() ? Result::Ok : Result::Loading, std::move(text) });
+		}
+		return reply;
+	default:
+		return fail("Unknown command");
+	}
+
+	reply.entries.push_back({ Result::Ok, {} });
+	return reply;
+}
+
+void App::HandlePush(const Request& request) {
+	Reply reply;
+	reply.id = request.id;
+#ifdef __linux__
+	if (request.fd == -1) {
+		reply.entries.push_back({ Result::Failed, "No shared memory was passed" });
+	} else if (request.fd == LOST_FD) {
+		reply.entries.push_back({ Result::Failed, "The shared memory was lost, too many descriptors were sent at once" });
+	} else {
+		// Copying or converting unsealed pixels takes as long as a decode, so it is done on the loader
+		pendingPushes.push_back({ request.client, request.id, request.slot, loader->Submit([fd = request.fd] {
+			Image image = MapSharedImage(fd);
+			close(fd);
+			return image;
+			}) });
+		return;
+	}
+#else
+	reply.entries.push_back({ Result::Failed, "Shared memory images are not supported on this platform" });
+#endif
+	msgServer->SendReply(request.client, reply);
+}
+
+void App::UpdatePushes() {
+	while (!pendingPushes.empty()
+		&& pendingPushes.front().image.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+		PendingPush push = std::move(pendingPushes.front());
+		pendingPushes.pop_front();
+		Reply reply;
+		reply.id = push.requestId;
+		Image img = push.image.get();
+		if (!img.Valid()) {
+			reply.entries.push_back({ Result::Failed, img.Error() });
+			msgServer->SendReply(push.client, reply);
+			continue;
+		}
+
+		ImageEntity* target = nullptr;
+		for (uint64_t id : imageOrder) {
+			ImageEntity* im = images.Get(id);
+			if (!im->slot.empty() && im->slot == push.slot) {
+				target = im;
+				break;
+			}
+		}
+		if (!target) {
+			target = &InsertImage();
+			target->slot = push.slot.empty() ? "shared" : push.slot;
+			target->fullPath = "shm:" + target->slot;
+			target->name = target->slot;
+			activeImage = target->id;
+		}
+
+		ImageEntity& image = *target;
+		bool resized = image.image.GetWidth() != img.GetWidth() || image.image.GetHeight() != img.GetHeight();
+		textures.Upload(image.id, img); // Updated in place when the size is unchanged
+		image.image = std::move(img);
+		image.currentTextureIndex = 0;
+		image.generation++;
+		if (resized) {
+			ResetTransform(image);
+		}
+		Show();
+		reply.entries.push_back({ Result::Ok, image.slot });
+		msgServer->SendReply(push.client, reply);
+	}
+}
+
+void App::ResolveAck(ImageEntity& image, Result result, std::string text) {
+	if (!image.ack)
+		return;
+	auto [ackId, entry] = image.ack.value();
+	image.ack = std::nullopt;
+
+	auto it = pendingAcks.find(ackId);
+	if (it == pendingAcks.end())
+		return;
+	PendingAck& ack = it->second;
+	ack.reply.entries[entry] = { result, std::move(text) };
+	if (--ack.remaining == 0) {
+		if (msgServer) {
+			msgServer->SendReply(ack.client, ack.reply);
+		}
+		pendingAcks.erase(it);
+	}
+}
+
+void App::UpdateBenchmark() {
+	if (benchFinished)
+		return;
+
+	const ImageEntity* image = nullptr;
+	if (TryGetVisibleImage(&image)) {
+		bench->Presented(image->fullPath);
+	}
+
+	// Only start sending once the window is up, like a real second instance would
+	if (bench->IsIpc()) {
+		bench->SendFiles();
+	}
+
+	if (bench->Finished()) {
+		benchFinished = true;
+		bench->Print();
+		Quit();
+	}
+}
+
 void App::Resized(int width, int height) {
 	maximized = (SDL_GetWindowFlags(GetWindow()) & SDL_WINDOW_MAXIMIZED) != 0;
 	if (!maximized && !fullscreen) {
@@ -297,32 +899,79 @@ void App::SetWindowTitle(const char* title) const {
 	}
 }
 
-void App::UpdateStatus() const {
+void App::UpdateStatus() {
+	// Toggle status bar
+	if (!GetCtrlKeyDown() && GetKeyPressed(SDL_Scancode::SDL_SCANCODE_B)) {
+		statusBarEnabled = !statusBarEnabled;
+	}
+
+	// Toggle performance HUD
+	if (!GetCtrlKeyDown() && GetKeyPressed(SDL_Scancode::SDL_SCANCODE_H)) {
+		hudEnabled = !hudEnabled;
+		hud.periodStart = SDL_GetPerformanceCounter();
+		hud.length = 0;
+	}
+	if (hudEnabled) {
+		UpdateHud();
+	}
+
+	status.length = 0;
 	const ImageEntity* image = nullptr;
 	if (!TryGetVisibleImage(&image)) {
 		SetWindowTitle("imgnow");
+		titleImageId = 0;
 		return;
 	}
 
+	// The title only changes with the file, everything else is drawn in the window
+	if (titleImageId != image->id) {
+		std::string title = "imgnow | " + image->name;
+		SetWindowTitle(title.c_str());
+		titleImageId = image->id;
+	}
+
 	SDL_Point offset = ScreenToImagePosition(GetMousePosition());
 	SDL_Rect bounds = { 0, 0, image->image.GetWidth(), image->image.GetHeight() };
 	SDL_Colour colour{};
-	if (SDL_PointInRect(&offset, &bounds)) {
+	status.inside = SDL_PointInRect(&offset, &bounds);
+	if (status.inside) {
 		colour = image->image.GetPixel(offset.x, offset.y, image->currentTextureIndex);
 	}
-
-	static const std::string SEP = " | ";
-	std::string text = "imgnow" + SEP
-		+ image->name + SEP
-		+ "Dim: " + std::to_string(image->image.GetWidth()) + "x" + std::to_string(image->image.GetHeight()) + SEP
-		+ "XY: (" + std::to_string(offset.x) + ", " + std::to_string(offset.y) + ")" + SEP
-		+ colourFormatter.GetLabel() + ": " + colourFormatter.FormatColour(colour) + SEP
-		+ "Zoom: " + std::to_string((int)(image->display.scale * 100)) + "%";
-	SetWindowTitle(text.c_str());
+	status.colour = colour;
+
+	char formatted[64];
+	colourFormatter.FormatColour(colour, formatted, sizeof(formatted));
+	int length = std::snprintf(status.text, sizeof(status.text), "Dim: %dx%d | XY: (%d, %d) | %s: %s | Zoom: %d%%",
+		image->image.GetWidth(),
+		image->image.GetHeight(),
+		offset.x,
+		offset.y,
+		colourFormatter.GetLabel(),
+		formatted,
+		(int)(image->display.scale * 100));
+	status.length = std::clamp(length, 0, (int)sizeof(status.text) - 1);
+	if (filtered.active) {
+		static const char* const CHANNEL_NAMES[] = { "RGB", "Red", "Green", "Blue", "Alpha" };
+		static_assert(std::size(CHANNEL_NAMES) == (size_t)ViewChannel::Count);
+		const ViewFilter& filter = filtered.applied;
+		length = std::snprintf(status.text + status.length, sizeof(status.text) - status.length, " | View: %s %d-%d%s%s",
+			CHANNEL_NAMES[(int)filter.channel],
+			filter.black,
+			filter.white,
+			autoLevels ? " (auto)" : "",
+			filter.falseColour ? " false colour" : "");
+		status.length = std::min(status.length + std::max(length, 0), sizeof(status.text) - 1);
+	}
+	if (DuplicateInfo duplicates = imageIndex.GetDuplicates(image->id); duplicates.group) {
+		length = std::snprintf(status.text + status.length, sizeof(status.text) - status.length, " | Duplicate group %u%s",
+			duplicates.group,
+			duplicates.exact ? " (exact)" : "");
+		status.length = std::min(status.length + std::max(length, 0), sizeof(status.text) - 1);
+	}
 
 	// Copy colour to clipboard
 	if (GetCtrlKeyDown() && GetKeyPressed(SDL_Scancode::SDL_SCANCODE_K)) {
-		if (!clip::set_text(colourFormatter.FormatColour(colour))) {
+		if (!clip::set_text(formatted)) {
 			SDL_ShowSimpleMessageBox(
 				SDL_MESSAGEBOX_ERROR,
 				"Clipboard Error",
@@ -332,6 +981,471 @@ void App::UpdateStatus() const {
 	}
 }
 
+void App::UpdateHud() {
+	// Averaged over a few frames so that the numbers are readable
+	uint64_t now = SDL_GetPerformanceCounter();
+	double elapsed = (double)(now - hud.periodStart) / SDL_GetPerformanceFrequency();
+	if (elapsed < HUD_PERIOD && hud.length != 0)
+		return;
+
+	auto ms = [](uint64_t ticks, int count) {
+		return count ? 1000.0 * ticks / SDL_GetPerformanceFrequency() / count : 0.0;
+	};
+	auto [cw, ch] = GetClientSize();
+	double windowPixels = (double)std::max(1, cw * ch) * std::max(1, hud.drawnFrames);
+	int length = std::snprintf(hud.text, sizeof(hud.text), "FPS: %.0f | Drawn: %.0f/s | Update: %.2f ms | Draw: %.2f ms | Damage: %.0f%%",
+		hud.frames / std::max(elapsed, 0.001),
+		hud.drawnFrames / std::max(elapsed, 0.001),
+		ms(hud.updateTicks, hud.frames),
+		ms(hud.drawTicks, hud.drawnFrames),
+		100.0 * hud.damagedPixels / windowPixels);
+	hud.length = std::clamp(length, 0, (int)sizeof(hud.text) - 1);
+	hud.periodStart = now;
+	hud.frames = 0;
+	hud.drawnFrames = 0;
+	hud.updateTicks = 0;
+	hud.drawTicks = 0;
+	hud.damagedPixels = 0;
+}
+
+SDL_Rect App::GetStatusRect() const {
+	if (!statusBarEnabled || status.length == 0)
+		return {};
+	auto [cw, ch] = GetClientSize();
+	int h = text.GetLineHeight();
+	int w = text.Measure({ status.text, status.length }) + 2 * TEXT_PADDING;
+	if (status.inside) {
+		w += h; // Colour swatch
+	}
+	return { 0, ch - h, w, h };
+}
+
+SDL_Rect App::GetHudRect() const {
+	if (!hudEnabled || hud.length == 0)
+		return {};
+	int h = text.GetLineHeight();
+	int w = text.Measure({ hud.text, hud.length }) + 2 * TEXT_PADDING;
+	return { 0, 0, w, h };
+}
+
+void App::DrawStatus() const {
+	if (SDL_Rect rc = GetStatusRect(); !SDL_RectEmpty(&rc)) {
+		text.FillRect(rc, TEXT_BACKGROUND);
+		text.DrawString({ status.text, status.length }, rc.x + TEXT_PADDING, rc.y + (rc.h - text.GetLineSpacing()) / 2, TEXT_FOREGROUND);
+		if (status.inside) {
+			// Show the colour under the cursor
+			int size = rc.h - 2 * TEXT_PADDING;
+			SDL_Colour opaque = { status.colour.r, status.colour.g, status.colour.b, 255 };
+			text.FillRect({ rc.x + rc.w - TEXT_PADDING - size, rc.y + TEXT_PADDING, size, size }, opaque);
+		}
+	}
+	if (SDL_Rect rc = GetHudRect(); !SDL_RectEmpty(&rc)) {
+		text.FillRect(rc, TEXT_BACKGROUND);
+		text.DrawString({ hud.text, hud.length }, rc.x + TEXT_PADDING, rc.y + (rc.h - text.GetLineSpacing()) / 2, TEXT_FOREGROUND);
+	}
+	if (SDL_Rect rc = GetCompareRect(); !SDL_RectEmpty(&rc)) {
+		text.FillRect(rc, TEXT_BACKGROUND);
+		text.DrawString({ compare.text, compare.length }, rc.x + TEXT_PADDING, rc.y + (rc.h - text.GetLineSpacing()) / 2, TEXT_FOREGROUND);
+	}
+	text.Flush();
+}
+
+void App::UpdateStats() {
+	// Toggle selection statistics
+	if (!GetCtrlKeyDown() && GetKeyPressed(SDL_Scancode::SDL_SCANCODE_I)) {
+		statsEnabled = !statsEnabled;
+	}
+
+	const ImageEntity* image = nullptr;
+	if (!statsEnabled || !TryGetVisibleImage(&image)) {
+		if (stats.Get() || stats.Busy()) {
+			stats.Clear();
+		}
+		statsPanel.lineCount = 0;
+		return;
+	}
+
+	// Shares ownership of every frame but points at the current one
+	const Image& img = image->image;
+	std::shared_ptr<const uint8_t> pixels = img.SharePixels();
+	size_t frameOffset = (size_t)img.GetWidth() * img.GetHeight() * 4 * image->currentTextureIndex;
+	uint64_t key = Fingerprint()
+		.Add(image->id)
+		.Add(image->generation)
+		.Add(image->currentTextureIndex)
+		.Get();
+	stats.Request(key, img.GetWidth(), img.GetHeight(),
+		std::shared_ptr<const uint8_t>(pixels, pixels.get() + frameOffset), GetSourceRect(*image));
+	stats.Update();
+
+	// Only format the panel when the result changes
+	const PixelStats* result = stats.Get();
+	bool busy = stats.Busy() || (result && result->key != key);
+	if (statsPanel.lineCount && statsPanel.sequence == stats.GetSequence() && statsPanel.busy == busy)
+		return;
+	statsPanel.sequence = stats.GetSequence();
+	statsPanel.busy = busy;
+	statsPanel.lineCount = 0;
+	statsPanel.bars = {};
+	auto addLine = [&](const char* format, auto... args) {
+		int i = statsPanel.lineCount++;
+		int length = std::snprintf(statsPanel.lines[i], sizeof(statsPanel.lines[i]), format, args...);
+		statsPanel.lengths[i] = std::clamp(length, 0, (int)sizeof(statsPanel.lines[i]) - 1);
+	};
+	if (!result) {
+		addLine("%s", "Computing statistics...");
+		return;
+	}
+
+	const SDL_Rect& rc = result->rect;
+	addLine("Area: %dx%d at (%d, %d)%s", rc.w, rc.h, rc.x, rc.y, busy ? " ..." : "");
+	addLine("Pixels: %llu | Transparent: %llu",
+		(unsigned long long)result->pixelCount,
+		(unsigned long long)result->transparentCount);
+	addLine("Unique colours: %s%llu", result->uniqueExact ? "" : "~", (unsigned long long)result->uniqueColours);
+	addLine("%s", "     Min  Max    Mean      SD");
+	for (int c = 0; c < 4; c++) {
+		const ChannelStats& ch = result->channels[c];
+		addLine("%c   %4d %4d %7.2f %7.2f", "RGBA"[c], ch.min, ch.max, ch.mean, ch.stddev);
+	}
+
+	// Colour channels share a scale so that they can be compared, alpha has its own
+	uint32_t colourPeak = 1;
+	uint32_t alphaPeak = 1;
+	for (int v = 0; v < 256; v++) {
+		for (int c = 0; c < 3; c++) {
+			colourPeak = std::max(colourPeak, result->histogram[c][v]);
+		}
+		alphaPeak = std::max(alphaPeak, result->histogram[3][v]);
+	}
+	for (int c = 0; c < 4; c++) {
+		uint64_t peak = c == 3 ? alphaPeak : colourPeak;
+		for (int v = 0; v < 256; v++) {
+			// Rounded up so that every colour that is present shows
+			uint64_t n = result->histogram[c][v];
+			statsPanel.bars[c][v] = (uint8_t)((n * STATS_HISTOGRAM_HEIGHT + peak - 1) / peak);
+		}
+	}
+}
+
+SDL_Rect App::GetStatsRect() const {
+	if (!statsEnabled || statsPanel.lineCount == 0)
+		return {};
+	auto [cw, ch] = GetClientSize();
+	int w = 256;
+	for (int i = 0; i < statsPanel.lineCount; i++) {
+		w = std::max(w, text.Measure({ statsPanel.lines[i], statsPanel.lengths[i] }));
+	}
+	w += 2 * TEXT_PADDING;
+	int h = statsPanel.lineCount * text.GetLineSpacing() + STATS_HISTOGRAM_HEIGHT + 3 * TEXT_PADDING;
+
+	// Sits on top of the status bar
+	SDL_Rect status = GetStatusRect();
+	int bottom = SDL_RectEmpty(&status) ? ch : status.y;
+	return { 0, bottom - h, w, h };
+}
+
+void App::DrawStats() const {
+	static const SDL_Colour BAR_COLOURS[] = {
+		{ 255, 64, 64, 140 },
+		{ 64, 255, 64, 140 },
+		{ 64, 96, 255, 140 },
+		{ 160, 160, 160, 100 },
+	};
+	SDL_Rect rc = GetStatsRect();
+	if (SDL_RectEmpty(&rc))
+		return;
+	text.FillRect(rc, TEXT_BACKGROUND);
+	int x = rc.x + TEXT_PADDING;
+	int y = rc.y + TEXT_PADDING;
+	for (int i = 0; i < statsPanel.lineCount; i++) {
+		text.DrawString({ statsPanel.lines[i], statsPanel.lengths[i] }, x, y, TEXT_FOREGROUND);
+		y += text.GetLineSpacing();
+	}
+
+	// Alpha behind the colour channels
+	int bottom = rc.y + rc.h - TEXT_PADDING;
+	for (int c : { 3, 0, 1, 2 }) {
+		for (int v = 0; v < 256; v++) {
+			if (int h = statsPanel.bars[c][v]) {
+				text.FillRect({ x + v, bottom - h, 1, h }, BAR_COLOURS[c]);
+			}
+		}
+	}
+	text.Flush();
+}
+
+void App::UpdateCompare() {
+	// Compare other images with the current one, or stop comparing
+	if (!GetCtrlKeyDown() && GetKeyPressed(SDL_Scancode::SDL_SCANCODE_X)) {
+		ImageEntity* image = nullptr;
+		if (TryGetCurrentImage(&image)) {
+			compare.referenceId = compare.referenceId == image->id ? 0 : image->id;
+		}
+	}
+	if (!GetCtrlKeyDown() && GetKeyPressed(SDL_Scancode::SDL_SCANCODE_M)) {
+		compare.mode = (CompareMode)(((int)compare.mode + 1) % (int)CompareMode::Count);
+	}
+	if (compare.referenceId && !images.Get(compare.referenceId)) {
+		compare.referenceId = 0;
+	}
+
+	ImageEntity* image = nullptr;
+	ImageEntity* reference = nullptr;
+	bool comparing = TryGetVisibleImage(&image) && TryGetCompareImage(&reference);
+	uint64_t pair = comparing ? Fingerprint().Add(image->id).Add(reference->id).Get() : 0;
+	if (pair != compare.pair) {
+		// The previous pair's heatmap would otherwise be shown until the new one is ready
+		if (comparer.Get() || comparer.Busy()) {
+			comparer.Clear();
+		}
+		if (compare.heatmap.Loaded()) {
+			textures.Release(compare.heatmap.id);
+			compare.heatmap.image = Image();
+		}
+		compare.pair = pair;
+		compare.length = 0;
+	}
+	if (!comparing)
+		return;
+
+	// Both images follow the current image's pan, zoom, rotation and flips
+	for (ImageEntity* other : { reference, &compare.heatmap }) {
+		auto& display = other->display;
+		display.x = image->display.x;
+		display.y = image->display.y;
+		display.scale = image->display.scale;
+		display.rotation = image->display.rotation;
+		display.animatedRotation = image->display.animatedRotation;
+		display.flipHorizontal = image->display.flipHorizontal;
+		display.flipVertical = image->display.flipVertical;
+	}
+	compare.showReference = (SDL_GetTicks64() / FLICKER_PERIOD) % 2 != 0;
+
+	// Compared again whenever either image reloads or animates
+	auto frame = [](const ImageEntity& entity) {
+		const Image& img = entity.image;
+		std::shared_ptr<const uint8_t> pixels = img.SharePixels();
+		size_t offset = (size_t)img.GetWidth() * img.GetHeight() * 4 * entity.currentTextureIndex;
+		return PixelSource{ img.GetWidth(), img.GetHeight(), std::shared_ptr<const uint8_t>(pixels, pixels.get() + offset) };
+	};
+	uint64_t key = Fingerprint()
+		.Add(image->id)
+		.Add(image->generation)
+		.Add(image->currentTextureIndex)
+		.Add(reference->id)
+		.Add(reference->generation)
+		.Add(reference->currentTextureIndex)
+		.Get();
+	comparer.Request(key, frame(*image), frame(*reference));
+	comparer.Update();
+	textures.SetScaleMode(compare.heatmap.id, GetScaleMode(*image));
+
+	// Only upload the heatmap and format the text when the result changes
+	const CompareResult* result = comparer.Get();
+	bool busy = comparer.Busy() || (result && result->key != key);
+	if (compare.length && compare.sequence == comparer.GetSequence() && compare.busy == busy)
+		return;
+	bool changed = compare.sequence != comparer.GetSequence();
+	compare.sequence = comparer.GetSequence();
+	compare.busy = busy;
+	static const char* const MODE_NAMES[] = { "Split", "Flicker", "Difference" };
+	static_assert(std::size(MODE_NAMES) == (size_t)CompareMode::Count);
+	const char* modeName = MODE_NAMES[(int)compare.mode];
+	int length = 0;
+	if (!result) {
+		length = std::snprintf(compare.text, sizeof(compare.text), "%s | Comparing with %s...",
+			modeName, reference->name.c_str());
+	} else {
+		if (changed && result->heatmap) {
+			// Drawn like any other image, the fourth byte of each pixel is always 255
+			compare.heatmap.image = Image(result->width, result->height, 3, result->heatmap);
+			compare.heatmap.generation++;
+			textures.Upload(compare.heatmap.id, compare.heatmap.image);
+		}
+		char psnr[32];
+		if (std::isinf(result->psnr)) {
+			std::snprintf(psnr, sizeof(psnr), "identical");
+		} else {
+			std::snprintf(psnr, sizeof(psnr), "%.2f dB", result->psnr);
+		}
+		uint64_t pixels = std::max<uint64_t>(1, (uint64_t)result->width * result->height);
+		length = std::snprintf(compare.text, sizeof(compare.text), "%s | vs %.40s | PSNR: %s | Max error: %d | Differing: %llu (%.2f%%)%s%s",
+			modeName,
+			reference->name.c_str(),
+			psnr,
+			result->maxError,
+			(unsigned long long)result->differingPixels,
+			100.0 * result->differingPixels / pixels,
+			result->sizesMatch ? "" : " | Sizes differ",
+			busy ? " ..." : "");
+	}
+	compare.length = std::clamp(length, 0, (int)sizeof(compare.text) - 1);
+}
+
+void App::UpdateViewFilter() {
+	if (!GetCtrlKeyDown()) {
+		// Cycle channel, or reset everything
+		if (GetKeyPressed(SDL_Scancode::SDL_SCANCODE_L)) {
+			if (GetShiftKeyDown()) {
+				viewFilter = {};
+				autoLevels = false;
+			} else {
+				viewFilter.channel = (ViewChannel)(((int)viewFilter.channel + 1) % (int)ViewChannel::Count);
+			}
+		}
+
+		// Toggle auto levels and false colour
+		if (GetKeyPressed(SDL_Scancode::SDL_SCANCODE_N)) {
+			autoLevels = !autoLevels;
+		}
+		if (GetKeyPressed(SDL_Scancode::SDL_SCANCODE_U)) {
+			viewFilter.falseColour = !viewFilter.falseColour;
+		}
+
+		// Move the black point, or the white point with shift. Starts from the auto levels if they were on.
+		int step = GetKeyPressed(SDL_Scancode::SDL_SCANCODE_PERIOD) - GetKeyPressed(SDL_Scancode::SDL_SCANCODE_COMMA);
+		if (step) {
+			if (autoLevels) {
+				viewFilter.black = filtered.applied.black;
+				viewFilter.white = filtered.applied.white;
+				autoLevels = false;
+			}
+			if (GetShiftKeyDown()) {
+				viewFilter.white = (uint8_t)std::clamp(viewFilter.white + step * LEVELS_STEP, viewFilter.black + 1, 255);
+			} else {
+				viewFilter.black = (uint8_t)std::clamp(viewFilter.black + step * LEVELS_STEP, 0, viewFilter.white - 1);
+			}
+		}
+	}
+
+	filtered.active = false;
+	ImageEntity* image = nullptr;
+	if (!TryGetVisibleImage(&image)) {
+		ReleaseFilteredFrame();
+		return;
+	}
+	const ImageEntity* reference = nullptr;
+	if (TryGetCompareImage(&reference))
+		return;
+
+	const Image& img = image->image;
+	// Shared with the filter jobs, which may outlive a reload
+	std::shared_ptr<const uint8_t> source(img.SharePixels(),
+		img.GetPixels() + (size_t)img.GetWidth() * img.GetHeight() * 4 * image->currentTextureIndex);
+	uint64_t sourceKey = Fingerprint()
+		.Add(image->id)
+		.Add(image->generation)
+		.Add(image->currentTextureIndex)
+		.Get();
+	SDL_Rect visible = GetVisibleSourceRect(*image).value_or(SDL_Rect{ 0, 0, img.GetWidth(), img.GetHeight() });
+
+	// Auto levels are measured again whenever different pixels come into view
+	filtered.applied = viewFilter;
+	if (autoLevels) {
+		uint64_t rangeKey = Fingerprint().Add(sourceKey).Add(viewFilter.channel).Add(visible).Get();
+		if (rangeKey != filtered.rangeKey) {
+			filtered.range = filtered.ranges.Find(sourceKey, viewFilter.channel, source.get(), img.GetWidth(), img.GetHeight(), visible, *loader);
+			filtered.rangeKey = rangeKey;
+		}
+		filtered.applied.black = (uint8_t)filtered.range.x;
+		filtered.applied.white = (uint8_t)std::max(filtered.range.y, std::min(filtered.range.x + 1, 255));
+	}
+	if (filtered.applied.IsIdentity()) {
+		// Keep the pixels while the image stays the same so that toggling back is quick
+		if (sourceKey != filtered.sourceKey) {
+			ReleaseFilteredFrame();
+		}
+		return;
+	}
+
+	// The texture is only created here, tiles are uploaded as they are filtered.
+	// Single channels, alpha included, are shown as opaque greyscale so they need no blending.
+	AlphaType alphaType = filtered.applied.channel == ViewChannel::All
+		? img.GetAlphaType(image->currentTextureIndex)
+		: AlphaType::Opaque;
+	bool reallocated = filtered.frame.SetSource(sourceKey, img.GetWidth(), img.GetHeight());
+	if (reallocated || !filtered.entity.Loaded()) {
+		filtered.entity.image = Image(img.GetWidth(), img.GetHeight(), filtered.frame.GetPixels(), alphaType);
+		filtered.alphaType = alphaType;
+		textures.Allocate(filtered.entity.id, filtered.entity.image);
+	} else if (alphaType != filtered.alphaType) {
+		// Same pixels, only the blending changes
+		filtered.entity.image = Image(img.GetWidth(), img.GetHeight(), filtered.frame.GetPixels(), alphaType);
+		filtered.alphaType = alphaType;
+		textures.UpdateBlendMode(filtered.entity.id, filtered.entity.image);
+	}
+	filtered.sourceKey = sourceKey;
+	textures.SetScaleMode(filtered.entity.id, GetScaleMode(*image));
+	filtered.entity.display = image->display;
+
+	// Uploaded tile by tile, a rect around them could span many tiles that haven't changed
+	std::vector<SDL_Rect> changed = filtered.frame.Update(filtered.applied, source, visible, *loader);
+	for (const SDL_Rect& rc : changed) {
+		textures.UpdateRect(filtered.entity.id, filtered.entity.image, rc);
+	}
+	if (!changed.empty()) {
+		filtered.entity.generation++;
+	}
+	// The unfiltered image is shown until the first pass over the view has finished
+	filtered.active = filtered.frame.Covers(visible);
+}
+
+void App::ReleaseFilteredFrame() {
+	if (!filtered.entity.Loaded())
+		return;
+	textures.Release(filtered.entity.id);
+	filtered.entity.image = Image();
+	filtered.frame.Reset();
+	filtered.sourceKey = 0;
+	filtered.rangeKey = 0;
+	filtered.ranges.Reset();
+}
+
+bool App::TryGetCompareImage(ImageEntity** image) {
+	ImageEntity* current = nullptr;
+	if (!compare.referenceId || !TryGetCurrentImage(&current) || current->id == compare.referenceId)
+		return false;
+	ImageEntity* reference = images.Get(compare.referenceId);
+	if (!reference || !reference->Loaded())
+		return false;
+	*image = reference;
+	return true;
+}
+
+bool App::TryGetCompareImage(const ImageEntity** image) const {
+	const ImageEntity* current = nullptr;
+	if (!compare.referenceId || !TryGetCurrentImage(&current) || current->id == compare.referenceId)
+		return false;
+	const ImageEntity* reference = images.Get(compare.referenceId);
+	if (!reference || !reference->Loaded())
+		return false;
+	*image = reference;
+	return true;
+}
+
+SDL_Rect App::GetCompareSplitRect() const {
+	auto [cw, ch] = GetClientSize();
+	int x = (int)std::lround(compare.split * cw);
+	return { x, 0, cw - x, ch };
+}
+
+bool App::MouseOverCompareDivider() const {
+	const ImageEntity* reference = nullptr;
+	if (compare.mode != CompareMode::Split || !TryGetCompareImage(&reference) || MouseOverSidebar())
+		return false;
+	return std::abs(GetMousePosition().x - GetCompareSplitRect().x) <= DIVIDER_GRAB_DISTANCE;
+}
+
+SDL_Rect App::GetCompareRect() const {
+	if (compare.length == 0)
+		return {};
+	int h = text.GetLineHeight();
+	int w = text.Measure({ compare.text, compare.length }) + 2 * TEXT_PADDING;
+	SDL_Rect hud = GetHudRect();
+	return { 0, hud.y + hud.h, w, h };
+}
+
 void App::UpdateActiveImage() {
 	ImageEntity* image = nullptr;
 	if (!TryGetVisibleImage(&image))
@@ -376,6 +1490,14 @@ void App::UpdateActiveImage() {
 		Zoom({ mx, my }, WHEEL_ZOOM_SPEED * scroll);
 	}
 
+	// Move the compare divider
+	else if (GetMousePressed(SDL_BUTTON_LEFT) && MouseOverCompareDivider()) {
+		compare.draggingSplit = true;
+	}
+	else if (GetMouseDown(SDL_BUTTON_LEFT) && compare.draggingSplit) {
+		compare.split = std::clamp((float)mx / GetClientSize().x, 0.0f, 1.0f);
+	}
+
 	// Begin pan
 	else if ((GetMousePressed(SDL_BUTTON_LEFT) || GetMousePressed(SDL_BUTTON_MIDDLE)) && !MouseOverSidebar()) {
 		dragged = true;
@@ -409,24 +1531,20 @@ void App::UpdateActiveImage() {
 		}
 	}
 
-	// Deselect
-	else if (GetKeyPressed(SDL_Scancode::SDL_SCANCODE_ESCAPE)) {
+	// Deselect, unless Escape dismisses the load errors instead
+	else if (GetKeyPressed(SDL_Scancode::SDL_SCANCODE_ESCAPE) && loadErrors.lines.empty()) {
 		display.selectFrom = { -1, -1 };
 		display.selectTo = { -1, -1 };
 	}
 
 	// Reload
-	else if (GetCtrlKeyDown() && GetKeyDown(SDL_Scancode::SDL_SCANCODE_R)) {
+	else if (GetCtrlKeyDown() && GetKeyPressed(SDL_Scancode::SDL_SCANCODE_R)) {
 		ReloadImage(*image);
 	}
 
 	// Toggle antialiasing
 	else if (GetKeyPressed(SDL_Scancode::SDL_SCANCODE_P)) {
-		antialiasing = !antialiasing;
-		SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, antialiasing ? "2" : "0");
-		for (auto& image : images) {
-			ReloadImage(image);
-		}
+		antialiasing = !antialiasing; // Applied to the textures on the next frame
 	}
 
 	// Copy to clipboard
@@ -474,6 +1592,9 @@ void App::UpdateActiveImage() {
 	if (!dragged) {
 		dragLocation = std::nullopt;
 	}
+	if (!GetMouseDown(SDL_BUTTON_LEFT)) {
+		compare.draggingSplit = false;
+	}
 
 	// Animate rotation smoothly
 	float dist = std::abs(display.animatedRotation - display.rotation);
@@ -489,16 +1610,75 @@ void App::UpdateActiveImage() {
 		}
 		display.animatedRotation = std::lerp(display.animatedRotation, (float)display.rotation, 0.2f);
 	}
+}
 
-	// Draw image
-	if (image->image.GetChannels() == 4 && display.animatedRotation == display.rotation) {
+void App::DrawActiveImage(const SDL_Rect& clip) const {
+	const ImageEntity* image = nullptr;
+	if (!TryGetVisibleImage(&image))
+		return;
+	const auto& display = image->display;
+
+	// Draw image, or the images being compared
+	const ImageEntity* reference = nullptr;
+	if (!TryGetCompareImage(&reference)) {
+		DrawImage(filtered.active ? filtered.entity : *image, clip);
+	} else if (compare.mode == CompareMode::Split) {
+		// The reference covers the right of the divider
+		DrawImage(*image, clip);
+		SDL_Rect right = GetCompareSplitRect();
+		SDL_Rect part{};
+		if (SDL_IntersectRect(&clip, &right, &part)) {
+			SDL_RenderSetClipRect(GetRenderer(), &part);
+			DrawImage(*reference, part);
+			SDL_RenderSetClipRect(GetRenderer(), &clip);
+		}
+	} else if (compare.mode == CompareMode::Flicker) {
+		DrawImage(compare.showReference ? *reference : *image, clip);
+	} else {
+		DrawImage(compare.heatmap.Loaded() ? compare.heatmap : *image, clip);
+	}
+
+	// The compositor draws the overlays itself
+	if (!compositor || display.animatedRotation != display.rotation) {
+		// Draw grid
+		if (gridEnabled) {
+			DrawGrid();
+		}
+
+		// Draw selection
+		if (SDL_Rect dst = GetSelectionScreenRect(); !SDL_RectEmpty(&dst)) {
+			SDL_SetRenderDrawColor(GetRenderer(), 0, 0, 0, 100);
+			SDL_RenderFillRect(GetRenderer(), &dst);
+			SDL_SetRenderDrawColor(GetRenderer(), 200, 200, 200, 200);
+			SDL_RenderDrawRect(GetRenderer(), &dst);
+		}
+	}
+
+	// Draw the divider
+	if (reference && compare.mode == CompareMode::Split) {
+		SDL_Rect right = GetCompareSplitRect();
+		SDL_Rect line = { right.x - 1, 0, 2, right.h };
+		SDL_SetRenderDrawColor(GetRenderer(), 230, 230, 230, 255);
+		SDL_RenderFillRect(GetRenderer(), &line);
+	}
+}
+
+void App::DrawImage(const ImageEntity& image, const SDL_Rect& clip) const {
+	const auto& display = image.display;
+	if (compositor && display.animatedRotation == display.rotation) {
+		// Includes the overlays
+		DrawComposited(image, clip);
+		return;
+	}
+	bool opaque = image.image.GetAlphaType(image.currentTextureIndex) == AlphaType::Opaque;
+	if (!opaque && display.animatedRotation == display.rotation) {
 		DrawAlphaBackground();
 	}
 	SDL_Rect dst = {
 		(int)display.x,
 		(int)display.y,
-		(int)(display.scale * image->image.GetWidth()),
-		(int)(display.scale * image->image.GetHeight()),
+		(int)(display.scale * image.image.GetWidth()),
+		(int)(display.scale * image.image.GetHeight()),
 	};
 	std::underlying_type_t<SDL_RendererFlip> flip = SDL_RendererFlip::SDL_FLIP_NONE;
 	if (display.flipHorizontal)
@@ -506,37 +1686,180 @@ void App::UpdateActiveImage() {
 	if (display.flipVertical)
 		flip |= SDL_RendererFlip::SDL_FLIP_VERTICAL;
 
-	SDL_RenderCopyEx(
-		GetRenderer(),
-		image->GetTexture(),
-		nullptr,
-		&dst,
-		90 * display.animatedRotation,
-		nullptr,
-		(SDL_RendererFlip)flip);
+	if (auto src = GetVisibleSourceRect(image)) {
+		// Only draw the part of the image that covers the window so that the renderer
+		// doesn't have to clip a quad that is millions of pixels wide when zoomed in.
+		// The sub-rect is positioned and rotated exactly as if the whole image was drawn.
+		if (!SDL_RectEmpty(&*src)) {
+			int w = image.image.GetWidth();
+			int h = image.image.GetHeight();
+			float sx = (float)dst.w / w;
+			float sy = (float)dst.h / h;
+			int ox = display.flipHorizontal ? w - src->x - src->w : src->x;
+			int oy = display.flipVertical ? h - src->y - src->h : src->y;
+			SDL_FRect part = { dst.x + ox * sx, dst.y + oy * sy, src->w * sx, src->h * sy };
+			SDL_FPoint centre = { dst.x + dst.w / 2.0f - part.x, dst.y + dst.h / 2.0f - part.y };
+			SDL_RenderCopyExF(
+				GetRenderer(),
+				GetTexture(image),
+				&*src,
+				&part,
+				90 * display.animatedRotation,
+				&centre,
+				(SDL_RendererFlip)flip);
+		}
+	} else {
+		SDL_RenderCopyEx(
+			GetRenderer(),
+			GetTexture(image),
+			nullptr,
+			&dst,
+			90 * display.animatedRotation,
+			nullptr,
+			(SDL_RendererFlip)flip);
+	}
+}
+
+std::optional<SDL_Rect> App::GetVisibleSourceRect(const ImageEntity& image) const {
+	// The thumbnail doesn't share the image's coordinates and ScreenToImagePosition
+	// only handles whole quarter turns
+	if (!textures.Get(image.id, image.currentTextureIndex) || image.display.animatedRotation != image.display.rotation)
+		return std::nullopt;
 
-	// Draw grid
-	if (gridEnabled) {
-		DrawGrid();
+	auto [cw, ch] = GetClientSize();
+	SDL_Point corners[] = {
+		ScreenToImagePosition({ 0, 0 }),
+		ScreenToImagePosition({ cw - 1, 0 }),
+		ScreenToImagePosition({ 0, ch - 1 }),
+		ScreenToImagePosition({ cw - 1, ch - 1 }),
+	};
+	int minX = corners[0].x, maxX = corners[0].x;
+	int minY = corners[0].y, maxY = corners[0].y;
+	for (const SDL_Point& p : corners) {
+		minX = std::min(minX, p.x);
+		maxX = std::max(maxX, p.x);
+		minY = std::min(minY, p.y);
+		maxY = std::max(maxY, p.y);
+	}
+
+	// Include a pixel either side for rounding and filtering
+	SDL_Rect visible = { minX - 1, minY - 1, maxX - minX + 3, maxY - minY + 3 };
+	SDL_Rect bounds = { 0, 0, image.image.GetWidth(), image.image.GetHeight() };
+	SDL_Rect src{};
+	if (!SDL_IntersectRect(&visible, &bounds, &src))
+		return SDL_Rect{};
+	return src;
+}
+
+void App::DrawPixelValues(const SDL_Rect& clip) const {
+	const ImageEntity* image = nullptr;
+	if (!TryGetVisibleImage(&image))
+		return;
+	const auto& display = image->display;
+	if (display.scale < PIXEL_VALUES_MIN_SCALE || display.animatedRotation != display.rotation)
+		return;
+	auto src = GetVisibleSourceRect(*image);
+	if (!src || SDL_RectEmpty(&*src))
+		return;
+
+	int advance = valueText.GetAdvance();
+	int spacing = valueText.GetLineSpacing();
+	for (int y = src->y; y < src->y + src->h; y++) {
+		for (int x = src->x; x < src->x + src->w; x++) {
+			SDL_Rect cell = RectFromPoints(ImageToScreenPosition({ x, y }), ImageToScreenPosition({ x + 1, y + 1 }));
+			if (!SDL_HasIntersection(&cell, &clip))
+				continue;
+
+			SDL_Colour colour = image->image.GetPixel(x, y, image->currentTextureIndex);
+			const PixelLabel& label = pixelLabels.Get(colourFormatter, colour);
+			int w = label.maxLength * advance;
+			int h = label.lineCount * spacing;
+			if (w + 2 > cell.w || h + 2 > cell.h)
+				continue; // Doesn't fit at this zoom
+
+			// Dark text on light pixels. Transparent pixels are mostly over the light checkerboard.
+			int luma = (299 * colour.r + 587 * colour.g + 114 * colour.b) / 1000;
+			luma = (luma * colour.a + 223 * (255 - colour.a)) / 255;
+			SDL_Colour ink = luma > 140 ? SDL_Colour{ 0, 0, 0, 255 } : SDL_Colour{ 255, 255, 255, 255 };
+
+			int top = cell.y + (cell.h - h) / 2;
+			for (int i = 0; i < label.lineCount; i++) {
+				std::string_view line = label.GetLine(i);
+				int left = cell.x + (cell.w - (int)line.size() * advance) / 2;
+				valueText.DrawString(line, left, top + i * spacing, ink);
+			}
+		}
 	}
+	valueText.Flush();
+}
+
+SDL_Rect App::GetSelectionScreenRect() const {
+	const ImageEntity* image = nullptr;
+	if (!TryGetVisibleImage(&image) || image->display.selectTo.x == -1)
+		return {};
+	SDL_Rect selection = RectFromPoints(image->display.selectFrom, image->display.selectTo);
+	SDL_Point topLeft = ImageToScreenPosition({ selection.x, selection.y });
+	SDL_Point bottomRight = ImageToScreenPosition(
+		{ selection.x + selection.w + 1,
+		selection.y + selection.h + 1 });
+	return RectFromPoints(topLeft, bottomRight);
+}
+
+void App::DrawComposited(const ImageEntity& image, const SDL_Rect& clip) const {
+	const auto& display = image.display;
+	const Image& img = image.image;
+	CompositorView view;
+	view.pixels = img.GetPixels() + (size_t)img.GetWidth() * (size_t)img.GetHeight() * image.currentTextureIndex * 4;
+	view.width = img.GetWidth();
+	view.height = img.GetHeight();
+	view.x = display.x;
+	view.y = display.y;
+	view.scale = display.scale;
+	view.rotation = display.rotation;
+	view.flipHorizontal = display.flipHorizontal;
+	view.flipVertical = display.flipVertical;
+	view.bilinear = GetScaleMode(image) != SDL_ScaleModeNearest;
+	AlphaType alphaType = img.GetAlphaType(image.currentTextureIndex);
+	view.opaque = alphaType == AlphaType::Opaque;
+	// Bilinear filtering mixes the alpha at the edges of the holes
+	view.binaryAlpha = alphaType == AlphaType::Binary && !view.bilinear;
+	view.checkerboard = !view.opaque;
+	SDL_Rect rc = GetImageRect();
+	view.checkerOrigin = { rc.x, rc.y };
+	view.gridAlpha = GetGridAlpha(display.scale);
+	view.selection = GetSelectionScreenRect();
+	auto [cw, ch] = GetClientSize();
+	compositor->Draw(view, cw, ch, clip);
+}
+
+float App::LayoutSidebar() {
+	auto [cw, ch] = GetClientSize();
+	sidebarRect = {
+		cw - (int)(SIDEBAR_WIDTH * sidebarAnimatedPosition),
+		0,
+		SIDEBAR_WIDTH,
+		ch
+	};
+
+	sidebarIcons.resize(imageOrder.size());
+	float y = 0;
+	for (size_t i = 0; i < imageOrder.size(); i++) {
+		SDL_Rect& rc = sidebarIcons[i];
+		rc.w = SIDEBAR_WIDTH - 2 * SIDEBAR_BORDER;
+		rc.x = sidebarRect.x + SIDEBAR_BORDER;
+		rc.y = (int)(y - sidebarScroll) + SIDEBAR_BORDER;
+		rc.h = (int)(rc.w / images.Get(imageOrder[i])->image.GetAspectRatio());
 
-	// Draw selection
-	if (display.selectTo.x != -1) {
-		SDL_Rect selection = RectFromPoints(display.selectFrom, display.selectTo);
-		SDL_Point topLeft = ImageToScreenPosition({ selection.x, selection.y });
-		SDL_Point bottomRight = ImageToScreenPosition(
-			{ selection.x + selection.w + 1,
-			selection.y + selection.h + 1 });
-		SDL_Rect dst = RectFromPoints(topLeft, bottomRight);
-		SDL_SetRenderDrawColor(GetRenderer(), 0, 0, 0, 100);
-		SDL_RenderFillRect(GetRenderer(), &dst);
-		SDL_SetRenderDrawColor(GetRenderer(), 200, 200, 200, 200);
-		SDL_RenderDrawRect(GetRenderer(), &dst);
+		// Don't increment y on the last iteration because
+		// this value of y is used as a bound for scrolling.
+		if (i < imageOrder.size() - 1) {
+			y += SIDEBAR_BORDER + rc.h;
+		}
 	}
+	return y;
 }
 
 void App::UpdateSidebar() {
-	auto [cw, ch] = GetClientSize();
 	float scroll = GetScrollDelta();
 
 	// Toggle sidebar
@@ -544,6 +1867,11 @@ void App::UpdateSidebar() {
 		sidebarEnabled = !sidebarEnabled;
 	}
 
+	// Group duplicates
+	if (!GetCtrlKeyDown() && GetKeyPressed(SDL_Scancode::SDL_SCANCODE_D) && !reorderFrom) {
+		GroupDuplicates();
+	}
+
 	// Animate sidebar
 	float animationTargetValue = (float)sidebarEnabled;
 	if (std::abs(animationTargetValue - sidebarAnimatedPosition) < 0.001f) {
@@ -552,136 +1880,195 @@ void App::UpdateSidebar() {
 		sidebarAnimatedPosition = std::lerp(sidebarAnimatedPosition, animationTargetValue, 0.2f);
 	}
 
+	hoverImage = 0;
+	reorderLineY = std::nullopt;
 	if (sidebarAnimatedPosition == 0.0f) {
+		sidebarRect = {};
+		sidebarIcons.clear();
 		return;
 	}
 
-	// Draw background
-	SDL_Rect sbRc = {
-		cw - (int)(SIDEBAR_WIDTH * sidebarAnimatedPosition),
-		0,
-		SIDEBAR_WIDTH,
-		ch
-	};
-	SDL_SetRenderDrawColor(GetRenderer(), 40, 40, 40, 200);
-	SDL_RenderFillRect(GetRenderer(), &sbRc);
-
-	// Mini icons
-	hoverImageIndex = std::nullopt;
-	bool reorderLineDrawn = false;
-	float y = 0;
-	for (size_t i = 0; i < images.size(); i++) {
-		const auto& image = images[i];
+	float maxScroll = LayoutSidebar();
 
-		float screenY = y - sidebarScroll;
-		SDL_Rect rc{};
-		rc.w = SIDEBAR_WIDTH - 2 * SIDEBAR_BORDER;
-		rc.x = sbRc.x + SIDEBAR_BORDER;
-		rc.y = (int)screenY + SIDEBAR_BORDER;
-		rc.h = (int)(rc.w / image.image.GetAspectRatio());
-		if (image.GetTexture()) {
-			SDL_RenderCopy(GetRenderer(), image.GetTexture(), nullptr, &rc);
-		} else {
-			// Texture hasn't loaded yet so fill with placeholder
-			SDL_SetRenderDrawColor(GetRenderer(), 0, 0, 0, 255);
-			SDL_RenderFillRect(GetRenderer(), &rc);
-		}
+	if (MouseOverSidebar()) {
+		SDL_Point mp = GetMousePosition();
+		size_t active = GetImagePosition(activeImage);
+		for (size_t i = 0; i < imageOrder.size(); i++) {
+			const SDL_Rect& rc = sidebarIcons[i];
 
-		// Highlight if cursor is over icon
-		if (MouseOverSidebar()) {
-			SDL_Point mp = GetMousePosition();
+			// Hover over icon
 			SDL_Rect hitbox = {
-				sbRc.x,
-				(int)screenY + SIDEBAR_BORDER / 2,
-				sbRc.w,
+				sidebarRect.x,
+				rc.y - SIDEBAR_BORDER / 2,
+				sidebarRect.w,
 				rc.h + SIDEBAR_BORDER,
 			};
 			if (SDL_PointInRect(&mp, &hitbox)) {
-				SDL_SetRenderDrawColor(GetRenderer(), 150, 150, 150, 255);
-				SDL_RenderDrawRect(GetRenderer(), &rc);
-				hoverImageIndex = i;
+				hoverImage = imageOrder[i];
 				if (GetMousePressed(SDL_BUTTON_LEFT)) {
 					// Selected a different image
-					activeImageIndex = i;
-					reorderFrom = i;
+					activeImage = imageOrder[i];
+					active = i;
+					reorderFrom = imageOrder[i];
 				}
 			}
-			
-			// Draw reorder line
+
+			// Find where the dragged image would be moved to
 			hitbox.y -= hitbox.h / 2;
-			if (GetMouseDown(SDL_BUTTON_LEFT) && reorderFrom && !reorderLineDrawn && activeImageIndex != i && activeImageIndex + 1 != i) {
-				SDL_SetRenderDrawColor(GetRenderer(), 255, 255, 255, 255);
+			if (GetMouseDown(SDL_BUTTON_LEFT) && reorderFrom && !reorderLineY && active != i && active + 1 != i) {
 				if (SDL_PointInRect(&mp, &hitbox)) {
-					int y = (int)screenY + SIDEBAR_BORDER / 2;
-					SDL_RenderDrawLine(GetRenderer(), rc.x, y, rc.x + rc.w, y);
-					reorderLineDrawn = true;
+					reorderLineY = rc.y - SIDEBAR_BORDER / 2;
 					reorderTo = i;
-				} else if (i == images.size() - 1 && mp.y >= hitbox.y + hitbox.h) {
-					int y = (int)screenY + SIDEBAR_BORDER / 2 + hitbox.h;
-					SDL_RenderDrawLine(GetRenderer(), rc.x, y, rc.x + rc.w, y);
-					reorderLineDrawn = true;
+				} else if (i == imageOrder.size() - 1 && mp.y >= hitbox.y + hitbox.h) {
+					reorderLineY = rc.y - SIDEBAR_BORDER / 2 + hitbox.h;
 					reorderTo = i + 1;
 				}
 			}
 		}
-
-		// Highlight if image is active
-		if (activeImageIndex == i) {
-			SDL_SetRenderDrawColor(GetRenderer(), 255, 255, 255, 255);
-			SDL_RenderDrawRect(GetRenderer(), &rc);
-		}
-
-		// Don't increment y on the last iteration because
-		// this value of y is used as a bound for scrolling.
-		if (i < images.size() - 1) {
-			y += SIDEBAR_BORDER + rc.h;
-		}
 	}
-	
+
 	// Reorder images
 	if (GetMouseReleased(SDL_BUTTON_LEFT)) {
-		if (reorderTo) {
-			if (reorderTo.value() > reorderFrom.value()) {
+		// Only the handle moves, the dragged image may have been closed in the meantime
+		size_t from = GetImagePosition(reorderFrom);
+		if (reorderTo && from < imageOrder.size()) {
+			if (reorderTo.value() > from) {
 				reorderTo.value()--;
 			}
-			ImageEntity moved = std::move(images[reorderFrom.value()]);
-			images.erase(images.begin() + reorderFrom.value());
-			images.insert(images.begin() + reorderTo.value(), std::move(moved));
+			imageOrder.erase(imageOrder.begin() + from);
+			// Other images may have been closed since the target was picked
+			size_t to = std::min(reorderTo.value(), imageOrder.size());
+			imageOrder.insert(imageOrder.begin() + to, reorderFrom);
 		}
-		reorderFrom = std::nullopt;
+		reorderFrom = 0;
 		reorderTo = std::nullopt;
 	}
 
 	// Scroll sidebar
 	if (MouseOverSidebar()) {
 		sidebarScroll -= scroll * 1000;
-		sidebarScroll = std::clamp(sidebarScroll, 0.0f, y);
+		sidebarScroll = std::clamp(sidebarScroll, 0.0f, maxScroll);
+	}
+
+	// Images may have moved
+	LayoutSidebar();
+}
+
+SDL_Texture* App::GetSidebarIcon(const ImageEntity& image) const {
+	SDL_Texture* icon = textures.GetThumbnail(image.id);
+	if (image.image.GetFrameCount() > 1 || !icon) {
+		// Animate resident gifs
+		icon = GetTexture(image);
+	}
+	return icon;
+}
+
+void App::DrawSidebar() const {
+	if (SDL_RectEmpty(&sidebarRect))
+		return;
+
+	// Draw background
+	SDL_SetRenderDrawColor(GetRenderer(), 40, 40, 40, 200);
+	SDL_RenderFillRect(GetRenderer(), &sidebarRect);
+
+	// Mini icons
+	for (size_t i = 0; i < std::min(imageOrder.size(), sidebarIcons.size()); i++) {
+		const SDL_Rect& rc = sidebarIcons[i];
+		if (rc.y >= sidebarRect.h || rc.y + rc.h < 0)
+			continue;
+
+		const ImageEntity& image = *images.Get(imageOrder[i]);
+		if (SDL_Texture* icon = GetSidebarIcon(image)) {
+			SDL_RenderCopy(GetRenderer(), icon, nullptr, &rc);
+		} else {
+			// Texture hasn't loaded yet so fill with placeholder
+			SDL_SetRenderDrawColor(GetRenderer(), 0, 0, 0, 255);
+			SDL_RenderFillRect(GetRenderer(), &rc);
+		}
+
+		// Highlight if cursor is over icon
+		if (hoverImage == image.id) {
+			SDL_SetRenderDrawColor(GetRenderer(), 150, 150, 150, 255);
+			SDL_RenderDrawRect(GetRenderer(), &rc);
+		}
+
+		// Highlight if image is active
+		if (activeImage == image.id) {
+			SDL_SetRenderDrawColor(GetRenderer(), 255, 255, 255, 255);
+			SDL_RenderDrawRect(GetRenderer(), &rc);
+		}
+
+		// Mark duplicates with the colour of their group
+		if (DuplicateInfo duplicates = imageIndex.GetDuplicates(image.id); duplicates.group) {
+			int size = text.GetLineHeight();
+			SDL_Rect marker = { rc.x + 2, rc.y + 2, size, size };
+			text.FillRect(marker, GetDuplicateColour(duplicates.group));
+			const char* label = duplicates.exact ? "=" : "~";
+			text.DrawString(label, marker.x + (size - text.Measure(label)) / 2, marker.y + (size - text.GetLineSpacing()) / 2, TEXT_FOREGROUND);
+		}
+	}
+	text.Flush();
+
+	// Draw reorder line
+	if (reorderLineY) {
+		int x = sidebarRect.x + SIDEBAR_BORDER;
+		int w = SIDEBAR_WIDTH - 2 * SIDEBAR_BORDER;
+		SDL_SetRenderDrawColor(GetRenderer(), 255, 255, 255, 255);
+		SDL_RenderDrawLine(GetRenderer(), x, reorderLineY.value(), x + w, reorderLineY.value());
 	}
 }
 
 void App::UpdateImageLoading() {
 	// Check messages from network
 	if (msgServer) {
-		for (const auto& msg : msgServer->GetMessages()) {
-			QueueFileLoad(msg);
+		for (auto& request : msgServer->GetRequests()) {
+			HandleRequest(request);
+		}
+		UpdatePushes();
+	}
+
+	if (watcher) {
+		UpdateFileWatcher();
+	}
+
+	// Open the files chosen in the open file dialog
+	if (openDialog.valid() && openDialog.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+		for (auto& path : openDialog.get()) {
+			QueueFileLoad(std::move(path));
 		}
 	}
 
+	UpdatePathResolution();
+
 	// Check if any discarded futures have finished loading
 	for (auto it = discardedFutures.begin(); it != discardedFutures.end(); ++it) {
-		if ((*it)->wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+		if (it->wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
 			activeLoadThreads--;
-			delete *it;
 			it = discardedFutures.erase(it);
 			if (it == discardedFutures.end())
 				break;
 		}
 	}
 
+	// Undo the watches of paths that finished resolving after their image was closed
+	for (auto it = discardedResolves.begin(); it != discardedResolves.end(); ) {
+		if (it->wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+			++it;
+			continue;
+		}
+		try {
+			ResolvedFile file = it->get();
+			if (watcher && file.error.empty()) {
+				watcher->Unwatch(file.fullPath);
+			}
+		} catch (std::future_error&) {}
+		it = discardedResolves.erase(it);
+	}
+
 	// Check if any futures have finished loading
-	for (size_t i = 0; i < images.size(); i++) {
-		auto& image = images[i];
-		if (!image.future.valid())
+	for (size_t i = 0; i < imageOrder.size(); i++) {
+		auto& image = *images.Get(imageOrder[i]);
+		if (!image.future.valid() || image.resolving.valid())
 			continue;
 
 		// Check if image has loaded
@@ -690,40 +2077,42 @@ void App::UpdateImageLoading() {
 		activeLoadThreads--;
 
 		// Check for errors
-		Image img = image.future.get();
+		Image img;
+		try {
+			img = image.future.get();
+		} catch (std::future_error&) {
+			// The job was discarded before it ran
+		}
+		if (!img.Valid() && image.Loaded()) {
+			// A reload failed, keep showing the previous version.
+			// Files that are still being written are picked up again on the next change.
+			if (!image.reloadQuiet && !bench) {
+				AddLoadError(image.fullPath + ": " + img.Error() + " (the previous version is still shown)");
+			}
+			continue;
+		}
 		if (!img.Valid()) {
-			std::string msg = "Cannot load " + image.fullPath
-				+ ".\nReason: " + img.Error() + ".";
-			SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Error", msg.c_str(), GetWindow());
-			DeleteImage(images.data() + i);
+			FailLoad(image, img.Error());
 			i--;
 			continue;
 		}
-		
-		for (size_t n = 0; n < img.GetFrameCount(); n++) {
-			// Create surface
-			SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormatFrom(
-				(void*)(img.GetPixels() + (size_t)img.GetWidth() * (size_t)img.GetHeight() * n * 4),
-				img.GetWidth(),
-				img.GetHeight(),
-				32,
-				img.GetWidth() * 4,
-				SDL_PixelFormatEnum::SDL_PIXELFORMAT_ABGR8888);
-			if (!surface)
-				throw SDLException();
-
-			// Create texture
-			SDL_Texture* texture = SDL_CreateTextureFromSurface(GetRenderer(), surface);
-			SDL_FreeSurface(surface);
-			if (!texture)
-				throw SDLException();
-
-			image.textures.push_back(texture);
+
+		// Full resolution textures are uploaded by UpdateResidency once the image is needed.
+		// If they are already resident, the previous version was kept until now so that a reload doesn't flash.
+		const Image* thumbnail = img.GetThumbnail();
+		textures.UploadThumbnail(image.id, thumbnail ? *thumbnail : img);
+		if (textures.HasFrames(image.id)) {
+			textures.Upload(image.id, img);
 		}
 		
 		image.image = std::move(img);
 		image.currentTextureIndex = 0;
+		image.generation++;
 		image.openTime = SDL_GetTicks64();
+		ResolveAck(image, Result::Ok, image.fullPath);
+		if (image.indexed) {
+			image.hashJob = HashAsync(*loader, image.image);
+		}
 		
 		// If the image was reloaded, it might have a selection area
 		// outside the image's bounds.
@@ -738,52 +2127,356 @@ void App::UpdateImageLoading() {
 		if (!image.wasReloaded) {
 			ResetTransform(image);
 
-			activeImageIndex = i;
+			activeImage = image.id;
+		}
+
+		if (bench) {
+			// Activate one image per frame so that every image gets
+			// shown and its first present can be measured.
+			break;
 		}
 	}
 
-	// Begin loading images that haven't been loaded yet
-	for (auto it = images.begin(); it != images.end(); ++it) {
-		if (!it->GetTexture() && !it->future.valid()) {
-			// Skip if image is already open
-			auto match = [&](const ImageEntity& im) { return im.fullPath == it->fullPath; };
-			if (std::any_of(images.begin(), it, match)) {
-				it = DeleteImage(&*it);
-				if (it == images.end())
-					break;
-				continue;
-			}
+	// Begin loading images that haven't been loaded yet.
+	// The current batch of load errors ends once nothing is left loading.
+	loadErrors.batchDone = true;
+	for (size_t i = 0; i < imageOrder.size(); i++) {
+		ImageEntity& image = *images.Get(imageOrder[i]);
+		if (!image.Loaded() || image.future.valid() || image.reloadPending) {
+			loadErrors.batchDone = false;
+		}
+		if (image.resolving.valid())
+			continue;
 
+		bool reload = image.reloadPending && image.Loaded();
+		if ((!image.Loaded() || reload) && !image.future.valid()) {
 			if (activeLoadThreads >= maxLoadThreads)
 				break;
 
-			it->future = std::async(std::launch::async, [path = it->fullPath] {
-				return Image(path.c_str());
-				});
+			if (reload && image.watched) {
+				// Started along with the decode so that a change while decoding is still noticed
+				CheckSignature(image, true);
+			}
+			image.future = DecodeAsync(*loader, image.fullPath, bench);
+			image.reloadPending = false;
 			activeLoadThreads++;
 		}
 	}
 }
 
-std::vector<ImageEntity>::iterator App::DeleteImage(ImageEntity* image) {
+void App::UpdatePathResolution() {
+	for (size_t i = 0; i < imageOrder.size(); i++) {
+		ImageEntity& image = *images.Get(imageOrder[i]);
+		if (!image.resolving.valid()
+			|| image.resolving.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			continue;
+
+		ResolvedFile file = image.resolving.get();
+		if (!file.error.empty()) {
+			if (bench) {
+				bench->DecodeFinished(image.fullPath, "Cannot load: " + file.error);
+			}
+			FailLoad(image, file.error);
+			i--;
+			continue;
+		}
+		image.fullPath = std::move(file.fullPath);
+		image.name = std::move(file.name);
+		image.identity = file.identity;
+		if (bench) {
+			bench->FileQueued(image.fullPath);
+		}
+		if (watcher) {
+			// Watched by the resolve job
+			image.watched = true;
+			CheckSignature(image, true);
+		}
+
+		// Skip if the file is already open, possibly through a different path or a hard link.
+		// Decodes that were started before the app was created are kept either way.
+		image.indexed = true;
+		if (uint64_t existing = imageIndex.AddFile(image.id, image.fullPath, image.identity); existing && !image.future.valid()) {
+			// Opening a file that is already open shows it instead
+			bool active = activeImage == image.id;
+			ResolveAck(image, Result::Duplicate, image.fullPath);
+			DeleteImage(&image);
+			if (active) {
+				activeImage = existing;
+			}
+			i--;
+		}
+	}
+}
+
+void App::UpdateDuplicates() {
+	for (uint64_t id : imageOrder) {
+		ImageEntity& image = *images.Get(id);
+		if (!image.hashJob.valid()
+			|| image.hashJob.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			continue;
+		try {
+			imageIndex.SetHashes(image.id, image.hashJob.get());
+		} catch (std::future_error&) {
+			// The job was discarded before it ran
+		}
+	}
+	imageIndex.Regroup();
+}
+
+void App::GroupDuplicates() {
+	// Images are ranked by the position of the first image in their group,
+	// so everything that isn't a duplicate keeps its place
+	std::unordered_map<uint32_t, size_t> firsts;
+	std::vector<std::pair<size_t, uint64_t>> ranked;
+	for (size_t i = 0; i < imageOrder.size(); i++) {
+		uint32_t group = imageIndex.GetDuplicates(imageOrder[i]).group;
+		ranked.push_back({ group ? firsts.try_emplace(group, i).first->second : i, imageOrder[i] });
+	}
+	std::stable_sort(ranked.begin(), ranked.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+	for (size_t i = 0; i < ranked.size(); i++) {
+		imageOrder[i] = ranked[i].second;
+	}
+}
+
+void App::UpdateFileWatcher() {
+	std::vector<std::string> changed;
+	std::vector<std::string> created;
+	watcher->Poll(changed, created);
+
+	for (const auto& path : changed) {
+		if (ImageEntity* image = images.Get(imageIndex.FindFile(path))) {
+			CheckSignature(*image, false);
+		}
+	}
+	for (uint64_t id : imageOrder) {
+		ImageEntity& image = *images.Get(id);
+		if (!image.signatureCheck.valid()
+			|| image.signatureCheck.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			continue;
+		FileSignature sig{};
+		try {
+			sig = image.signatureCheck.get();
+		} catch (std::future_error&) {}
+		bool baseline = image.signatureBaseline;
+		if (image.signatureRecheck) {
+			image.signatureRecheck = false;
+			CheckSignature(image, false);
+		}
+		if (!sig.valid)
+			continue;
+		if (baseline) {
+			image.signature = sig;
+			continue;
+		}
+		bool modified = !image.signature.valid || sig.size != image.signature.size || sig.hash != image.signature.hash;
+		image.signature = sig;
+		if (modified) {
+			ReloadImage(image, true);
+		}
+	}
+
+	// New images in watched directories
+	for (auto& path : created) {
+		QueueFileLoad(std::move(path));
+	}
+}
+
+void App::CheckSignature(ImageEntity& image, bool baseline) {
+	if (!watcher)
+		return;
+	if (image.signatureCheck.valid()) {
+		image.signatureRecheck |= !baseline;
+		return;
+	}
+	// Reads the whole file unless the size and modification time match, so it runs with the other
+	// file system work rather than holding up decodes on the loader
+	image.signatureBaseline = baseline;
+	image.signatureCheck = io.Submit([path = image.fullPath, previous = image.signature] {
+		return GetFileSignature(path, previous);
+		});
+}
+
+SDL_Texture* App::GetTexture(const ImageEntity& image) const {
+	if (SDL_Texture* tex = textures.Get(image.id, image.currentTextureIndex)) {
+		return tex;
+	}
+	return textures.GetThumbnail(image.id);
+}
+
+void App::UpdateResidency() {
+	// Full resolution textures are only kept for images that are likely to be shown soon:
+	// the current image, the hovered image and the neighbours of the active image.
+	// Everything else is drawn from its thumbnail.
+	size_t active = GetImagePosition(activeImage);
+	auto nearActive = [&](size_t i) {
+		size_t d = i > active ? i - active : active - i;
+		return std::min(d, imageOrder.size() - d) <= RESIDENT_NEIGHBOURS; // Tab wraps around
+	};
+	uint64_t current = GetCurrentImage();
+	bool prefetched = false;
+	for (size_t i = 0; i < imageOrder.size(); i++) {
+		auto& image = *images.Get(imageOrder[i]);
+		if (!image.Loaded())
+			continue;
+
+		// Shared memory images are live and have no thumbnail so they always stay resident
+		// The compare reference is drawn next to the current image, so it needs full resolution too
+		bool keep = image.id == current || nearActive(i) || image.id == hoverImage || !image.slot.empty()
+			|| image.id == compare.referenceId;
+		if (!keep) {
+			textures.ReleaseFrames(image.id);
+		} else if (!textures.HasFrames(image.id)) {
+			// The image being drawn is uploaded straight away, the others one per frame
+			if (image.id != current) {
+				if (prefetched)
+					continue;
+				prefetched = true;
+			}
+			textures.Upload(image.id, image.image);
+			if (bench) {
+				bench->TextureReady(image.fullPath, image.image.GetWidth(), image.image.GetHeight());
+			}
+		}
+	}
+}
+
+SDL_ScaleMode App::GetScaleMode(const ImageEntity& image) const {
+	if (!antialiasing)
+		return SDL_ScaleModeNearest;
+	// Filtering only blurs when every image pixel covers a whole number of screen pixels
+	float scale = image.display.scale;
+	bool rotating = image.display.animatedRotation != image.display.rotation;
+	if (scale >= 1.0f && std::abs(scale - std::round(scale)) < 0.001f && !rotating)
+		return SDL_ScaleModeNearest;
+	return SDL_ScaleModeBest;
+}
+
+ImageEntity& App::InsertImage(size_t position) {
+	uint64_t id = images.Insert({});
+	ImageEntity& image = *images.Get(id);
+	image.id = id;
+	if (position == (size_t)-1) {
+		imageOrder.push_back(id);
+	} else {
+		imageOrder.insert(imageOrder.begin() + position, id);
+	}
+	if (!activeImage) {
+		activeImage = id;
+	}
+	return image;
+}
+
+void App::DeleteImage(ImageEntity* image) {
+	ResolveAck(*image, Result::Cancelled, image->fullPath);
+	if (image->watched) {
+		watcher->Unwatch(image->fullPath);
+	}
+	if (image->resolving.valid()) {
+		discardedResolves.push_back(std::move(image->resolving));
+	}
 	if (image->future.valid()) {
-		auto heapFuture = new std::future<Image>(std::move(image->future));
-		discardedFutures.push_back(heapFuture);
+		discardedFutures.push_back(std::move(image->future));
 	}
 
-	for (auto texture : image->textures) {
-		SDL_DestroyTexture(texture);
+	textures.Release(image->id);
+	if (image->indexed) {
+		imageIndex.Remove(image->id);
 	}
-	image->textures.clear();
 
-	auto it = std::find_if(images.begin(), images.end(), [image](const ImageEntity& im) { return &im == image; });
-	it = images.erase(it);
+	// The next image takes the place of the active image
+	uint64_t id = image->id;
+	size_t position = GetImagePosition(id);
+	imageOrder.erase(imageOrder.begin() + position);
+	if (activeImage == id) {
+		activeImage = imageOrder.empty() ? 0 : imageOrder[std::min(position, imageOrder.size() - 1)];
+	}
+	if (hoverImage == id) {
+		hoverImage = 0;
+	}
+	images.Remove(id);
+}
 
-	if (activeImageIndex > 0 && activeImageIndex >= images.size()) {
-		activeImageIndex = images.size() - 1;
+void App::FailLoad(ImageEntity& image, const std::string& error) {
+	ResolveAck(image, Result::Failed, error);
+	if (!bench) { // Errors are reported in the benchmark results instead
+		AddLoadError(image.fullPath + ": " + error);
+	}
+	DeleteImage(&image);
+}
+
+void App::AddLoadError(std::string line, bool saving) {
+	// Failures are collected until nothing is left loading, so that a folder of
+	// unsupported files ends up in one list instead of one message per file
+	if (loadErrors.batchDone) {
+		loadErrors.lines.clear();
+		loadErrors.count = 0;
+		loadErrors.saves = 0;
+		loadErrors.batchDone = false;
+	}
+	loadErrors.count++;
+	loadErrors.saves += saving ? 1 : 0;
+	const char* failed = loadErrors.saves == 0 ? "loaded"
+		: loadErrors.saves == loadErrors.count ? "saved"
+		: "loaded or saved";
+	char heading[96];
+	std::snprintf(heading, sizeof(heading), "%zu file%s could not be %s | Escape to dismiss",
+		loadErrors.count,
+		loadErrors.count == 1 ? "" : "s",
+		failed);
+	if (loadErrors.lines.empty()) {
+		loadErrors.lines.emplace_back(heading);
+	} else {
+		loadErrors.lines[0] = heading;
+	}
+	if (loadErrors.count <= LOAD_ERRORS_SHOWN) {
+		loadErrors.lines.push_back(std::move(line));
+	} else {
+		std::string more = "... and " + std::to_string(loadErrors.count - LOAD_ERRORS_SHOWN) + " more";
+		if (loadErrors.count == LOAD_ERRORS_SHOWN + 1) {
+			loadErrors.lines.push_back(std::move(more));
+		} else {
+			loadErrors.lines.back() = std::move(more);
+		}
+	}
+	loadErrors.sequence++;
+}
+
+void App::UpdateLoadErrors() {
+	// Runs after UpdateActiveImage, which leaves the selection alone while there are errors to dismiss
+	if (!loadErrors.lines.empty() && !GetCtrlKeyDown() && GetKeyPressed(SDL_Scancode::SDL_SCANCODE_ESCAPE)) {
+		loadErrors.lines.clear();
+		loadErrors.sequence++;
 	}
-	
-	return it;
+}
+
+SDL_Rect App::GetLoadErrorsRect() const {
+	if (loadErrors.lines.empty())
+		return {};
+	auto [cw, ch] = GetClientSize();
+	int w = 0;
+	for (const auto& line : loadErrors.lines) {
+		w = std::max(w, text.Measure(line));
+	}
+	w = std::min(w + 2 * TEXT_PADDING, cw);
+	int h = (int)loadErrors.lines.size() * text.GetLineSpacing() + 2 * TEXT_PADDING;
+
+	// Below the HUD and comparison results
+	SDL_Rect hud = GetHudRect();
+	SDL_Rect compare = GetCompareRect();
+	return { 0, std::max(hud.y + hud.h, compare.y + compare.h), w, h };
+}
+
+void App::DrawLoadErrors() const {
+	SDL_Rect rc = GetLoadErrorsRect();
+	if (SDL_RectEmpty(&rc))
+		return;
+	text.FillRect(rc, TEXT_BACKGROUND);
+	int y = rc.y + TEXT_PADDING;
+	for (size_t i = 0; i < loadErrors.lines.size(); i++) {
+		text.DrawString(loadErrors.lines[i], rc.x + TEXT_PADDING, y, i == 0 ? ERROR_FOREGROUND : TEXT_FOREGROUND);
+		y += text.GetLineSpacing();
+	}
+	text.Flush();
 }
 
 bool App::MouseOverSidebar() const {
@@ -792,35 +2485,41 @@ bool App::MouseOverSidebar() const {
 		&& MouseInWindow();
 }
 
-size_t App::GetCurrentImageIndex() const {
-	if (GetMouseDown(SDL_BUTTON_RIGHT)) {
+uint64_t App::GetCurrentImage() const {
+	if (GetMouseDown(SDL_BUTTON_RIGHT) || !hoverImage) {
 		// Do not preview hovered image when selecting an area
-		return activeImageIndex;
+		return activeImage;
 	} else {
-		return hoverImageIndex.value_or(activeImageIndex);
+		return hoverImage;
 	}
 }
 
+size_t App::GetImagePosition(uint64_t id) const {
+	return std::find(imageOrder.begin(), imageOrder.end(), id) - imageOrder.begin();
+}
+
 bool App::TryGetCurrentImage(ImageEntity** image) {
-	if (images.empty())
+	ImageEntity* current = images.Get(GetCurrentImage());
+	if (!current)
 		return false;
-	*image = &images[GetCurrentImageIndex()];
+	*image = current;
 	return true;
 }
 
 bool App::TryGetCurrentImage(const ImageEntity** image) const {
-	if (images.empty())
+	const ImageEntity* current = images.Get(GetCurrentImage());
+	if (!current)
 		return false;
-	*image = &images[GetCurrentImageIndex()];
+	*image = current;
 	return true;
 }
 
 bool App::TryGetVisibleImage(ImageEntity** image) {
-	return TryGetCurrentImage(image) && (*image)->GetTexture();
+	return TryGetCurrentImage(image) && (*image)->Loaded();
 }
 
 bool App::TryGetVisibleImage(const ImageEntity** image) const {
-	return TryGetCurrentImage(image) && (*image)->GetTexture();
+	return TryGetCurrentImage(image) && (*image)->Loaded();
 }
 
 void App::ResetTransform(ImageEntity& image) const {
@@ -875,54 +2574,67 @@ void App::DrawGrid() const {
 	if (!TryGetVisibleImage(&image))
 		return;
 
-	const auto& display = image->display;
-	if (display.scale < 2)
+	Uint8 alpha = GetGridAlpha(image->display.scale);
+	if (alpha == 0)
 		return;
 
-	auto [cw, ch] = GetClientSize();
-	SDL_Rect rect = GetImageRect();
-	float minX = std::max((float)rect.x, std::fmod((float)rect.x, display.scale));
-	float maxX = (float)std::min(rect.x + rect.w, cw);
-	float minY = std::max((float)rect.y, std::fmod((float)rect.y, display.scale));
-	float maxY = (float)std::min(rect.y + rect.h, ch);
-	
-	std::vector<SDL_FPoint> points;
-	for (float x = minX; x <= maxX + display.scale / 2; x += display.scale) {
-		points.push_back({ x, minY });
-		points.push_back({ x, maxY });
-		points.push_back({ x, minY });
-	}
-	for (float y = minY; y <= maxY + display.scale / 2; y += display.scale) {
-		points.push_back({ minX, y });
-		points.push_back({ maxX, y });
-		points.push_back({ minX, y });
+	overlays.DrawGrid(GetImageRect(), image->display.scale, GetClientSize(), { 30, 30, 30, alpha });
+}
+
+Uint8 App::GetGridAlpha(float scale) const {
+	// Fade in as the pixels get big enough for the lines not to hide them
+	float t = (scale - GRID_MIN_SCALE) / (GRID_OPAQUE_SCALE - GRID_MIN_SCALE);
+	if (!gridEnabled || t < 0)
+		return 0;
+	return (Uint8)std::lround(std::min(t, 1.0f) * 255);
+}
+
+std::future<Image> App::DecodeAsync(ThreadPool& loader, std::string path, std::shared_ptr<Benchmark> bench) {
+	if (bench) {
+		bench->FileQueued(Benchmark::Key(path));
 	}
-	
-	SDL_SetRenderDrawColor(GetRenderer(), 30, 30, 30, 255);
-	SDL_RenderDrawLinesF(GetRenderer(), points.data(), (int)points.size());
+	return loader.Submit([path = std::move(path), bench = std::move(bench)] {
+		if (bench) {
+			bench->DecodeStarted(Benchmark::Key(path));
+		}
+		Image image(path.c_str());
+		if (image.Valid() && std::max(image.GetWidth(), image.GetHeight()) > THUMBNAIL_SIZE) {
+			image.SetThumbnail(image.Downscale(THUMBNAIL_SIZE));
+		}
+		if (bench) {
+			bench->DecodeFinished(Benchmark::Key(path), image.Valid() ? "" : "Cannot load: " + image.Error());
+		}
+		return image;
+		});
 }
 
-void App::QueueFileLoad(std::string path, size_t index) {
-	ImageEntity image{};
-	
-	try {
-		auto fullPath = fs::canonical(path);
-		image.fullPath = fullPath.string();
-		image.name = fullPath.filename().string();
-	} catch (fs::filesystem_error&) {
-		image.fullPath = path;
-		size_t idx = path.find_last_of("\\/");
-		image.name = idx == std::string::npos ? path : path.substr(idx + 1);
+ImageEntity& App::QueueFileLoad(std::string path, size_t position, std::future<Image> future) {
+	ImageEntity& image = InsertImage(position);
+	if (future.valid()) {
+		image.future = std::move(future);
+		activeLoadThreads++;
 	}
 	
-	if (index == (size_t)-1) {
-		images.push_back(std::move(image));
-	} else {
-		images.insert(images.begin() + index, std::move(image));
-	}
+	// Shown as given until the path has been resolved on an I/O thread,
+	// which can take a long time on network mounts
+	size_t idx = path.find_last_of("\\/");
+	image.name = idx == std::string::npos ? path : path.substr(idx + 1);
+	// Watching looks up the directory, which can block just the same
+	image.resolving = io.Submit([path, watcher = watcher] {
+		ResolvedFile file = ResolveFile(path);
+		if (watcher && file.error.empty()) {
+			watcher->Watch(file.fullPath);
+		}
+		return file;
+		});
+	image.fullPath = std::move(path);
+	return image;
 }
 
 void App::ShowOpenFileDialog() {
+	if (openDialog.valid() || exportJob.dialog.valid())
+		return;
+
 	static const char* filters[] = {
 		"*.jpeg", "*.jpg",
 		"*.png", "*.bmp",
@@ -937,25 +2649,102 @@ void App::ShowOpenFileDialog() {
 		"*.PIC", "*.PGM",
 		"*.PPM",
 	};
-	const char* paths = tinyfd_openFileDialog(
-		"Open File",
-		nullptr,
-		(int)std::size(filters),
-		filters,
-		nullptr,
-		1);
-	if (!paths)
+	openDialog = ShowDialogAsync([] {
+		std::vector<std::string> chosen;
+		if (const char* paths = tinyfd_openFileDialog(
+			"Open File",
+			nullptr,
+			(int)std::size(filters),
+			filters,
+			nullptr,
+			1)) {
+			std::string pathsStr = paths;
+			auto split = pathsStr
+				| std::views::split('|')
+				| std::views::transform([](auto&& s) {
+					return std::string_view(&*s.begin(), std::ranges::distance(s));
+					});
+			for (const auto& path : split) {
+				chosen.emplace_back(path);
+			}
+		}
+		return chosen;
+		});
+}
+
+void App::ShowSaveFileDialog() {
+	// One export at a time, the progress of the running one is shown in the bottom right
+	ImageEntity* image = nullptr;
+	if (exportJob.dialog.valid() || exportJob.job.valid() || openDialog.valid() || !TryGetVisibleImage(&image))
 		return;
-	
-	std::string pathsStr = paths;
-	auto split = pathsStr
-		| std::views::split('|')
-		| std::views::transform([](auto&& s) {
-			return std::string_view(&*s.begin(), std::ranges::distance(s));
-			});
-	for (const auto& path : split) {
-		QueueFileLoad(std::string(path));
+
+	// The user can switch images while the dialog is open, so the pixels are picked now.
+	// The source shares ownership of the frame, which keeps it alive even if the image is closed.
+	const Image& img = image->image;
+	SDL_Rect rect = GetSourceRect(*image);
+	size_t offset = ((size_t)img.GetWidth() * img.GetHeight() * image->currentTextureIndex
+		+ (size_t)img.GetWidth() * rect.y + rect.x) * 4;
+	exportJob.source = {
+		std::shared_ptr<const uint8_t>(img.SharePixels(), img.GetPixels() + offset),
+		(size_t)img.GetWidth(),
+		rect.w,
+		rect.h,
+		{ image->display.flipHorizontal, image->display.flipVertical, image->display.rotation },
+	};
+
+	static const char* filters[] = { "*.png", "*.qoi", "*.rgba" };
+	fs::path suggested = fs::path(image->fullPath).parent_path() / fs::path(image->name).stem();
+	exportJob.dialog = ShowDialogAsync([suggested = suggested.string() + "-export.png"] {
+		const char* path = tinyfd_saveFileDialog(
+			"Save Selection",
+			suggested.c_str(),
+			(int)std::size(filters),
+			filters,
+			"PNG, QOI or raw RGBA");
+		return std::string(path ? path : "");
+		});
+}
+
+void App::UpdateExport() {
+	auto& exp = exportJob;
+
+	// Write the pixels picked when the dialog was opened once a file is chosen
+	if (exp.dialog.valid() && exp.dialog.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+		std::string path = exp.dialog.get();
+		ExportSource source = std::move(exp.source);
+		exp.source = {};
+		if (!path.empty()) {
+			exp.rowsDone = std::make_shared<std::atomic<size_t>>(0);
+			exp.rows = source.orientation.Transposed() ? source.width : source.height;
+			exp.path = path;
+			exp.name = fs::path(path).filename().string();
+			// The job shares ownership of the pool, since it keeps using it to encode chunks in parallel
+			exp.job = loader->Submit([source, format = GuessExportFormat(path), path, pool = loader, rowsDone = exp.rowsDone] {
+				return ExportImage(source, format, path, *pool, rowsDone.get());
+				});
+		}
+	}
+
+	if (exp.job.valid() && exp.job.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+		std::string error;
+		try {
+			error = exp.job.get();
+		} catch (std::future_error&) {
+			error = "The export was cancelled";
+		}
+		// Shown with the load errors rather than in a message box, which would block the window
+		if (!error.empty()) {
+			AddLoadError(exp.path + ": " + error, true);
+		}
+	}
+
+	int length = 0;
+	if (exp.job.valid()) {
+		length = std::snprintf(exp.text, sizeof(exp.text), "Saving %s: %zu%%",
+			exp.name.c_str(),
+			exp.rowsDone->load() * 100 / std::max(exp.rows, (size_t)1));
 	}
+	exp.length = std::clamp(length, 0, (int)sizeof(exp.text) - 1);
 }
 
 SDL_Point App::ScreenToImagePosition(SDL_Point p) const {
@@ -1052,103 +2841,137 @@ SDL_Point App::ImageToScreenPosition(SDL_Point p) const {
 	};
 }
 
-void App::CopyToClipboard() const {
+SDL_Rect App::GetSourceRect(const ImageEntity& image) const {
+	const auto& display = image.display;
+	SDL_Rect bounds = { 0, 0, image.image.GetWidth(), image.image.GetHeight() };
+	if (display.selectFrom.x == -1 || display.selectTo.x == -1)
+		return bounds;
+
+	// The selection's points are inclusive and can sit on the far edge of the image
+	SDL_Rect selection = RectFromPoints(display.selectFrom, display.selectTo);
+	selection.w++;
+	selection.h++;
+	SDL_Rect rect{};
+	SDL_IntersectRect(&selection, &bounds, &rect);
+	return rect;
+}
+
+void App::CopyToClipboard() {
+	// The clipboard would end up with whichever copy finished last
+	if (clipboardCopy.length)
+		return;
+
 	const ImageEntity* image = nullptr;
 	TryGetVisibleImage(&image);
 	const auto& display = image->display;
+	const Image& img = image->image;
+
+	// The pixels are read straight from the frame, which the jobs share ownership of
+	SDL_Rect rect = GetSourceRect(*image);
+	size_t offset = ((size_t)img.GetWidth() * img.GetHeight() * image->currentTextureIndex
+		+ (size_t)img.GetWidth() * rect.y + rect.x) * 4;
+	std::shared_ptr<const uint8_t> source(img.SharePixels(), img.GetPixels() + offset);
+	Orientation orientation = { display.flipHorizontal, display.flipVertical, display.rotation };
+
+	auto& copy = clipboardCopy;
+	// Left uninitialised, the bands overwrite every byte and zeroing would stall the UI thread
+	copy.pixels = std::shared_ptr<uint8_t[]>(new uint8_t[(size_t)rect.w * rect.h * 4]);
+	copy.size = orientation.Transposed() ? SDL_Point{ rect.h, rect.w } : SDL_Point{ rect.w, rect.h };
+	copy.bandsDone = 0;
+	copy.bandsDiscarded = false;
+	for (int y = 0; y < copy.size.y; y += CLIPBOARD_BAND_ROWS) {
+		copy.bands.push_back(loader->Submit([
+			source, stride = (size_t)img.GetWidth(), rect, orientation, pixels = copy.pixels,
+			y, y1 = std::min(copy.size.y, y + CLIPBOARD_BAND_ROWS), rowBytes = (size_t)copy.size.x * 4] {
+			TransformRows(source.get(), stride, rect.w, rect.h, orientation, pixels.get() + rowBytes * y, y, y1);
+			}));
+	}
+	UpdateClipboard();
+}
 
-	SDL_Rect rect{};
-	if (display.selectFrom.x != -1 && display.selectTo.x != -1) {
-		rect = SDL_Rect{
-			std::min(display.selectFrom.x, display.selectTo.x),
-			std::min(display.selectFrom.y, display.selectTo.y),
-			std::abs(display.selectFrom.x - display.selectTo.x) + 1,
-			std::abs(display.selectFrom.y - display.selectTo.y) + 1,
-		};
-	} else {
-		rect = { 0, 0, image->image.GetWidth(), image->image.GetHeight() };
-	}
-	
-	std::vector<uint8_t> data;
-	const uint8_t* fullImage = image->image.GetPixels()
-		+ image->currentTextureIndex * image->image.GetWidth() * image->image.GetHeight() * 4;
-	for (int dy = 0; dy < rect.h; dy++) {
-		const uint8_t* p = fullImage + 4 * (image->image.GetWidth() * (rect.y + dy) + rect.x);
-		data.insert(data.end(), p, p + 4 * rect.w);
+void App::UpdateClipboard() {
+	auto& copy = clipboardCopy;
+
+	// Bands mostly finish in the order they were submitted
+	while (copy.bandsDone < copy.bands.size()
+		&& copy.bands[copy.bandsDone].wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+		try {
+			copy.bands[copy.bandsDone].get();
+		} catch (std::future_error&) {
+			copy.bandsDiscarded = true;
+		}
+		copy.bandsDone++;
+	}
+	if (!copy.bands.empty() && copy.bandsDone == copy.bands.size()) {
+		copy.bands.clear();
+		std::shared_ptr<uint8_t[]> pixels = std::move(copy.pixels);
+
+		// The clipboard is owned by the thread that sets it on some platforms, so this stays on the main thread
+		bool copied = false;
+		if (!copy.bandsDiscarded) {
+			clip::image_spec spec{};
+			spec.alpha_mask = 0xFF000000;
+			spec.blue_mask =  0x00FF0000;
+			spec.green_mask = 0x0000FF00;
+			spec.red_mask =   0x000000FF;
+			spec.alpha_shift = 24;
+			spec.blue_shift = 16;
+			spec.green_shift = 8;
+			spec.red_shift = 0;
+			spec.width = copy.size.x;
+			spec.height = copy.size.y;
+			spec.bits_per_pixel = 32;
+			spec.bytes_per_row = spec.bits_per_pixel / 8 * spec.width;
+
+			clip::image clipimage(pixels.get(), spec);
+			copied = clip::set_image(clipimage);
+		}
+		if (!copied) {
+			SDL_ShowSimpleMessageBox(
+				SDL_MESSAGEBOX_ERROR,
+				"Clipboard Error",
+				"Failed to copy image to clipboard.",
+				GetWindow());
+		}
 	}
 
-	std::vector<uint8_t> transformed;
-	if (!display.flipHorizontal && !display.flipVertical && display.rotation == 0) {
-		transformed = std::move(data);
-	} else {
-		transformed.resize(data.size());
-		int dstW = !RotatedPerpendicular() ? rect.w : rect.h;
-		int dstH = RotatedPerpendicular() ? rect.w : rect.h;
-		for (int y = 0; y < rect.h; y++) {
-			for (int x = 0; x < rect.w; x++) {
-				int srcX = x;
-				int srcY = y;
-				if (display.flipHorizontal) {
-					srcX = rect.w - x - 1;
-				}
-				if (display.flipVertical) {
-					srcY = rect.h - y - 1;
-				}
+	int length = 0;
+	if (!copy.bands.empty()) {
+		length = std::snprintf(copy.text, sizeof(copy.text), "Copying %dx%d: %zu%%",
+			copy.size.x,
+			copy.size.y,
+			copy.bandsDone * 100 / copy.bands.size());
+	}
+	copy.length = std::clamp(length, 0, (int)sizeof(copy.text) - 1);
+}
 
-				int dstX = x;
-				int dstY = y;
-				switch (display.rotation) {
-				case 0:
-					break;
-				case 1:
-					dstX = rect.h - y - 1;
-					dstY = x;
-					break;
-				case 2:
-					dstX = rect.w - x - 1;
-					dstY = rect.h - y - 1;
-					break;
-				case 3:
-					dstX = y;
-					dstY = rect.w - x - 1;
-					break;
-				}
+SDL_Rect App::GetProgressRect() const {
+	int lines = (clipboardCopy.length != 0) + (exportJob.length != 0);
+	if (lines == 0)
+		return {};
+	auto [cw, ch] = GetClientSize();
+	int w = std::max(
+		clipboardCopy.length ? text.Measure({ clipboardCopy.text, clipboardCopy.length }) : 0,
+		exportJob.length ? text.Measure({ exportJob.text, exportJob.length }) : 0);
+	w += 2 * TEXT_PADDING;
+	int h = lines * text.GetLineSpacing() + 2 * TEXT_PADDING;
+	int right = SDL_RectEmpty(&sidebarRect) ? cw : sidebarRect.x;
+	return { right - w, ch - h, w, h };
+}
 
-				std::memcpy(
-					transformed.data() + 4 * (dstY * dstW + dstX),
-					data.data() + 4 * (srcY * rect.w + srcX),
-					4);
-			}
+void App::DrawProgress() const {
+	SDL_Rect rc = GetProgressRect();
+	if (SDL_RectEmpty(&rc))
+		return;
+	text.FillRect(rc, TEXT_BACKGROUND);
+	int y = rc.y + TEXT_PADDING;
+	for (std::string_view line : { std::string_view(clipboardCopy.text, clipboardCopy.length), std::string_view(exportJob.text, exportJob.length) }) {
+		if (!line.empty()) {
+			text.DrawString(line, rc.x + TEXT_PADDING, y, TEXT_FOREGROUND);
+			y += text.GetLineSpacing();
 		}
-
-		// Update the copied image dimensions
-		rect.w = dstW;
-		rect.h = dstH;
-	}
-	
-	clip::image_spec spec{};
-	spec.alpha_mask = 0xFF000000;
-	spec.blue_mask =  0x00FF0000;
-	spec.green_mask = 0x0000FF00;
-	spec.red_mask =   0x000000FF;
-	spec.alpha_shift = 24;
-	spec.blue_shift = 16;
-	spec.green_shift = 8;
-	spec.red_shift = 0;
-	spec.width = rect.w;
-	spec.height = rect.h;
-	spec.bits_per_pixel = 32;
-	spec.bytes_per_row = spec.bits_per_pixel / 8 * spec.width;
-	
-	clip::image clipimage(transformed.data(), spec);
-	
-	if (!clip::set_image(clipimage)) {
-		SDL_ShowSimpleMessageBox(
-			SDL_MESSAGEBOX_ERROR,
-			"Clipboard Error",
-			"Failed to copy image to clipboard.",
-			GetWindow());
 	}
+	text.Flush();
 }
 
 bool App::RotatedPerpendicular() const {
@@ -1159,6 +2982,7 @@ bool App::RotatedPerpendicular() const {
 
 void App::DrawAlphaBackground() const {
 	SDL_Rect rc = GetImageRect();
+	SDL_Point origin = { rc.x, rc.y };
 
 	// Prevent background showing around the edges of the image
 	rc.x += 1;
@@ -1166,41 +2990,7 @@ void App::DrawAlphaBackground() const {
 	rc.w -= 2;
 	rc.h -= 2;
 
-	if (!SDL_RectEquals(&rc, &alphaBgCachedRect)) {
-		constexpr int SQUARE_SIZE = 8;
-		auto [cw, ch] = GetClientSize();
-		int xmin = std::max(0, rc.x / SQUARE_SIZE * SQUARE_SIZE);
-		int ymin = std::max(0, rc.y / SQUARE_SIZE * SQUARE_SIZE);
-		int xmax = std::min(cw, (rc.x + rc.w) / SQUARE_SIZE * SQUARE_SIZE);
-		int ymax = std::min(ch, (rc.y + rc.h) / SQUARE_SIZE * SQUARE_SIZE);
-
-		std::vector<SDL_Rect> squares;
-		int i = (xmin / SQUARE_SIZE + ymin / SQUARE_SIZE) % 2;
-		for (int y = ymin, yi = i; y <= ymax; y += SQUARE_SIZE, yi++) {
-			for (int x = xmin, xi = 0; x <= xmax; x += SQUARE_SIZE, xi++) {
-				if ((xi + yi) % 2 == 0) {
-					int left = std::max(rc.x, x);
-					int top = std::max(rc.y, y);
-					int right = std::min(x + SQUARE_SIZE, rc.x + rc.w);
-					int bottom = std::min(y + SQUARE_SIZE, rc.y + rc.h);
-					squares.push_back({
-						left,
-						top,
-						right - left,
-						bottom - top,
-						});
-				}
-			}
-		}
-
-		alphaBgCachedRect = rc;
-		alphaBgCachedSquares = std::move(squares);
-	}
-
-	SDL_SetRenderDrawColor(GetRenderer(), 255, 255, 255, 255);
-	SDL_RenderFillRect(GetRenderer(), &rc);
-	SDL_SetRenderDrawColor(GetRenderer(), 191, 191, 191, 255);
-	SDL_RenderFillRects(GetRenderer(), alphaBgCachedSquares.data(), (int)alphaBgCachedSquares.size());
+	overlays.DrawCheckerboard(rc, origin, GetClientSize());
 }
 
 float App::GetScrollDelta() const {
@@ -1227,11 +3017,15 @@ void App::FileDropped(const char* path) {
 	QueueFileLoad(path);
 }
 
-void App::ReloadImage(ImageEntity& image) {
-	for (SDL_Texture* tex : image.textures) {
-		SDL_DestroyTexture(tex);
+void App::ReloadImage(ImageEntity& image, bool quiet) {
+	if (!image.slot.empty()) {
+		// Shared memory images have nothing on disk to reload from
+		return;
 	}
-	image.textures.clear();
-	image.image = Image();
+
+	// The current textures stay visible until the new decode has finished.
+	// An image that hasn't started loading yet will read the latest version anyway.
+	image.reloadPending = image.Loaded() || image.future.valid();
+	image.reloadQuiet = quiet;
 	image.wasReloaded = true;
 }
@@ -3,20 +3,52 @@
 #include <string>
 #include <vector>
 #include <stack>
+#include <deque>
 #include "window.h"
 #include "config.h"
 #include "colourfmt.h"
 #include "net.h"
+#include "bench.h"
+#include "threadpool.h"
+#include "options.h"
+#include "watcher.h"
+#include "texture.h"
+#include "compositor.h"
+#include "damage.h"
+#include "overlay.h"
+#include "text.h"
+#include "pixelvalues.h"
+#include "stats.h"
+#include "compare.h"
+#include "viewfilter.h"
+#include "imageindex.h"
+#include "slotmap.h"
+#include "transform.h"
+#include "export.h"
 
 struct ImageEntity {
+	uint64_t id = 0; // Handle in the image store, also the key for the image's textures in the TextureManager
 	std::string fullPath;
 	std::string name;
 	std::future<Image> future;
 	Image image;
 	size_t currentTextureIndex = 0;
-	std::vector<SDL_Texture*> textures;
+	uint64_t generation = 0; // Incremented whenever the pixels change
 	uint64_t openTime = 0; // Milliseconds since SDL startup
 	bool wasReloaded = false;
+	bool reloadPending = false; // Decode again once the current decode (if any) finishes
+	bool reloadQuiet = false; // Don't report errors from the pending reload, used for changes on disk
+	FileSignature signature; // Of the file on disk when it was last decoded
+	std::future<FileSignature> signatureCheck;
+	bool signatureBaseline = false; // The pending check records the signature of a new decode instead of looking for changes
+	bool signatureRecheck = false; // The file changed again while it was being checked
+	std::future<ResolvedFile> resolving; // Valid until the path has been resolved, nothing is done with the file before then
+	FileIdentity identity;
+	bool watched = false; // Registered with the file watcher
+	bool indexed = false; // Checked against the open files once
+	std::future<ImageHashes> hashJob; // For finding duplicates once decoded
+	std::optional<std::pair<uint64_t, size_t>> ack; // Pending acknowledgement and entry index for an open request
+	std::string slot; // Non-empty for images pushed through shared memory
 	struct {
 		float x = 0;
 		float y = 0;
@@ -28,56 +60,252 @@ struct ImageEntity {
 		SDL_Point selectFrom = { -1, -1 };
 		SDL_Point selectTo = { -1, -1 };
 	} display;
-	SDL_Texture* GetTexture() const;
+	bool Loaded() const;
+};
+
+enum class CompareMode {
+	Split,      // Active image left of a divider and the reference right of it
+	Flicker,    // Alternates between the two
+	Difference, // Heatmap of the absolute difference
+	Count,
+};
+
+// An image whose decode was started before the app was created
+struct PendingImage {
+	std::string path;
+	std::future<Image> future;
 };
 
 struct App : Window {
-	App(int argc, char** argv, Config config, std::unique_ptr<MessageServer> msgServer);
+	App(const Options& options, std::vector<PendingImage> pending, Config config,
+		std::unique_ptr<MessageServer> msgServer, std::shared_ptr<ThreadPool> loader, std::shared_ptr<Benchmark> bench);
+	static std::future<Image> DecodeAsync(ThreadPool& loader, std::string path, std::shared_ptr<Benchmark> bench);
 	~App();
 	void Update() override;
 	void Resized(int width, int height) override;
 	void Moved(int x, int y) override;
 	void FileDropped(const char* path) override;
+	void CloseRequested() override;
+	uint32_t GetSleepTime() const override;
+	void Exposed() override;
 private:
+	void Hide();
+	void Show();
+	void SaveConfig();
 	void SetWindowTitle(const char* title) const;
 	void UpdateActiveImage();
+	void DrawActiveImage(const SDL_Rect& clip) const;
+	void DrawImage(const ImageEntity& image, const SDL_Rect& clip) const; // Without the grid and selection
 	void DrawAlphaBackground() const;
 	void UpdateSidebar();
+	float LayoutSidebar(); // Returns the scroll bound
+	void DrawSidebar() const;
+	SDL_Texture* GetSidebarIcon(const ImageEntity& image) const;
 	void DrawGrid() const;
-	void UpdateStatus() const;
+	Uint8 GetGridAlpha(float scale) const; // 0 if the grid is hidden
+	void DrawPixelValues(const SDL_Rect& clip) const;
+	void DrawComposited(const ImageEntity& image, const SDL_Rect& clip) const;
+	std::vector<SDL_Rect> CollectDamage();
+	void Draw(std::vector<SDL_Rect> rects); // Redraws and presents the damaged rects
+	SDL_Rect GetSelectionScreenRect() const; // Empty if nothing is selected
+	std::optional<SDL_Rect> GetVisibleSourceRect(const ImageEntity& image) const; // Empty if off screen
+	void UpdateStatus();
+	void UpdateHud();
+	SDL_Rect GetStatusRect() const; // Empty if hidden
+	SDL_Rect GetHudRect() const;
+	void DrawStatus() const;
+	void UpdateStats();
+	SDL_Rect GetStatsRect() const; // Empty if hidden
+	void DrawStats() const;
+	void UpdateCompare();
+	bool TryGetCompareImage(ImageEntity** image); // The reference, if it isn't the current image
+	bool TryGetCompareImage(const ImageEntity** image) const;
+	SDL_Rect GetCompareSplitRect() const; // Right of the divider
+	bool MouseOverCompareDivider() const;
+	SDL_Rect GetCompareRect() const; // Empty if not comparing
+	void UpdateViewFilter();
+	void ReleaseFilteredFrame();
+	void UpdateDuplicates();
+	void GroupDuplicates(); // Moves duplicates next to the first image of their group
+	void UpdatePathResolution();
+	void AddLoadError(std::string line, bool saving = false); // Starts a new list if the previous batch of files has finished loading
+	void UpdateLoadErrors();
+	SDL_Rect GetLoadErrorsRect() const; // Empty if there are no errors
+	void DrawLoadErrors() const;
 	void UpdateImageLoading();
 	bool MouseOverSidebar() const;
 	bool TryGetCurrentImage(ImageEntity** image);
 	bool TryGetCurrentImage(const ImageEntity** image) const;
 	bool TryGetVisibleImage(ImageEntity** image);
 	bool TryGetVisibleImage(const ImageEntity** image) const;
-	void QueueFileLoad(std::string path, size_t index = (size_t)-1);
-	void ShowOpenFileDialog();
+	ImageEntity& QueueFileLoad(std::string path, size_t position = (size_t)-1, std::future<Image> future = {});
+	void ShowOpenFileDialog(); // Returns straight away, the chosen files are opened by UpdateImageLoading
+	void ShowSaveFileDialog(); // Returns straight away, UpdateExport writes the image once a file is chosen
+	void UpdateExport();
 	float GetScrollDelta() const;
 	void Zoom(SDL_Point pivot, float speed);
-	std::vector<ImageEntity>::iterator DeleteImage(ImageEntity* image); // Returns iterator to next image
+	ImageEntity& InsertImage(size_t position = (size_t)-1); // Adds an empty image at position in the sidebar, or at the end
+	void DeleteImage(ImageEntity* image);
+	void FailLoad(ImageEntity& image, const std::string& error); // Reports the error and deletes the image
 	void ResetTransform(ImageEntity& image) const;
-	void CopyToClipboard() const;
+	void CopyToClipboard(); // Returns straight away, UpdateClipboard hands the pixels over once they are ready
+	void UpdateClipboard();
+	SDL_Rect GetProgressRect() const; // Empty unless copying or exporting
+	void DrawProgress() const;
+	SDL_Rect GetSourceRect(const ImageEntity& image) const; // The selection in image pixels, or the whole image
 	SDL_Rect GetImageRect() const;
 	SDL_Point ScreenToImagePosition(SDL_Point p) const;
 	SDL_Point ImageToScreenPosition(SDL_Point p) const;
 	bool RotatedPerpendicular() const;
-	size_t GetCurrentImageIndex() const;
-	void ReloadImage(ImageEntity& image);
+	uint64_t GetCurrentImage() const; // The hovered or active image's handle
+	size_t GetImagePosition(uint64_t id) const; // In the sidebar, or the number of images if it isn't open
+	void ReloadImage(ImageEntity& image, bool quiet = false);
+	void UpdateFileWatcher();
+	void CheckSignature(ImageEntity& image, bool baseline);
+	void UpdateBenchmark();
+	void HandleRequest(Request& request);
+	Reply HandleCommand(const Request& request);
+	void ResolveAck(ImageEntity& image, Result result, std::string text);
+	void HandlePush(const Request& request); // Replies once the pixels have been mapped or copied on the loader
+	void UpdatePushes();
+	SDL_Texture* GetTexture(const ImageEntity& image) const; // Falls back to the thumbnail if the frames aren't resident
+	SDL_ScaleMode GetScaleMode(const ImageEntity& image) const;
+	void UpdateResidency();
 	Config config;
+	TextureManager textures;
+	mutable OverlayRenderer overlays;
+	mutable TextRenderer text;
+	mutable TextRenderer valueText; // Always at the smallest scale to fit in pixel cells
+	mutable PixelLabelCache pixelLabels;
+	uint64_t nextImageId = 1; // For entities outside the store, always below any handle
 	std::unique_ptr<MessageServer> msgServer;
+	std::shared_ptr<ThreadPool> loader;
+	ThreadPool io; // Resolves paths, apart from the loader so that slow file systems don't hold up decodes
+	std::future<std::vector<std::string>> openDialog; // Valid while the open file dialog is shown
+	StatsEngine stats;
+	CompareEngine comparer;
+	std::shared_ptr<Benchmark> bench; // Null unless running with --bench-open
+	bool benchFinished = false;
+	struct PendingAck {
+		uint64_t client;
+		Reply reply;
+		size_t remaining;
+	};
+	std::unordered_map<uint64_t, PendingAck> pendingAcks;
+	uint64_t nextAckId = 1;
+	struct PendingPush {
+		uint64_t client;
+		uint32_t requestId;
+		std::string slot;
+		std::future<Image> image;
+	};
+	std::deque<PendingPush> pendingPushes; // Shown in the order they were pushed
+	std::unique_ptr<Compositor> compositor; // Null unless drawing on the CPU, see software_compositor
+	bool softwareRenderer = false;
+	DamageTracker damage;
+	SDL_Texture* frameTarget = nullptr; // Holds the last frame so that only damaged rects are redrawn
+	SDL_Point frameTargetSize{};
+	std::shared_ptr<FileWatcher> watcher; // Null unless auto reload or --watch-dir is enabled, shared with the resolve jobs
+	bool resident = false; // Hide instead of quitting when the window is closed
+	bool hidden = false;
+	bool idle = false; // The last update drew nothing, and no job was running when it started
 	ColourFormatter colourFormatter;
 	std::stack<std::string> openFileHistory;
-	std::vector<ImageEntity> images;
-	size_t activeImageIndex = 0;
-	std::optional<size_t> hoverImageIndex = 0;
+	SlotMap<ImageEntity> images; // Entities never move, so pointers to them stay valid until they are deleted
+	std::vector<uint64_t> imageOrder; // Handles in sidebar order
+	ImageIndex imageIndex;
+	uint64_t activeImage = 0; // Handle, 0 if there are no images
+	uint64_t hoverImage = 0; // Handle of the image under the cursor in the sidebar, 0 if none
 	std::optional<SDL_Point> dragLocation;
 	float sidebarScroll = 0;
 	bool sidebarEnabled = true;
-	std::optional<size_t> reorderFrom;
-	std::optional<size_t> reorderTo;
+	uint64_t reorderFrom = 0; // Handle of the image being dragged in the sidebar
+	std::optional<size_t> reorderTo; // Position in imageOrder
 	float sidebarAnimatedPosition = 1; // Between 0 and 1
+	SDL_Rect sidebarRect{}; // Empty when hidden
+	std::vector<SDL_Rect> sidebarIcons;
+	std::optional<int> reorderLineY;
 	bool gridEnabled = false;
+	bool statusBarEnabled = true;
+	bool hudEnabled = false;
+	struct {
+		char text[256] = {};
+		size_t length = 0; // Empty if there is no image
+		SDL_Colour colour{}; // Under the cursor
+		bool inside = false; // Whether the cursor is over the image
+	} status;
+	struct {
+		uint64_t periodStart = 0; // Performance counter
+		int frames = 0;
+		int drawnFrames = 0;
+		uint64_t updateTicks = 0;
+		uint64_t drawTicks = 0;
+		uint64_t damagedPixels = 0;
+		char text[128] = {};
+		size_t length = 0;
+	} hud;
+	bool statsEnabled = false;
+	struct {
+		char lines[8][64] = {};
+		size_t lengths[8] = {};
+		int lineCount = 0; // Zero if there is nothing to show
+		std::array<std::array<uint8_t, 256>, 4> bars{}; // Histogram bar heights
+		uint64_t sequence = 0; // Of the formatted result
+		bool busy = false;
+	} statsPanel;
+	struct {
+		uint64_t referenceId = 0; // The image compared against the current image, 0 if none
+		CompareMode mode = CompareMode::Split;
+		float split = 0.5f; // Position of the divider across the window
+		bool draggingSplit = false;
+		bool showReference = false; // Flicker phase
+		ImageEntity heatmap; // Drawn in place of the current image in difference mode
+		uint64_t pair = 0; // Fingerprint of the compared images, the results are dropped when it changes
+		uint64_t sequence = 0; // Of the uploaded heatmap and formatted text
+		bool busy = false;
+		char text[256] = {};
+		size_t length = 0;
+	} compare;
+	struct {
+		std::vector<std::string> lines; // A heading, then the path and reason of the first few failures
+		size_t count = 0; // Failures in the batch
+		size_t saves = 0; // Of which were exports
+		uint64_t sequence = 0; // Incremented whenever the lines change
+		bool batchDone = true; // Nothing was left loading at the end of the last update
+	} loadErrors;
+	struct {
+		std::shared_ptr<uint8_t[]> pixels; // The selection as shown, written by the band jobs
+		SDL_Point size{};
+		std::vector<std::future<void>> bands; // The clipboard is set on the main thread once every band is done
+		size_t bandsDone = 0;
+		bool bandsDiscarded = false; // Some band never ran, so the pixels are incomplete
+		char text[64] = {};
+		size_t length = 0; // Empty unless copying
+	} clipboardCopy;
+	struct {
+		std::future<std::string> dialog; // Valid while the save file dialog is shown, the path is empty if cancelled
+		ExportSource source; // The selection as shown when the dialog was opened
+		std::future<std::string> job; // Empty string once written, otherwise the error
+		std::shared_ptr<std::atomic<size_t>> rowsDone;
+		size_t rows = 0;
+		std::string path; // Of the file being written
+		std::string name;
+		char text[96] = {};
+		size_t length = 0; // Empty unless exporting
+	} exportJob;
+	ViewFilter viewFilter; // As set by the user, auto levels are applied on top
+	bool autoLevels = false; // Stretch the levels over the range of the visible pixels
+	struct {
+		ImageEntity entity; // Drawn in place of the current image while a filter is applied
+		FilteredFrame frame;
+		uint64_t sourceKey = 0;
+		AlphaType alphaType = AlphaType::Translucent; // Of the filtered pixels
+		ViewFilter applied; // Including auto levels
+		bool active = false;
+		uint64_t rangeKey = 0; // Of the pixels auto levels was last measured over
+		ChannelRanges ranges; // Of the source frame
+		SDL_Point range = { 0, 255 };
+	} filtered;
 	bool fullscreen = false;
 	int activeLoadThreads = 0;
 	int maxLoadThreads = 1;
@@ -88,7 +316,6 @@ private:
 	std::optional<SDL_Point> restoredPos{};
 	std::optional<SDL_Point> restoredSize{};
 	std::optional<uint64_t> lastPauseTime;
-	mutable std::vector<SDL_Rect> alphaBgCachedSquares;
-	mutable SDL_Rect alphaBgCachedRect;
 	mutable std::string titleText;
+	uint64_t titleImageId = 0;
 };
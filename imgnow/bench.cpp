@@ -0,0 +1,266 @@
+#include "bench.h"
+#include "net.h"
+#include "SDL.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+// Give up if some file never makes it to the screen
+constexpr double TIMEOUT_MS = 60000.0;
+constexpr uint32_t BENCH_POLL_MS = 100; // How often the send thread checks whether the app is exiting
+
+// Initialized before main runs so that it is as close to process start as possible
+static std::chrono::steady_clock::time_point processStart = std::chrono::steady_clock::now();
+
+static void AppendJsonString(std::string& out, const std::string& s) {
+	out += '"';
+	for (char c : s) {
+		switch (c) {
+		case '"': out += "\\\""; break;
+		case '\\': out += "\\\\"; break;
+		case '\n': out += "\\n"; break;
+		case '\r': out += "\\r"; break;
+		case '\t': out += "\\t"; break;
+		default:
+			if ((unsigned char)c < 0x20) {
+				char buf[8];
+				std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+				out += buf;
+			} else {
+				out += c;
+			}
+		}
+	}
+	out += '"';
+}
+
+static void AppendJsonTime(std::string& out, const char* key, double ms) {
+	char buf[64];
+	if (ms < 0) {
+		std::snprintf(buf, sizeof(buf), "\"%s\": null", key);
+	} else {
+		std::snprintf(buf, sizeof(buf), "\"%s\": %.3f", key, ms);
+	}
+	out += buf;
+}
+
+Benchmark::Benchmark(std::vector<std::string> paths, bool viaIpc, uint16_t port) :
+	paths(std::move(paths)),
+	viaIpc(viaIpc),
+	port(port) {
+	for (const auto& path : this->paths) {
+		Get(Key(path));
+	}
+}
+
+Benchmark::~Benchmark() {
+	stopping = true;
+	if (sendThread.joinable()) {
+		sendThread.join();
+	}
+}
+
+double Benchmark::Now() {
+	using namespace std::chrono;
+	return duration_cast<duration<double, std::milli>>(steady_clock::now() - processStart).count();
+}
+
+void Benchmark::UseHeadlessVideo() {
+	// Respect an explicitly chosen driver so that the benchmark can also be run on a real display
+	if (!std::getenv("SDL_VIDEODRIVER")) {
+		SDL_SetHint(SDL_HINT_VIDEODRIVER, "offscreen,dummy");
+	}
+	if (!std::getenv("SDL_RENDER_DRIVER")) {
+		SDL_SetHint(SDL_HINT_RENDER_DRIVER, "software");
+	}
+}
+
+std::string Benchmark::Key(const std::string& path) {
+	try {
+		return fs::canonical(path).string();
+	} catch (fs::filesystem_error&) {
+		return path;
+	}
+}
+
+void Benchmark::PrintClientResult(double connected, double sent, size_t fileCount) {
+	std::string out = "{\n  \"mode\": \"client\",\n  ";
+	AppendJsonTime(out, "connected", connected);
+	out += ",\n  ";
+	AppendJsonTime(out, "sent", sent);
+	out += ",\n  \"fileCount\": " + std::to_string(fileCount) + "\n}\n";
+	std::fputs(out.c_str(), stdout);
+	std::fflush(stdout);
+}
+
+Benchmark::File& Benchmark::Get(const std::string& path) {
+	auto [it, inserted] = files.try_emplace(path);
+	if (inserted) {
+		order.push_back(path);
+	}
+	return it->second;
+}
+
+void Benchmark::WindowShown(const char* rendererName) {
+	std::lock_guard<std::mutex> lock(mutex);
+	windowShown = Now();
+	renderer = rendererName ? rendererName : "";
+}
+
+void Benchmark::SendFiles() {
+	if (sendThread.joinable())
+		return;
+	
+	// Behave exactly like a second instance would
+	sendThread = std::thread([this] {
+		try {
+			MessageClient client(port);
+			Request request;
+			request.command = Command::Open;
+			request.paths = paths;
+			for (const auto& path : paths) {
+				FileSent(Key(path));
+			}
+			client.Send(std::move(request));
+			// The app can exit without ever replying, so don't wait for it indefinitely
+			while (!client.WaitForReply(BENCH_POLL_MS)) {
+				if (stopping) {
+					SendFailed("The app exited before acknowledging the files");
+					return;
+				}
+			}
+			client.Receive();
+			Acknowledged();
+		} catch (NetException& ex) {
+			SendFailed(ex.what());
+		}
+	});
+}
+
+void Benchmark::SendFailed(const std::string& error) {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (auto& [path, file] : files) {
+		if (file.acknowledged < 0) {
+			file.error = "Failed to send: " + error;
+		}
+	}
+}
+
+void Benchmark::Acknowledged() {
+	std::lock_guard<std::mutex> lock(mutex);
+	double now = Now();
+	for (auto& [path, file] : files) {
+		file.acknowledged = now;
+	}
+}
+
+void Benchmark::FileSent(const std::string& path) {
+	std::lock_guard<std::mutex> lock(mutex);
+	Get(path).sent = Now();
+}
+
+void Benchmark::FileQueued(const std::string& path) {
+	std::lock_guard<std::mutex> lock(mutex);
+	File& file = Get(path);
+	if (file.queued < 0) {
+		file.queued = Now();
+	}
+}
+
+void Benchmark::DecodeStarted(const std::string& path) {
+	std::lock_guard<std::mutex> lock(mutex);
+	Get(path).decodeStart = Now();
+}
+
+void Benchmark::DecodeFinished(const std::string& path, const std::string& error) {
+	std::lock_guard<std::mutex> lock(mutex);
+	File& file = Get(path);
+	file.decodeEnd = Now();
+	file.error = error;
+}
+
+void Benchmark::TextureReady(const std::string& path, int width, int height) {
+	std::lock_guard<std::mutex> lock(mutex);
+	File& file = Get(path);
+	if (file.textureReady < 0) { // Textures are uploaded again after being evicted
+		file.textureReady = Now();
+		file.width = width;
+		file.height = height;
+	}
+}
+
+void Benchmark::Presented(const std::string& path) {
+	std::lock_guard<std::mutex> lock(mutex);
+	File& file = Get(path);
+	if (file.firstPresent < 0) {
+		file.firstPresent = Now();
+	}
+}
+
+bool Benchmark::IsIpc() const {
+	return viaIpc;
+}
+
+bool Benchmark::Finished() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (Now() > TIMEOUT_MS)
+		return true;
+	if (windowShown < 0)
+		return false;
+	for (const auto& [path, file] : files) {
+		if (file.firstPresent < 0 && file.error.empty())
+			return false;
+		if (viaIpc && file.acknowledged < 0 && file.error.empty())
+			return false;
+	}
+	return true;
+}
+
+void Benchmark::Print() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	std::string out = "{\n  \"mode\": ";
+	out += viaIpc ? "\"ipc\"" : "\"direct\"";
+	out += ",\n  \"renderer\": ";
+	AppendJsonString(out, renderer);
+	out += ",\n  \"processStart\": 0,\n  ";
+	AppendJsonTime(out, "windowShown", windowShown);
+	out += ",\n  \"timedOut\": ";
+	out += Now() > TIMEOUT_MS ? "true" : "false";
+	out += ",\n  \"files\": [";
+	for (size_t i = 0; i < order.size(); i++) {
+		const File& file = files.at(order[i]);
+		out += i ? ",\n    {\n      \"path\": " : "\n    {\n      \"path\": ";
+		AppendJsonString(out, order[i]);
+		out += ",\n      ";
+		if (viaIpc) {
+			AppendJsonTime(out, "sent", file.sent);
+			out += ",\n      ";
+			AppendJsonTime(out, "acknowledged", file.acknowledged);
+			out += ",\n      ";
+		}
+		AppendJsonTime(out, "queued", file.queued);
+		out += ",\n      ";
+		AppendJsonTime(out, "decodeStart", file.decodeStart);
+		out += ",\n      ";
+		AppendJsonTime(out, "decodeEnd", file.decodeEnd);
+		out += ",\n      ";
+		AppendJsonTime(out, "textureReady", file.textureReady);
+		out += ",\n      ";
+		AppendJsonTime(out, "firstPresent", file.firstPresent);
+		out += ",\n      \"width\": " + std::to_string(file.width);
+		out += ",\n      \"height\": " + std::to_string(file.height);
+		out += ",\n      \"error\": ";
+		if (file.error.empty()) {
+			out += "null";
+		} else {
+			AppendJsonString(out, file.error);
+		}
+		out += "\n    }";
+	}
+	out += order.empty() ? "]\n}\n" : "\n  ]\n}\n";
+	std::fputs(out.c_str(), stdout);
+	std::fflush(stdout);
+}
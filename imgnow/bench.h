@@ -0,0 +1,60 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <stdint.h>
+
+// Collects time-to-first-pixel measurements for --bench-open.
+// All times are in milliseconds since the process started and
+// are written to stdout as json once every file has been shown.
+struct Benchmark {
+	Benchmark(std::vector<std::string> paths, bool viaIpc, uint16_t port);
+	~Benchmark();
+	Benchmark(const Benchmark&) = delete;
+	Benchmark& operator=(const Benchmark&) = delete;
+	static double Now();
+	static void UseHeadlessVideo(); // Select the offscreen video driver unless overridden
+	static std::string Key(const std::string& path); // Canonical path used to identify a file
+	static void PrintClientResult(double connected, double sent, size_t fileCount);
+
+	void WindowShown(const char* rendererName);
+	void SendFiles(); // Send the files to this instance through MessageClient on a background thread
+	void FileQueued(const std::string& path);
+	void DecodeStarted(const std::string& path);
+	void DecodeFinished(const std::string& path, const std::string& error);
+	void TextureReady(const std::string& path, int width, int height);
+	void Presented(const std::string& path);
+	bool IsIpc() const;
+	bool Finished() const;
+	void Print() const;
+private:
+	struct File {
+		double sent = -1;
+		double queued = -1;
+		double decodeStart = -1;
+		double decodeEnd = -1;
+		double textureReady = -1;
+		double firstPresent = -1;
+		double acknowledged = -1; // The whole batch is acknowledged at once
+		int width = 0;
+		int height = 0;
+		std::string error;
+	};
+	File& Get(const std::string& path);
+	void FileSent(const std::string& path);
+	void SendFailed(const std::string& error);
+	void Acknowledged();
+	mutable std::mutex mutex;
+	std::map<std::string, File> files;
+	std::vector<std::string> order;
+	std::string renderer;
+	double windowShown = -1;
+	std::vector<std::string> paths;
+	bool viaIpc;
+	uint16_t port;
+	std::thread sendThread;
+	std::atomic_bool stopping = false; // Stops the send thread waiting for the acknowledgement
+};
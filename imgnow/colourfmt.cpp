@@ -1,5 +1,4 @@
 #include "colourfmt.h"
-#include <exception> // std::exception
 #include <cstdlib> // std::abort
 #include <cstdio> // std::snprintf
 #include <algorithm> // std::min, std::max
@@ -16,23 +15,6 @@ struct CmykColour {
 	int c, m, y, k, a;
 };
 
-struct FormatError : std::exception { };
-
-template<typename... Args>
-static std::string Format(const char* format, Args... args) {
-	int size = std::snprintf(nullptr, 0, format, args...);
-	if (size <= 0)
-		throw FormatError();
-	std::string s;
-	s.resize((size_t)size);
-	std::snprintf(s.data(), (size_t)size + 1, format, args...);
-	return s;
-}
-
-static std::string ToString2dp(float f) {
-	return Format("%.2ff", f);
-}
-
 static HsvColour RgbToHsv(const SDL_Colour& colour) {
 	float r = colour.r / 255.0f;
 	float g = colour.g / 255.0f;
@@ -125,109 +107,66 @@ static CmykColour RgbToCmyk(const SDL_Colour& colour) {
 	};
 }
 
-static const char* HEX_CHARS = "0123456789ABCDEF";
-
-static std::string HexA(const SDL_Colour& colour) {
-	return std::string()
-		+ HEX_CHARS[(colour.r >> 4) & 0xF] + HEX_CHARS[colour.r & 0xF]
-		+ HEX_CHARS[(colour.g >> 4) & 0xF] + HEX_CHARS[colour.g & 0xF]
-		+ HEX_CHARS[(colour.b >> 4) & 0xF] + HEX_CHARS[colour.b & 0xF]
-		+ HEX_CHARS[(colour.a >> 4) & 0xF] + HEX_CHARS[colour.a & 0xF];
+// Each formatter writes into buffer like snprintf and returns the untruncated length
+static int HexA(char* buffer, size_t size, const SDL_Colour& colour) {
+	return std::snprintf(buffer, size, "%02X%02X%02X%02X", colour.r, colour.g, colour.b, colour.a);
 }
 
-static std::string Hex(const SDL_Colour& colour) {
-	return std::string()
-		+ HEX_CHARS[(colour.r >> 4) & 0xF] + HEX_CHARS[colour.r & 0xF]
-		+ HEX_CHARS[(colour.g >> 4) & 0xF] + HEX_CHARS[colour.g & 0xF]
-		+ HEX_CHARS[(colour.b >> 4) & 0xF] + HEX_CHARS[colour.b & 0xF];
+static int Hex(char* buffer, size_t size, const SDL_Colour& colour) {
+	return std::snprintf(buffer, size, "%02X%02X%02X", colour.r, colour.g, colour.b);
 }
 
-static std::string DecA(const SDL_Colour& colour) {
-	return "("
-		+ std::to_string(colour.r) + ", "
-		+ std::to_string(colour.g) + ", "
-		+ std::to_string(colour.b) + ", "
-		+ std::to_string(colour.a) + ")";
+static int DecA(char* buffer, size_t size, const SDL_Colour& colour) {
+	return std::snprintf(buffer, size, "(%d, %d, %d, %d)", colour.r, colour.g, colour.b, colour.a);
 }
 
-static std::string Dec(const SDL_Colour& colour) {
-	return "("
-		+ std::to_string(colour.r) + ", "
-		+ std::to_string(colour.g) + ", "
-		+ std::to_string(colour.b) + ")";
+static int Dec(char* buffer, size_t size, const SDL_Colour& colour) {
+	return std::snprintf(buffer, size, "(%d, %d, %d)", colour.r, colour.g, colour.b);
 }
 
-static std::string FloatA(const SDL_Colour& colour) {
-	return std::string("(")
-		+ ToString2dp(colour.r / 255.0f) + ", "
-		+ ToString2dp(colour.g / 255.0f) + ", "
-		+ ToString2dp(colour.b / 255.0f) + ", "
-		+ ToString2dp(colour.a / 255.0f) + ")";
+static int FloatA(char* buffer, size_t size, const SDL_Colour& colour) {
+	return std::snprintf(buffer, size, "(%.2ff, %.2ff, %.2ff, %.2ff)",
+		colour.r / 255.0f, colour.g / 255.0f, colour.b / 255.0f, colour.a / 255.0f);
 }
 
-static std::string Float(const SDL_Colour& colour) {
-	return "("
-		+ ToString2dp(colour.r / 255.0f) + ", "
-		+ ToString2dp(colour.g / 255.0f) + ", "
-		+ ToString2dp(colour.b / 255.0f) + ")";
+static int Float(char* buffer, size_t size, const SDL_Colour& colour) {
+	return std::snprintf(buffer, size, "(%.2ff, %.2ff, %.2ff)",
+		colour.r / 255.0f, colour.g / 255.0f, colour.b / 255.0f);
 }
 
-static std::string HsvA(const SDL_Colour& colour) {
+static int HsvA(char* buffer, size_t size, const SDL_Colour& colour) {
 	HsvColour hsv = RgbToHsv(colour);
-	return "("
-		+ std::to_string(hsv.h) + ", "
-		+ std::to_string(hsv.s) + ", "
-		+ std::to_string(hsv.v) + ", "
-		+ std::to_string(hsv.a) + ")";
+	return std::snprintf(buffer, size, "(%d, %d, %d, %d)", hsv.h, hsv.s, hsv.v, hsv.a);
 }
 
-static std::string Hsv(const SDL_Colour& colour) {
+static int Hsv(char* buffer, size_t size, const SDL_Colour& colour) {
 	HsvColour hsv = RgbToHsv(colour);
-	return "("
-		+ std::to_string(hsv.h) + ", "
-		+ std::to_string(hsv.s) + ", "
-		+ std::to_string(hsv.v) + ")";
+	return std::snprintf(buffer, size, "(%d, %d, %d)", hsv.h, hsv.s, hsv.v);
 }
 
-static std::string HslA(const SDL_Colour& colour) {
+static int HslA(char* buffer, size_t size, const SDL_Colour& colour) {
 	HslColour hsl = RgbToHsl(colour);
-	return "("
-		+ std::to_string(hsl.h) + ", "
-		+ std::to_string(hsl.s) + ", "
-		+ std::to_string(hsl.l) + ", "
-		+ std::to_string(hsl.a) + ")";
+	return std::snprintf(buffer, size, "(%d, %d, %d, %d)", hsl.h, hsl.s, hsl.l, hsl.a);
 }
 
-static std::string Hsl(const SDL_Colour& colour) {
+static int Hsl(char* buffer, size_t size, const SDL_Colour& colour) {
 	HslColour hsl = RgbToHsl(colour);
-	return "("
-		+ std::to_string(hsl.h) + ", "
-		+ std::to_string(hsl.s) + ", "
-		+ std::to_string(hsl.l) + ")";
+	return std::snprintf(buffer, size, "(%d, %d, %d)", hsl.h, hsl.s, hsl.l);
 }
 
-static std::string CmykA(const SDL_Colour& colour) {
+static int CmykA(char* buffer, size_t size, const SDL_Colour& colour) {
 	CmykColour cmyk = RgbToCmyk(colour);
-	return "("
-		+ std::to_string(cmyk.c) + ", "
-		+ std::to_string(cmyk.m) + ", "
-		+ std::to_string(cmyk.y) + ", "
-		+ std::to_string(cmyk.k) + ", "
-		+ std::to_string(cmyk.a) + ")";
+	return std::snprintf(buffer, size, "(%d, %d, %d, %d, %d)", cmyk.c, cmyk.m, cmyk.y, cmyk.k, cmyk.a);
 }
 
-static std::string Cmyk(const SDL_Colour& colour) {
+static int Cmyk(char* buffer, size_t size, const SDL_Colour& colour) {
 	CmykColour cmyk = RgbToCmyk(colour);
-	return "("
-		+ std::to_string(cmyk.c) + ", "
-		+ std::to_string(cmyk.m) + ", "
-		+ std::to_string(cmyk.y) + ", "
-		+ std::to_string(cmyk.k) + ")";
+	return std::snprintf(buffer, size, "(%d, %d, %d, %d)", cmyk.c, cmyk.m, cmyk.y, cmyk.k);
 }
 
 struct Fmt {
 	const char* label;
-	std::string(*format)(const SDL_Colour&);
+	int(*format)(char*, size_t, const SDL_Colour&);
 };
 
 static const Fmt FORMATS[] = {
@@ -264,13 +203,18 @@ const char* ColourFormatter::GetLabel() const {
 }
 
 std::string ColourFormatter::FormatColour(const SDL_Colour& colour) const {
-	try {
-		if (alphaEnabled) {
-			return FORMATS[format * 2].format(colour);
-		} else {
-			return FORMATS[format * 2 + 1].format(colour);
-		}
-	} catch (FormatError&) {
-		return "-";
+	char buffer[64];
+	size_t length = FormatColour(colour, buffer, sizeof(buffer));
+	return std::string(buffer, length);
+}
+
+size_t ColourFormatter::FormatColour(const SDL_Colour& colour, char* buffer, size_t size) const {
+	if (size == 0)
+		return 0;
+	const Fmt& fmt = FORMATS[format * 2 + (alphaEnabled ? 0 : 1)];
+	int length = fmt.format(buffer, size, colour);
+	if (length <= 0) {
+		length = std::snprintf(buffer, size, "-");
 	}
+	return std::min((size_t)length, size - 1);
 }
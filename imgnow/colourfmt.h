@@ -9,6 +9,8 @@ struct ColourFormatter {
 	void SwitchFormat(); // Go to the next format
 	const char* GetLabel() const;
 	std::string FormatColour(const SDL_Colour& colour) const;
+	// Writes a null terminated, possibly truncated string and returns its length, without allocating
+	size_t FormatColour(const SDL_Colour& colour, char* buffer, size_t size) const;
 private:
 	int format = 0;
 };
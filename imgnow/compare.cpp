@@ -0,0 +1,212 @@
+#include "compare.h"
+#include <cmath>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMGNOW_SSE2
+#include <emmintrin.h>
+#endif
+
+constexpr int BAND_ROWS = 64;
+constexpr int FLUSH_PIXELS = 16384; // Squared errors of this many pixels fit in the 32 bit lanes
+
+// Colour ramp from dark blue through red and yellow to white, indexed by the largest channel
+// difference of a pixel. The square root makes differences of a few levels stand out.
+static const std::array<uint32_t, 256>& GetHeatPalette() {
+	static const std::array<uint32_t, 256> palette = [] {
+		struct Stop { float t, r, g, b; };
+		static const Stop STOPS[] = {
+			{ 0.0f, 30, 30, 140 },
+			{ 0.35f, 210, 30, 60 },
+			{ 0.7f, 255, 200, 0 },
+			{ 1.0f, 255, 255, 255 },
+		};
+		std::array<uint32_t, 256> palette{};
+		palette[0] = 0xFF000000;
+		for (int d = 1; d < 256; d++) {
+			float t = std::sqrt(d / 255.0f);
+			int i = 0;
+			while (i < 2 && t > STOPS[i + 1].t) {
+				i++;
+			}
+			const Stop& lo = STOPS[i];
+			const Stop& hi = STOPS[i + 1];
+			float f = (t - lo.t) / (hi.t - lo.t);
+			uint32_t r = (uint32_t)std::lerp(lo.r, hi.r, f);
+			uint32_t g = (uint32_t)std::lerp(lo.g, hi.g, f);
+			uint32_t b = (uint32_t)std::lerp(lo.b, hi.b, f);
+			palette[d] = 0xFF000000 | b << 16 | g << 8 | r;
+		}
+		return palette;
+	}();
+	return palette;
+}
+
+CompareEngine::Band CompareEngine::CompareBand(const Job& job, uint8_t* heatmap, int width, int y0, int y1, const std::atomic<bool>& cancelled) {
+	const auto& palette = GetHeatPalette();
+	Band band;
+	for (int y = y0; y < y1; y++) {
+		if (cancelled)
+			break;
+		const uint8_t* a = job.a.pixels.get() + (size_t)y * job.a.width * 4;
+		const uint8_t* b = job.b.pixels.get() + (size_t)y * job.b.width * 4;
+		uint32_t* heat = (uint32_t*)heatmap + (size_t)y * width;
+		int x = 0;
+#ifdef IMGNOW_SSE2
+		const __m128i zero = _mm_setzero_si128();
+		__m128i maxError = zero;
+		alignas(16) uint32_t lanes[4];
+		while (x + 4 <= width) {
+			__m128i squares = zero;
+			int end = std::min(width - 3, x + FLUSH_PIXELS);
+			for (; x < end; x += 4) {
+				__m128i va = _mm_loadu_si128((const __m128i*)(a + x * 4));
+				__m128i vb = _mm_loadu_si128((const __m128i*)(b + x * 4));
+				__m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+				maxError = _mm_max_epu8(maxError, d);
+
+				// Widened to 16 bits and squared, with pairs of channels summed into 32 bits
+				__m128i lo = _mm_unpacklo_epi8(d, zero);
+				__m128i hi = _mm_unpackhi_epi8(d, zero);
+				squares = _mm_add_epi32(squares, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+
+				int equal = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(va, vb)));
+				band.differingPixels += 4 - std::popcount((unsigned)equal);
+
+				// Largest channel of each pixel ends up in its low byte
+				__m128i m = _mm_max_epu8(d, _mm_srli_epi32(d, 8));
+				m = _mm_max_epu8(m, _mm_srli_epi32(m, 16));
+				_mm_store_si128((__m128i*)lanes, m);
+				heat[x] = palette[lanes[0] & 0xFF];
+				heat[x + 1] = palette[lanes[1] & 0xFF];
+				heat[x + 2] = palette[lanes[2] & 0xFF];
+				heat[x + 3] = palette[lanes[3] & 0xFF];
+			}
+			_mm_store_si128((__m128i*)lanes, squares);
+			band.squaredError += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+		}
+		alignas(16) uint8_t maxBytes[16];
+		_mm_store_si128((__m128i*)maxBytes, maxError);
+		for (uint8_t m : maxBytes) {
+			band.maxError = std::max(band.maxError, (int)m);
+		}
+#endif
+		for (; x < width; x++) {
+			int largest = 0;
+			for (int c = 0; c < 4; c++) {
+				int d = std::abs(a[x * 4 + c] - b[x * 4 + c]);
+				band.squaredError += (uint64_t)(d * d);
+				largest = std::max(largest, d);
+			}
+			band.maxError = std::max(band.maxError, largest);
+			band.differingPixels += largest != 0;
+			heat[x] = palette[largest];
+		}
+	}
+	return band;
+}
+
+CompareEngine::CompareEngine(std::shared_ptr<ThreadPool> pool) :
+	pool(std::move(pool)) {
+}
+
+void CompareEngine::Request(uint64_t key, PixelSource a, PixelSource b) {
+	// Already compared or being compared
+	if (lastKey == key) {
+		pending.reset();
+		return;
+	}
+	pending = Job{ key, std::move(a), std::move(b) };
+	Update();
+}
+
+void CompareEngine::Start(Job job) {
+	int width = std::min(job.a.width, job.b.width);
+	int height = std::min(job.a.height, job.b.height);
+	Run run;
+	run.result.key = job.key;
+	run.result.width = width;
+	run.result.height = height;
+	run.result.sizesMatch = job.a.width == job.b.width && job.a.height == job.b.height;
+	if (width > 0 && height > 0) {
+		run.result.heatmap = std::shared_ptr<uint8_t>(new uint8_t[(size_t)width * height * 4], std::default_delete<uint8_t[]>());
+	}
+	run.cancelled = std::make_shared<std::atomic<bool>>(false);
+
+	// The job and heatmap are shared by every band and outlive the engine if it is cleared
+	auto shared = std::make_shared<const Job>(std::move(job));
+	for (int y = 0; y < height; y += BAND_ROWS) {
+		run.bands.push_back(pool->Submit([shared, heatmap = run.result.heatmap, cancelled = run.cancelled, width, y, y1 = std::min(height, y + BAND_ROWS)] {
+			return CompareBand(*shared, heatmap.get(), width, y, y1, *cancelled);
+			}));
+	}
+	lastKey = shared->key;
+	running = std::move(run);
+}
+
+void CompareEngine::Update() {
+	if (running) {
+		for (auto& band : running->bands) {
+			if (band.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+				return;
+		}
+
+		Band total;
+		bool discarded = false;
+		for (auto& band : running->bands) {
+			try {
+				Band b = band.get();
+				total.squaredError += b.squaredError;
+				total.differingPixels += b.differingPixels;
+				total.maxError = std::max(total.maxError, b.maxError);
+			} catch (std::future_error&) {
+				// Discarded by ThreadPool::Clear
+				discarded = true;
+			}
+		}
+		if (discarded) {
+			lastKey.reset();
+		} else {
+			CompareResult& r = running->result;
+			r.differingPixels = total.differingPixels;
+			r.maxError = total.maxError;
+			double mse = (double)total.squaredError / std::max<uint64_t>(1, (uint64_t)r.width * r.height * 4);
+			r.psnr = mse == 0
+				? std::numeric_limits<double>::infinity()
+				: 10 * std::log10(255.0 * 255.0 / mse);
+			result = std::move(r);
+			sequence++;
+		}
+		running.reset();
+	}
+	if (pending) {
+		Start(std::move(*pending));
+		pending.reset();
+	}
+}
+
+const CompareResult* CompareEngine::Get() const {
+	return result ? &*result : nullptr;
+}
+
+uint64_t CompareEngine::GetSequence() const {
+	return sequence;
+}
+
+bool CompareEngine::Busy() const {
+	return running.has_value() || pending.has_value();
+}
+
+void CompareEngine::Clear() {
+	if (running) {
+		*running->cancelled = true;
+	}
+	running.reset();
+	pending.reset();
+	lastKey.reset();
+	result.reset();
+	sequence++;
+}
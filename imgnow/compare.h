@@ -0,0 +1,66 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#include <future>
+#include <atomic>
+#include <optional>
+#include "threadpool.h"
+
+// One frame of RGBA8 pixels, kept alive while it is being compared
+struct PixelSource {
+	int width = 0;
+	int height = 0;
+	std::shared_ptr<const uint8_t> pixels;
+};
+
+struct CompareResult {
+	uint64_t key = 0; // Of the request
+	int width = 0; // Of the overlap of the two images, aligned at their top left corners
+	int height = 0;
+	bool sizesMatch = false;
+	uint64_t differingPixels = 0;
+	int maxError = 0; // Largest difference in any channel
+	double psnr = 0; // Over every channel, infinite if the pixels are identical
+	std::shared_ptr<uint8_t> heatmap; // Opaque RGBA, black where the images match
+};
+
+// Computes the absolute difference of two images on a thread pool. The overlap is split into
+// bands of rows that are compared with SSE2 in parallel, each producing part of the heatmap
+// and partial sums that are combined once every band has finished.
+// Only the latest request is kept while a comparison is running.
+struct CompareEngine {
+	explicit CompareEngine(std::shared_ptr<ThreadPool> pool);
+	CompareEngine(const CompareEngine&) = delete;
+	CompareEngine& operator=(const CompareEngine&) = delete;
+	void Request(uint64_t key, PixelSource a, PixelSource b); // key identifies both sets of pixels
+	void Update(); // Call every frame to collect finished work and start pending work
+	const CompareResult* Get() const; // The latest result, null if none has finished
+	uint64_t GetSequence() const; // Incremented whenever Get changes
+	bool Busy() const;
+	void Clear(); // Forget the images and any results
+private:
+	struct Job {
+		uint64_t key = 0;
+		PixelSource a;
+		PixelSource b;
+	};
+	struct Band {
+		uint64_t squaredError = 0;
+		uint64_t differingPixels = 0;
+		int maxError = 0;
+	};
+	struct Run {
+		CompareResult result;
+		std::shared_ptr<std::atomic<bool>> cancelled;
+		std::vector<std::future<Band>> bands;
+	};
+	static Band CompareBand(const Job& job, uint8_t* heatmap, int width, int y0, int y1, const std::atomic<bool>& cancelled);
+	void Start(Job job);
+	std::shared_ptr<ThreadPool> pool;
+	std::optional<Job> pending;
+	std::optional<Run> running;
+	std::optional<uint64_t> lastKey; // Of the running or latest comparison
+	std::optional<CompareResult> result;
+	uint64_t sequence = 0;
+};
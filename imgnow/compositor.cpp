@@ -0,0 +1,254 @@
+#include "compositor.h"
+#include <cmath>
+#include <algorithm>
+#include <cstring> // memcpy
+#include "window.h" // SDLException
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMGNOW_SSE2
+#include <emmintrin.h>
+#endif
+
+constexpr uint32_t OPAQUE_BLACK = 0xFF000000;
+constexpr uint32_t GRID_COLOUR = 0xFF1E1E1E; // Same as App::DrawGrid
+constexpr int CHECKER_SIZE_SHIFT = 3; // 8 pixel squares, same as OverlayRenderer
+constexpr int MIN_BAND_HEIGHT = 16;
+
+Compositor::Compositor(SDL_Renderer* renderer, int threadCount) :
+	renderer(renderer),
+	pool(threadCount) {
+}
+
+Compositor::~Compositor() {
+	if (target) {
+		SDL_DestroyTexture(target);
+	}
+}
+
+void Compositor::Draw(const CompositorView& view, int windowWidth, int windowHeight, const SDL_Rect& area) {
+	SDL_Rect window = { 0, 0, windowWidth, windowHeight };
+	SDL_Rect clipped{};
+	if (!SDL_IntersectRect(&area, &window, &clipped))
+		return;
+
+	if (!target || targetWidth != windowWidth || targetHeight != windowHeight) {
+		if (target) {
+			SDL_DestroyTexture(target);
+		}
+		target = SDL_CreateTexture(
+			renderer,
+			SDL_PixelFormatEnum::SDL_PIXELFORMAT_ABGR8888,
+			SDL_TEXTUREACCESS_STREAMING,
+			windowWidth,
+			windowHeight);
+		if (!target)
+			throw SDLException();
+		SDL_SetTextureBlendMode(target, SDL_BLENDMODE_NONE);
+		targetWidth = windowWidth;
+		targetHeight = windowHeight;
+	}
+
+	void* pixels = nullptr;
+	int pitch = 0;
+	if (SDL_LockTexture(target, &clipped, &pixels, &pitch) != 0)
+		throw SDLException();
+	Render(view, (uint8_t*)pixels, pitch, windowWidth, windowHeight, clipped);
+	SDL_UnlockTexture(target);
+	SDL_RenderCopy(renderer, target, &clipped, &clipped);
+}
+
+void Compositor::BuildSamples(std::vector<Sample>& samples, int count, float start, float step, int size) {
+	samples.resize(count);
+	int previous = -1;
+	for (int k = 0; k < count; k++) {
+		// Sample at the centre of the window pixel
+		float c = start + step * (k + 0.5f);
+		Sample& s = samples[k];
+		int n = (int)std::floor(c);
+		s.nearest = n >= 0 && n < size ? n : -1;
+		s.grid = k > 0 && s.nearest != -1 && s.nearest != previous;
+		previous = s.nearest;
+
+		float b = c - 0.5f;
+		float i0 = std::floor(b);
+		s.weight = (int)std::lround((b - i0) * 128);
+		s.i0 = std::clamp((int)i0, 0, size - 1);
+		s.i1 = std::clamp((int)i0 + 1, 0, size - 1);
+	}
+}
+
+void Compositor::Render(const CompositorView& view, uint8_t* out, int pitch, int outWidth, int outHeight, const SDL_Rect& area) {
+	// Invert the transform of SDL_RenderCopyEx. A window pixel is offset from the centre of
+	// the destination rect, rotated back and scaled into image space, then flipped.
+	// With whole quarter turns each image axis depends on only one window axis.
+	float s = view.scale;
+	float cx = view.x + view.width * s / 2;
+	float cy = view.y + view.height * s / 2;
+	float fu = view.flipHorizontal ? -1.0f : 1.0f;
+	float fv = view.flipVertical ? -1.0f : 1.0f;
+	int rotation = ((view.rotation % 4) + 4) % 4;
+	transposed = rotation % 2 == 1;
+	if (!transposed) {
+		float sign = rotation == 0 ? 1.0f : -1.0f;
+		float stepU = fu * sign / s;
+		float stepV = fv * sign / s;
+		BuildSamples(columns, outWidth, view.width / 2.0f - stepU * cx, stepU, view.width);
+		BuildSamples(rows, outHeight, view.height / 2.0f - stepV * cy, stepV, view.height);
+	} else {
+		// Window columns walk the image's v axis and window rows walk its u axis
+		float signX = rotation == 1 ? -1.0f : 1.0f;
+		float signY = -signX;
+		float stepV = fv * signX / s;
+		float stepU = fu * signY / s;
+		BuildSamples(columns, outWidth, view.height / 2.0f - stepV * cx, stepV, view.height);
+		BuildSamples(rows, outHeight, view.width / 2.0f - stepU * cy, stepU, view.width);
+	}
+
+	int bandCount = std::clamp(area.h / MIN_BAND_HEIGHT, 1, pool.GetThreadCount() * 2);
+	if (bandCount == 1) {
+		RenderBand(view, out, pitch, area, area.y, area.y + area.h);
+		return;
+	}
+	std::vector<std::future<void>> bands;
+	bands.reserve(bandCount);
+	for (int i = 0; i < bandCount; i++) {
+		int y0 = area.y + area.h * i / bandCount;
+		int y1 = area.y + area.h * (i + 1) / bandCount;
+		bands.push_back(pool.Submit([=, this, &view, &area] {
+			RenderBand(view, out, pitch, area, y0, y1);
+			}));
+	}
+	for (auto& band : bands) {
+		band.get();
+	}
+}
+
+static uint32_t Load(const uint8_t* pixels, int width, int x, int y) {
+	uint32_t p;
+	std::memcpy(&p, pixels + ((size_t)y * width + x) * 4, 4);
+	return p;
+}
+
+template <typename S>
+static uint32_t Bilinear(const uint8_t* pixels, int width, const S& sx, const S& sy) {
+	uint32_t p00 = Load(pixels, width, sx.i0, sy.i0);
+	uint32_t p10 = Load(pixels, width, sx.i1, sy.i0);
+	uint32_t p01 = Load(pixels, width, sx.i0, sy.i1);
+	uint32_t p11 = Load(pixels, width, sx.i1, sy.i1);
+#ifdef IMGNOW_SSE2
+	// Both rows are interpolated horizontally at once, one per 64 bit half
+	__m128i zero = _mm_setzero_si128();
+	__m128i left = _mm_unpacklo_epi8(_mm_set_epi32(0, 0, (int)p01, (int)p00), zero);
+	__m128i right = _mm_unpacklo_epi8(_mm_set_epi32(0, 0, (int)p11, (int)p10), zero);
+	__m128i dx = _mm_mullo_epi16(_mm_sub_epi16(right, left), _mm_set1_epi16((short)sx.weight));
+	__m128i h = _mm_add_epi16(left, _mm_srai_epi16(dx, 7));
+	__m128i bottom = _mm_unpackhi_epi64(h, h);
+	__m128i dy = _mm_mullo_epi16(_mm_sub_epi16(bottom, h), _mm_set1_epi16((short)sy.weight));
+	__m128i v = _mm_add_epi16(h, _mm_srai_epi16(dy, 7));
+	return (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(v, v));
+#else
+	uint32_t result = 0;
+	for (int shift = 0; shift < 32; shift += 8) {
+		int a = (p00 >> shift) & 0xFF;
+		int b = (p10 >> shift) & 0xFF;
+		int c = (p01 >> shift) & 0xFF;
+		int d = (p11 >> shift) & 0xFF;
+		int top = a + (((b - a) * sx.weight) >> 7);
+		int bottom = c + (((d - c) * sx.weight) >> 7);
+		int v = top + (((bottom - top) * sy.weight) >> 7);
+		result |= (uint32_t)std::clamp(v, 0, 255) << shift;
+	}
+	return result;
+#endif
+}
+
+// Blends c over the background colour bg with c's alpha and returns an opaque pixel
+static uint32_t BlendOver(uint32_t c, uint32_t bg) {
+	uint32_t a = c >> 24;
+	uint32_t result = OPAQUE_BLACK;
+	for (int shift = 0; shift < 24; shift += 8) {
+		uint32_t fg = (c >> shift) & 0xFF;
+		uint32_t b = (bg >> shift) & 0xFF;
+		result |= ((fg * a + b * (255 - a) + 127) / 255) << shift;
+	}
+	return result;
+}
+
+// dst points to window column x0
+template <bool Transposed, bool Linear, typename S>
+static void SampleRow(const CompositorView& view, uint32_t* dst, const S* columns, const S& row, int x0, int x1) {
+	for (int px = x0; px < x1; px++, dst++) {
+		const S& sx = Transposed ? row : columns[px];
+		const S& sy = Transposed ? columns[px] : row;
+		if (sx.nearest < 0 || sy.nearest < 0) {
+			*dst = OPAQUE_BLACK;
+		} else if (Linear) {
+			*dst = Bilinear(view.pixels, view.width, sx, sy);
+		} else {
+			*dst = Load(view.pixels, view.width, sx.nearest, sy.nearest);
+		}
+	}
+}
+
+void Compositor::RenderBand(const CompositorView& view, uint8_t* out, int pitch, const SDL_Rect& area, int y0, int y1) const {
+	const SDL_Rect& sel = view.selection;
+	int x0 = area.x;
+	int x1 = area.x + area.w;
+	for (int py = y0; py < y1; py++) {
+		uint32_t* dst = (uint32_t*)(out + (size_t)(py - area.y) * pitch); // Starts at column x0
+		const Sample& row = rows[py];
+
+		if (transposed) {
+			view.bilinear
+				? SampleRow<true, true>(view, dst, columns.data(), row, x0, x1)
+				: SampleRow<true, false>(view, dst, columns.data(), row, x0, x1);
+		} else if (row.nearest < 0) {
+			std::fill(dst, dst + area.w, OPAQUE_BLACK);
+			continue;
+		} else {
+			view.bilinear
+				? SampleRow<false, true>(view, dst, columns.data(), row, x0, x1)
+				: SampleRow<false, false>(view, dst, columns.data(), row, x0, x1);
+		}
+
+		// Overlays
+		bool selectedRow = py >= sel.y && py < sel.y + sel.h;
+		bool selectionEdgeRow = py == sel.y || py == sel.y + sel.h - 1;
+		if (view.opaque && !view.gridAlpha && !selectedRow)
+			continue;
+		for (int px = x0; px < x1; px++) {
+			const Sample& column = columns[px];
+			bool inside = transposed
+				? column.nearest >= 0 && row.nearest >= 0
+				: column.nearest >= 0;
+			if (!inside)
+				continue;
+
+			uint32_t p = dst[px - x0];
+			if ((p >> 24) != 0xFF) {
+				uint32_t bg = OPAQUE_BLACK;
+				if (view.checkerboard) {
+					// Arithmetic shifts round down, so squares left of or above the origin line up too
+					int cx = (px - view.checkerOrigin.x) >> CHECKER_SIZE_SHIFT;
+					int cy = (py - view.checkerOrigin.y) >> CHECKER_SIZE_SHIFT;
+					bool light = ((cx + cy) & 1) != 0;
+					bg = light ? 0xFFFFFFFF : 0xFFBFBFBF;
+				}
+				p = view.binaryAlpha ? bg : BlendOver(p, bg);
+			}
+
+			if (view.gridAlpha && (column.grid || row.grid)) {
+				p = BlendOver((GRID_COLOUR & 0x00FFFFFF) | ((uint32_t)view.gridAlpha << 24), p);
+			}
+
+			if (selectedRow && px >= sel.x && px < sel.x + sel.w) {
+				if (selectionEdgeRow || px == sel.x || px == sel.x + sel.w - 1) {
+					p = BlendOver((p & 0x00FFFFFF) | (55u << 24), 0xFFC8C8C8);
+				} else {
+					p = BlendOver((p & 0x00FFFFFF) | (155u << 24), OPAQUE_BLACK);
+				}
+			}
+			dst[px - x0] = p;
+		}
+	}
+}
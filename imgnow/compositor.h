@@ -0,0 +1,62 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include "SDL.h"
+#include "threadpool.h"
+
+// Everything needed to draw the visible image in one pass.
+// The geometry matches SDL_RenderCopyEx with a destination rect of
+// { x, y, width * scale, height * scale } rotated by 90 * rotation degrees about its centre.
+struct CompositorView {
+	const uint8_t* pixels = nullptr; // RGBA8, width * height
+	int width = 0;
+	int height = 0;
+	float x = 0;
+	float y = 0;
+	float scale = 1;
+	int rotation = 0; // Whole quarter turns only
+	bool flipHorizontal = false;
+	bool flipVertical = false;
+	bool bilinear = false;
+	bool opaque = false; // Every pixel has alpha 255, so nothing needs blending
+	bool binaryAlpha = false; // Every sample has alpha 0 or 255, so blending is a choice of pixel
+	bool checkerboard = false; // Blend over a checkerboard instead of black
+	SDL_Point checkerOrigin = { 0, 0 }; // Top left of the image on screen, where the squares start
+	uint8_t gridAlpha = 0; // 0 hides the grid
+	SDL_Rect selection = { 0, 0, 0, 0 }; // In window coordinates, empty if nothing is selected
+};
+
+// Draws the image and its overlays on the CPU into a streaming texture that covers the window.
+// SDL's software renderer transforms textures on a single thread one pixel at a time, which is
+// very slow for large rotated or zoomed images. Here the transform is precomputed per row and
+// column, the window is split into bands which are rendered in parallel and bilinear filtering
+// uses SSE2 where available.
+struct Compositor {
+	Compositor(SDL_Renderer* renderer, int threadCount);
+	~Compositor();
+	Compositor(const Compositor&) = delete;
+	Compositor& operator=(const Compositor&) = delete;
+	// Only area is rendered again, the rest of the texture is kept from previous frames
+	void Draw(const CompositorView& view, int windowWidth, int windowHeight, const SDL_Rect& area);
+	// Renders area of a window sized RGBA8 image into out, which points to the top left of area
+	void Render(const CompositorView& view, uint8_t* out, int pitch, int outWidth, int outHeight, const SDL_Rect& area);
+private:
+	// Source coordinates of a window row or column along one image axis
+	struct Sample {
+		int nearest; // -1 if outside the image
+		int i0;      // Bilinear taps, clamped to the image
+		int i1;
+		int weight;  // Of i1, 0 to 128
+		bool grid;   // First window pixel of a new image pixel
+	};
+	static void BuildSamples(std::vector<Sample>& samples, int count, float start, float step, int size);
+	void RenderBand(const CompositorView& view, uint8_t* out, int pitch, const SDL_Rect& area, int y0, int y1) const;
+	SDL_Renderer* renderer;
+	SDL_Texture* target = nullptr;
+	int targetWidth = 0;
+	int targetHeight = 0;
+	ThreadPool pool;
+	std::vector<Sample> columns;
+	std::vector<Sample> rows;
+	bool transposed = false; // Window columns walk image rows when rotated by 90 or 270 degrees
+};
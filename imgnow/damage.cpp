@@ -0,0 +1,58 @@
+#include "damage.h"
+
+// Beyond this many rects it is cheaper to redraw their bounding box
+constexpr size_t MAX_DAMAGE_RECTS = 4;
+
+void DamageTracker::Set(Region region, uint64_t fingerprint, SDL_Rect bounds) {
+	current[(size_t)region] = { fingerprint, bounds };
+}
+
+void DamageTracker::Invalidate() {
+	invalidated = true;
+}
+
+std::vector<SDL_Rect> DamageTracker::Collect(SDL_Point clientSize) {
+	SDL_Rect window = { 0, 0, clientSize.x, clientSize.y };
+	bool full = invalidated || clientSize.x != previousSize.x || clientSize.y != previousSize.y;
+	invalidated = false;
+	previousSize = clientSize;
+
+	std::vector<SDL_Rect> damage;
+	auto add = [&](SDL_Rect rc) {
+		SDL_Rect clipped{};
+		if (!SDL_IntersectRect(&rc, &window, &clipped))
+			return;
+		// Merge with overlapping rects so that nothing is drawn twice
+		for (auto it = damage.begin(); it != damage.end(); ) {
+			if (SDL_HasIntersection(&*it, &clipped)) {
+				SDL_UnionRect(&*it, &clipped, &clipped);
+				it = damage.erase(it);
+			} else {
+				++it;
+			}
+		}
+		damage.push_back(clipped);
+	};
+
+	for (size_t i = 0; i < current.size(); i++) {
+		const State& prev = previous[i];
+		const State& cur = current[i];
+		if (!full && prev.fingerprint != cur.fingerprint) {
+			add(prev.bounds);
+			add(cur.bounds);
+		}
+	}
+	previous = current;
+
+	if (full) {
+		return { window };
+	}
+	if (damage.size() > MAX_DAMAGE_RECTS) {
+		SDL_Rect bounds = damage[0];
+		for (const SDL_Rect& rc : damage) {
+			SDL_UnionRect(&bounds, &rc, &bounds);
+		}
+		damage = { bounds };
+	}
+	return damage;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <stdint.h>
+#include <cstring> // memcpy
+#include <type_traits>
+#include <array>
+#include <vector>
+#include "SDL.h"
+
+// Hash of everything that affects how part of the window looks.
+struct Fingerprint {
+	template <typename T>
+	Fingerprint& Add(const T& value) {
+		static_assert(std::is_trivially_copyable_v<T>);
+		uint8_t bytes[sizeof(T)];
+		std::memcpy(bytes, &value, sizeof(T));
+		return AddBytes(bytes, sizeof(T));
+	}
+	Fingerprint& AddBytes(const void* data, size_t size) {
+		for (size_t i = 0; i < size; i++) {
+			hash = (hash ^ ((const uint8_t*)data)[i]) * 0x100000001b3;
+		}
+		return *this;
+	}
+	uint64_t Get() const { return hash; }
+private:
+	uint64_t hash = 0xcbf29ce484222325;
+};
+
+// Finds the parts of the window that have to be redrawn. Each frame every region
+// reports a fingerprint of its inputs and its bounds on screen. If the fingerprint
+// changed, both the old and new bounds are damaged.
+struct DamageTracker {
+	enum class Region {
+		View,      // The image, checkerboard and grid
+		Selection,
+		Sidebar,
+		Status,    // Status bar along the bottom
+		Hud,       // Performance overlay in the top left
+		Stats,     // Selection statistics above the status bar
+		Compare,   // Comparison results along the top
+		Errors,    // Load errors below the comparison results
+		Progress,  // Clipboard copy and export progress in the bottom right
+		Count,
+	};
+	void Set(Region region, uint64_t fingerprint, SDL_Rect bounds);
+	void Invalidate(); // Redraw the whole window on the next frame
+	// Returns the damaged rects clipped to the window, or nothing if the frame can be skipped.
+	std::vector<SDL_Rect> Collect(SDL_Point clientSize);
+private:
+	struct State {
+		uint64_t fingerprint = 0;
+		SDL_Rect bounds{};
+	};
+	std::array<State, (size_t)Region::Count> previous{};
+	std::array<State, (size_t)Region::Count> current{};
+	SDL_Point previousSize{};
+	bool invalidated = true;
+};
@@ -0,0 +1,670 @@
+#include "export.h"
+#include <cstring> // memcpy, strerror
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib> // abs
+#include <cctype> // tolower
+#include <array>
+#include <algorithm>
+#include <vector>
+#include <queue>
+#include <functional>
+#include <filesystem>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+constexpr size_t CHUNK_BYTES = 1 << 20; // Pixels encoded together, chunks are independent so they can be encoded in parallel
+constexpr size_t DEFLATE_WINDOW = 32768;
+constexpr int DEFLATE_HASH_BITS = 15;
+constexpr int DEFLATE_MIN_MATCH = 4; // Matches are found through a hash of 4 bytes
+constexpr int DEFLATE_MAX_MATCH = 258;
+constexpr size_t DEFLATE_BLOCK_TOKENS = 1 << 16; // Each block gets Huffman codes fitted to its own symbols
+
+static const uint16_t LENGTH_BASE[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+};
+static const uint8_t LENGTH_EXTRA[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+};
+static const uint16_t DISTANCE_BASE[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+};
+static const uint8_t DISTANCE_EXTRA[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+};
+static const uint8_t CODE_LENGTH_ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+ExportFormat GuessExportFormat(const std::string& path) {
+	std::string extension = std::filesystem::path(path).extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return (char)std::tolower((unsigned char)c); });
+	if (extension == ".qoi")
+		return ExportFormat::Qoi;
+	if (extension == ".rgba" || extension == ".raw")
+		return ExportFormat::Raw;
+	return ExportFormat::Png;
+}
+
+bool ParseExportFormat(std::string_view name, ExportFormat& format) {
+	if (name == "png") {
+		format = ExportFormat::Png;
+	} else if (name == "qoi") {
+		format = ExportFormat::Qoi;
+	} else if (name == "raw") {
+		format = ExportFormat::Raw;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+static void PutBigEndian(std::vector<uint8_t>& out, uint32_t value) {
+	uint8_t bytes[4] = { (uint8_t)(value >> 24), (uint8_t)(value >> 16), (uint8_t)(value >> 8), (uint8_t)value };
+	out.insert(out.end(), bytes, bytes + 4);
+}
+
+static uint32_t Crc32(const uint8_t* data, size_t size, uint32_t crc = 0) {
+	static const auto table = [] {
+		std::array<uint32_t, 256> t{};
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; k++) {
+				c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			}
+			t[i] = c;
+		}
+		return t;
+	}();
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++) {
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+constexpr uint32_t ADLER_MOD = 65521;
+
+static uint32_t Adler32(const uint8_t* data, size_t size, uint32_t adler = 1) {
+	uint32_t a = adler & 0xFFFF;
+	uint32_t b = adler >> 16;
+	while (size) {
+		// Largest run that can't overflow before the modulo
+		size_t n = std::min(size, (size_t)5552);
+		size -= n;
+		for (; n; n--) {
+			a += *data++;
+			b += a;
+		}
+		a %= ADLER_MOD;
+		b %= ADLER_MOD;
+	}
+	return b << 16 | a;
+}
+
+// Checksum of two pieces of data from the checksums of each, so that chunks can be summed in parallel
+static uint32_t Adler32Combine(uint32_t first, uint32_t second, size_t secondSize) {
+	uint64_t n = secondSize % ADLER_MOD;
+	uint64_t a1 = first & 0xFFFF, b1 = first >> 16;
+	uint64_t a2 = second & 0xFFFF, b2 = second >> 16;
+	uint64_t a = (a1 + a2 + ADLER_MOD - 1) % ADLER_MOD;
+	uint64_t b = (b1 + b2 + n * a1 + ADLER_MOD - n) % ADLER_MOD;
+	return (uint32_t)(b << 16 | a);
+}
+
+struct BitWriter {
+	std::vector<uint8_t>& out;
+	uint64_t bits = 0;
+	int count = 0;
+	void Put(uint32_t value, int n) {
+		bits |= (uint64_t)value << count;
+		count += n;
+		while (count >= 8) {
+			out.push_back((uint8_t)bits);
+			bits >>= 8;
+			count -= 8;
+		}
+	}
+	void Align() {
+		if (count) {
+			Put(0, 8 - count);
+		}
+	}
+};
+
+// A literal byte if length is 0, otherwise a match
+struct Token {
+	uint16_t length;
+	uint16_t value; // Literal or distance
+};
+
+static int LengthCode(int length) {
+	return (int)(std::upper_bound(std::begin(LENGTH_BASE), std::end(LENGTH_BASE), length) - std::begin(LENGTH_BASE)) - 1;
+}
+
+static int DistanceCode(int distance) {
+	return (int)(std::upper_bound(std::begin(DISTANCE_BASE), std::end(DISTANCE_BASE), distance) - std::begin(DISTANCE_BASE)) - 1;
+}
+
+static std::vector<Token> FindMatches(const uint8_t* data, size_t size) {
+	std::vector<Token> tokens;
+	tokens.reserve(size / 2);
+	std::vector<int32_t> head((size_t)1 << DEFLATE_HASH_BITS, -1);
+	auto hash = [&](size_t i) {
+		uint32_t v;
+		std::memcpy(&v, data + i, 4);
+		return (v * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+	};
+	size_t i = 0;
+	while (i < size) {
+		if (i + DEFLATE_MIN_MATCH <= size) {
+			uint32_t h = hash(i);
+			int32_t candidate = head[h];
+			head[h] = (int32_t)i;
+			if (candidate >= 0 && i - candidate <= DEFLATE_WINDOW && std::memcmp(data + candidate, data + i, DEFLATE_MIN_MATCH) == 0) {
+				size_t limit = std::min(size - i, (size_t)DEFLATE_MAX_MATCH);
+				size_t length = DEFLATE_MIN_MATCH;
+				while (length < limit && data[candidate + length] == data[i + length]) {
+					length++;
+				}
+				tokens.push_back({ (uint16_t)length, (uint16_t)(i - candidate) });
+				for (size_t j = i + 1; j < i + length && j + DEFLATE_MIN_MATCH <= size; j++) {
+					head[hash(j)] = (int32_t)j;
+				}
+				i += length;
+				continue;
+			}
+		}
+		tokens.push_back({ 0, data[i] });
+		i++;
+	}
+	return tokens;
+}
+
+// Huffman code lengths no longer than maxBits. Frequencies are halved until the tree is shallow enough.
+static std::vector<uint8_t> BuildLengths(std::vector<uint32_t> freq, int maxBits) {
+	size_t n = freq.size();
+	std::vector<uint8_t> lengths(n);
+	while (true) {
+		using Node = std::pair<uint64_t, size_t>; // Weight and index, leaves come first
+		std::priority_queue<Node, std::vector<Node>, std::greater<Node>> queue;
+		std::vector<size_t> parents(n);
+		for (size_t i = 0; i < n; i++) {
+			if (freq[i]) {
+				queue.push({ freq[i], i });
+			}
+		}
+		if (queue.empty())
+			return lengths;
+		if (queue.size() == 1) {
+			lengths[queue.top().second] = 1;
+			return lengths;
+		}
+		while (queue.size() > 1) {
+			Node a = queue.top();
+			queue.pop();
+			Node b = queue.top();
+			queue.pop();
+			size_t parent = parents.size();
+			parents.push_back(parent); // The root is its own parent
+			parents[a.second] = parent;
+			parents[b.second] = parent;
+			queue.push({ a.first + b.first, parent });
+		}
+		int deepest = 0;
+		for (size_t i = 0; i < n; i++) {
+			int depth = 0;
+			if (freq[i]) {
+				for (size_t node = i; parents[node] != node; node = parents[node]) {
+					depth++;
+				}
+			}
+			lengths[i] = (uint8_t)depth;
+			deepest = std::max(deepest, depth);
+		}
+		if (deepest <= maxBits)
+			return lengths;
+		for (auto& f : freq) {
+			if (f) {
+				f = f / 2 | 1;
+			}
+		}
+	}
+}
+
+// Canonical codes, bit reversed since deflate sends Huffman codes from their highest bit
+static std::vector<uint16_t> BuildCodes(const std::vector<uint8_t>& lengths) {
+	uint16_t counts[16] = {};
+	for (uint8_t l : lengths) {
+		counts[l]++;
+	}
+	counts[0] = 0;
+	uint16_t next[16] = {};
+	for (int bits = 1, code = 0; bits < 16; bits++) {
+		code = (code + counts[bits - 1]) << 1;
+		next[bits] = (uint16_t)code;
+	}
+	std::vector<uint16_t> codes(lengths.size());
+	for (size_t i = 0; i < lengths.size(); i++) {
+		if (int l = lengths[i]) {
+			uint16_t code = next[l]++;
+			uint16_t reversed = 0;
+			for (int b = 0; b < l; b++) {
+				reversed |= (code >> b & 1) << (l - 1 - b);
+			}
+			codes[i] = reversed;
+		}
+	}
+	return codes;
+}
+
+static void WriteBlock(BitWriter& writer, const Token* tokens, size_t count, bool final) {
+	std::vector<uint32_t> litFreq(286), distFreq(30);
+	for (size_t i = 0; i < count; i++) {
+		if (tokens[i].length) {
+			litFreq[257 + LengthCode(tokens[i].length)]++;
+			distFreq[DistanceCode(tokens[i].value)]++;
+		} else {
+			litFreq[tokens[i].value]++;
+		}
+	}
+	litFreq[256] = 1; // End of block
+	// Some decoders reject incomplete distance codes, so there are always at least two
+	for (int i = 0, used = (int)std::count_if(distFreq.begin(), distFreq.end(), [](uint32_t f) { return f != 0; }); used < 2; i++) {
+		if (!distFreq[i]) {
+			distFreq[i] = 1;
+			used++;
+		}
+	}
+	std::vector<uint8_t> litLengths = BuildLengths(litFreq, 15);
+	std::vector<uint8_t> distLengths = BuildLengths(distFreq, 15);
+	std::vector<uint16_t> litCodes = BuildCodes(litLengths);
+	std::vector<uint16_t> distCodes = BuildCodes(distLengths);
+	int litCount = 286;
+	while (litCount > 257 && !litLengths[litCount - 1]) {
+		litCount--;
+	}
+	int distCount = 30;
+	while (distCount > 1 && !distLengths[distCount - 1]) {
+		distCount--;
+	}
+
+	// The code lengths themselves are run length encoded and Huffman coded
+	std::vector<uint8_t> all(litLengths.begin(), litLengths.begin() + litCount);
+	all.insert(all.end(), distLengths.begin(), distLengths.begin() + distCount);
+	std::vector<std::pair<uint8_t, uint8_t>> runs; // Symbol and extra bits
+	for (size_t i = 0; i < all.size();) {
+		size_t run = 1;
+		while (i + run < all.size() && all[i + run] == all[i]) {
+			run++;
+		}
+		if (all[i] == 0 && run >= 3) {
+			run = std::min(run, (size_t)138);
+			runs.push_back(run >= 11 ? std::pair<uint8_t, uint8_t>{ 18, (uint8_t)(run - 11) } : std::pair<uint8_t, uint8_t>{ 17, (uint8_t)(run - 3) });
+		} else if (all[i] != 0 && run >= 4) {
+			run = std::min(run, (size_t)7);
+			runs.push_back({ all[i], 0 });
+			runs.push_back({ 16, (uint8_t)(run - 4) });
+		} else {
+			run = 1;
+			runs.push_back({ all[i], 0 });
+		}
+		i += run;
+	}
+	std::vector<uint32_t> clFreq(19);
+	for (const auto& [symbol, extra] : runs) {
+		clFreq[symbol]++;
+	}
+	std::vector<uint8_t> clLengths = BuildLengths(clFreq, 7);
+	std::vector<uint16_t> clCodes = BuildCodes(clLengths);
+	int clCount = 19;
+	while (clCount > 4 && !clLengths[CODE_LENGTH_ORDER[clCount - 1]]) {
+		clCount--;
+	}
+
+	writer.Put(final, 1);
+	writer.Put(2, 2); // Dynamic Huffman codes
+	writer.Put(litCount - 257, 5);
+	writer.Put(distCount - 1, 5);
+	writer.Put(clCount - 4, 4);
+	for (int i = 0; i < clCount; i++) {
+		writer.Put(clLengths[CODE_LENGTH_ORDER[i]], 3);
+	}
+	for (const auto& [symbol, extra] : runs) {
+		writer.Put(clCodes[symbol], clLengths[symbol]);
+		if (symbol == 16) {
+			writer.Put(extra, 2);
+		} else if (symbol == 17) {
+			writer.Put(extra, 3);
+		} else if (symbol == 18) {
+			writer.Put(extra, 7);
+		}
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		const Token& t = tokens[i];
+		if (!t.length) {
+			writer.Put(litCodes[t.value], litLengths[t.value]);
+			continue;
+		}
+		int lc = LengthCode(t.length);
+		writer.Put(litCodes[257 + lc], litLengths[257 + lc]);
+		writer.Put(t.length - LENGTH_BASE[lc], LENGTH_EXTRA[lc]);
+		int dc = DistanceCode(t.value);
+		writer.Put(distCodes[dc], distLengths[dc]);
+		writer.Put(t.value - DISTANCE_BASE[dc], DISTANCE_EXTRA[dc]);
+	}
+	writer.Put(litCodes[256], litLengths[256]);
+}
+
+// Raw deflate data which ends on a byte boundary, so that the output of each chunk can simply be
+// concatenated. Only the last chunk is final, the others end with an empty stored block.
+static void Deflate(const uint8_t* data, size_t size, bool final, std::vector<uint8_t>& out) {
+	std::vector<Token> tokens = FindMatches(data, size);
+	BitWriter writer{ out };
+	for (size_t i = 0; i < tokens.size() || i == 0; i += DEFLATE_BLOCK_TOKENS) {
+		size_t count = std::min(DEFLATE_BLOCK_TOKENS, tokens.size() - i);
+		WriteBlock(writer, tokens.data() + i, count, final && i + count == tokens.size());
+	}
+	if (!final) {
+		writer.Put(0, 3);
+		writer.Align();
+		uint8_t empty[4] = { 0, 0, 0xFF, 0xFF };
+		out.insert(out.end(), empty, empty + 4);
+	}
+	writer.Align();
+}
+
+static uint8_t Paeth(uint8_t a, uint8_t b, uint8_t c) {
+	int p = a + b - c;
+	int pa = std::abs(p - a);
+	int pb = std::abs(p - b);
+	int pc = std::abs(p - c);
+	return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+template <uint8_t Type>
+static uint8_t Predict(uint8_t left, uint8_t up, uint8_t upLeft) {
+	if constexpr (Type == 1) return left;
+	if constexpr (Type == 2) return up;
+	if constexpr (Type == 3) return (uint8_t)((left + up) / 2);
+	if constexpr (Type == 4) return Paeth(left, up, upLeft);
+	return 0;
+}
+
+template <uint8_t Type>
+static void ApplyFilter(const uint8_t* row, const uint8_t* above, size_t size, uint8_t* out) {
+	for (size_t i = 0; i < size; i++) {
+		uint8_t left = i >= 4 ? row[i - 4] : 0;
+		uint8_t upLeft = i >= 4 ? above[i - 4] : 0;
+		out[i] = row[i] - Predict<Type>(left, above[i], upLeft);
+	}
+}
+
+// The magnitude of a filtered byte as a signed difference
+static uint32_t Cost(uint8_t v) {
+	return v < 128 ? v : 256 - v;
+}
+
+// Picks the PNG filter with the smallest sum of absolute differences, which usually compresses best.
+// All five filters are scored in one pass, then only the chosen one is written.
+static void FilterRow(const uint8_t* row, const uint8_t* above, size_t size, uint8_t* out, std::vector<uint8_t>& scratch) {
+	if (!above) {
+		// The first row is filtered against zeros
+		scratch.assign(size, 0);
+		above = scratch.data();
+	}
+	uint64_t sums[5] = {};
+	for (size_t i = 0; i < size; i++) {
+		uint8_t x = row[i];
+		uint8_t left = i >= 4 ? row[i - 4] : 0;
+		uint8_t up = above[i];
+		uint8_t upLeft = i >= 4 ? above[i - 4] : 0;
+		sums[0] += Cost(x);
+		sums[1] += Cost(x - Predict<1>(left, up, upLeft));
+		sums[2] += Cost(x - Predict<2>(left, up, upLeft));
+		sums[3] += Cost(x - Predict<3>(left, up, upLeft));
+		sums[4] += Cost(x - Predict<4>(left, up, upLeft));
+	}
+	uint8_t type = 0;
+	for (uint8_t t = 1; t < 5; t++) {
+		if (sums[t] < sums[type]) {
+			type = t;
+		}
+	}
+
+	out[0] = type;
+	switch (type) {
+	case 0: std::memcpy(out + 1, row, size); break;
+	case 1: ApplyFilter<1>(row, above, size, out + 1); break;
+	case 2: ApplyFilter<2>(row, above, size, out + 1); break;
+	case 3: ApplyFilter<3>(row, above, size, out + 1); break;
+	case 4: ApplyFilter<4>(row, above, size, out + 1); break;
+	}
+}
+
+struct EncodedChunk {
+	std::vector<uint8_t> bytes; // Ready to be written
+	uint32_t adler = 1; // PNG only, of the filtered rows
+	size_t filteredSize = 0;
+};
+
+struct ChunkEncoder {
+	const ExportSource& source;
+	ExportFormat format;
+	int width; // Of the result
+	int height;
+	int chunkRows;
+
+	// Transforms rows into a buffer, with the row before them if there is one for filtering and QOI's previous pixel
+	std::vector<uint8_t> TransformChunk(int y0, int y1, int& first) const {
+		first = y0 > 0 ? y0 - 1 : y0;
+		std::vector<uint8_t> rows((size_t)width * 4 * (y1 - first));
+		TransformRows(source.pixels.get(), source.stride, source.width, source.height, source.orientation,
+			rows.data(), first, y1);
+		return rows;
+	}
+
+	EncodedChunk EncodePng(int y0, int y1, bool last) const {
+		int first;
+		std::vector<uint8_t> rows = TransformChunk(y0, y1, first);
+		size_t rowSize = (size_t)width * 4;
+		std::vector<uint8_t> filtered((rowSize + 1) * (y1 - y0));
+		std::vector<uint8_t> scratch;
+		for (int y = y0; y < y1; y++) {
+			const uint8_t* row = rows.data() + rowSize * (y - first);
+			FilterRow(row, y > 0 ? row - rowSize : nullptr, rowSize, filtered.data() + (rowSize + 1) * (y - y0), scratch);
+		}
+		EncodedChunk chunk;
+		chunk.adler = Adler32(filtered.data(), filtered.size());
+		chunk.filteredSize = filtered.size();
+
+		// Each chunk is its own IDAT, the data of consecutive IDATs forms one zlib stream
+		std::vector<uint8_t>& out = chunk.bytes;
+		out.resize(8);
+		std::memcpy(out.data() + 4, "IDAT", 4);
+		if (y0 == 0) {
+			out.push_back(0x78); // Deflate with a 32K window
+			out.push_back(0x01); // Fastest compression, no dictionary
+		}
+		Deflate(filtered.data(), filtered.size(), last, out);
+		uint32_t length = (uint32_t)(out.size() - 8);
+		uint8_t lengthBytes[4] = { (uint8_t)(length >> 24), (uint8_t)(length >> 16), (uint8_t)(length >> 8), (uint8_t)length };
+		std::memcpy(out.data(), lengthBytes, 4);
+		PutBigEndian(out, Crc32(out.data() + 4, out.size() - 4));
+		return chunk;
+	}
+
+	// Chunks start with the last pixel of the previous chunk, which the decoder has too. The colour index
+	// is only used for pixels seen in the chunk, since only those are known to match the decoder's index.
+	EncodedChunk EncodeQoi(int y0, int y1) const {
+		int first;
+		std::vector<uint8_t> rows = TransformChunk(y0, y1, first);
+		size_t rowSize = (size_t)width * 4;
+		uint8_t previous[4] = { 0, 0, 0, 255 };
+		if (first < y0) {
+			std::memcpy(previous, rows.data() + rowSize - 4, 4);
+		}
+		uint8_t index[64][4] = {};
+		bool indexed[64] = {};
+		EncodedChunk chunk;
+		std::vector<uint8_t>& out = chunk.bytes;
+		out.reserve(rowSize * (y1 - y0) / 2);
+		int run = 0;
+		const uint8_t* p = rows.data() + rowSize * (y0 - first);
+		const uint8_t* end = rows.data() + rows.size();
+		for (; p < end; p += 4) {
+			if (std::memcmp(p, previous, 4) == 0) {
+				if (++run == 62) {
+					out.push_back((uint8_t)(0xC0 | (run - 1)));
+					run = 0;
+				}
+				continue;
+			}
+			if (run) {
+				out.push_back((uint8_t)(0xC0 | (run - 1)));
+				run = 0;
+			}
+			int h = (p[0] * 3 + p[1] * 5 + p[2] * 7 + p[3] * 11) % 64;
+			if (indexed[h] && std::memcmp(index[h], p, 4) == 0) {
+				out.push_back((uint8_t)h);
+			} else if (p[3] == previous[3]) {
+				int8_t dr = (int8_t)(p[0] - previous[0]);
+				int8_t dg = (int8_t)(p[1] - previous[1]);
+				int8_t db = (int8_t)(p[2] - previous[2]);
+				int8_t drg = (int8_t)(dr - dg);
+				int8_t dbg = (int8_t)(db - dg);
+				if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+					out.push_back((uint8_t)(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+				} else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7) {
+					out.push_back((uint8_t)(0x80 | (dg + 32)));
+					out.push_back((uint8_t)((drg + 8) << 4 | (dbg + 8)));
+				} else {
+					uint8_t op[4] = { 0xFE, p[0], p[1], p[2] };
+					out.insert(out.end(), op, op + 4);
+				}
+			} else {
+				uint8_t op[5] = { 0xFF, p[0], p[1], p[2], p[3] };
+				out.insert(out.end(), op, op + 5);
+			}
+			std::memcpy(index[h], p, 4);
+			indexed[h] = true;
+			std::memcpy(previous, p, 4);
+		}
+		if (run) {
+			out.push_back((uint8_t)(0xC0 | (run - 1)));
+		}
+		return chunk;
+	}
+
+	EncodedChunk EncodeRaw(int y0, int y1) const {
+		EncodedChunk chunk;
+		chunk.bytes.resize((size_t)width * 4 * (y1 - y0));
+		TransformRows(source.pixels.get(), source.stride, source.width, source.height, source.orientation,
+			chunk.bytes.data(), y0, y1);
+		return chunk;
+	}
+
+	EncodedChunk Encode(int y0, int y1) const {
+		switch (format) {
+		case ExportFormat::Png: return EncodePng(y0, y1, y1 == height);
+		case ExportFormat::Qoi: return EncodeQoi(y0, y1);
+		default: return EncodeRaw(y0, y1);
+		}
+	}
+};
+
+std::string ExportImage(const ExportSource& source, ExportFormat format, const std::string& path,
+	ThreadPool& pool, std::atomic<size_t>* rowsDone) {
+	if (source.width <= 0 || source.height <= 0)
+		return "Nothing to export";
+	bool transposed = source.orientation.Transposed();
+	int width = transposed ? source.height : source.width;
+	int height = transposed ? source.width : source.height;
+	int chunkRows = (int)std::clamp(CHUNK_BYTES / ((size_t)width * 4), (size_t)1, (size_t)height);
+	ChunkEncoder encoder{ source, format, width, height, chunkRows };
+
+	std::FILE* file = nullptr;
+	if (path == "-") {
+		file = stdout;
+#ifdef _WIN32
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+	} else {
+		file = std::fopen(path.c_str(), "wb");
+		if (!file)
+			return "Cannot open " + path + ": " + std::strerror(errno);
+	}
+	int error = 0; // The first errno from writing
+	auto write = [&](const std::vector<uint8_t>& bytes) {
+		if (!error && std::fwrite(bytes.data(), 1, bytes.size(), file) != bytes.size()) {
+			error = errno ? errno : EIO;
+		}
+	};
+
+	std::vector<uint8_t> header;
+	if (format == ExportFormat::Png) {
+		const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+		header.assign(signature, signature + 8);
+		PutBigEndian(header, 13);
+		size_t start = header.size();
+		header.insert(header.end(), { 'I', 'H', 'D', 'R' });
+		PutBigEndian(header, width);
+		PutBigEndian(header, height);
+		header.insert(header.end(), { 8, 6, 0, 0, 0 }); // 8 bit RGBA, deflate, adaptive filtering, not interlaced
+		PutBigEndian(header, Crc32(header.data() + start, header.size() - start));
+	} else if (format == ExportFormat::Qoi) {
+		header.assign({ 'q', 'o', 'i', 'f' });
+		PutBigEndian(header, width);
+		PutBigEndian(header, height);
+		header.insert(header.end(), { 4, 0 }); // RGBA, sRGB
+	}
+	write(header);
+
+	// A round of chunks at a time keeps the memory used bounded by the number of threads
+	uint32_t adler = 1;
+	int chunkCount = (height + chunkRows - 1) / chunkRows;
+	int roundSize = pool.GetThreadCount() + 1;
+	for (int round = 0; round < chunkCount && !error; round += roundSize) {
+		int count = std::min(roundSize, chunkCount - round);
+		std::vector<EncodedChunk> chunks(count);
+		pool.ParallelFor(count, [&](size_t i) {
+			int y0 = (round + (int)i) * chunkRows;
+			chunks[i] = encoder.Encode(y0, std::min(height, y0 + chunkRows));
+			});
+		for (int i = 0; i < count; i++) {
+			write(chunks[i].bytes);
+			adler = Adler32Combine(adler, chunks[i].adler, chunks[i].filteredSize);
+		}
+		if (rowsDone) {
+			*rowsDone = std::min(height, (round + count) * chunkRows);
+		}
+	}
+
+	std::vector<uint8_t> trailer;
+	if (format == ExportFormat::Png) {
+		// The zlib checksum gets an IDAT of its own, then the image ends
+		PutBigEndian(trailer, 4);
+		trailer.insert(trailer.end(), { 'I', 'D', 'A', 'T' });
+		PutBigEndian(trailer, adler);
+		PutBigEndian(trailer, Crc32(trailer.data() + 4, 8));
+		PutBigEndian(trailer, 0);
+		trailer.insert(trailer.end(), { 'I', 'E', 'N', 'D' });
+		PutBigEndian(trailer, Crc32(trailer.data() + 20, 4));
+	} else if (format == ExportFormat::Qoi) {
+		trailer.assign({ 0, 0, 0, 0, 0, 0, 0, 1 });
+	}
+	write(trailer);
+
+	if (std::fflush(file) != 0 && !error) {
+		error = errno;
+	}
+	if (file != stdout && std::fclose(file) != 0 && !error) {
+		error = errno;
+	}
+	if (error)
+		return "Cannot write " + (path == "-" ? std::string("to stdout") : path) + ": " + std::strerror(error);
+	return "";
+}
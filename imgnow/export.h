@@ -0,0 +1,33 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <atomic>
+#include "threadpool.h"
+#include "transform.h"
+
+enum class ExportFormat {
+	Png,
+	Qoi,
+	Raw, // RGBA8 rows with no header
+};
+
+ExportFormat GuessExportFormat(const std::string& path); // From the extension, PNG unless .qoi, .rgba or .raw
+bool ParseExportFormat(std::string_view name, ExportFormat& format); // "png", "qoi" or "raw"
+
+// An area of RGBA pixels and how it is shown
+struct ExportSource {
+	std::shared_ptr<const uint8_t> pixels; // Top left of the area
+	size_t stride = 0; // In pixels
+	int width = 0;
+	int height = 0;
+	Orientation orientation;
+};
+
+// Writes the pixels as they are shown to path, or to stdout if path is "-". Blocking.
+// Chunks of rows are transformed and encoded on the calling thread and any free workers of the pool,
+// a few at a time, and written in order, so the pixels are never held in full a second time.
+// rowsDone counts the rows written so far. Returns an empty string on success, otherwise the error.
+std::string ExportImage(const ExportSource& source, ExportFormat format, const std::string& path,
+	ThreadPool& pool, std::atomic<size_t>* rowsDone = nullptr);
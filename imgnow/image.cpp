@@ -1,10 +1,53 @@
 #include "image.h"
+#include <algorithm>
+#include <cctype> // tolower
 
 #define STB_IMAGE_IMPLEMENTATION
 #define STBI_WINDOWS_UTF8
 #define STBI_FAILURE_USERMSG
 #include "stb_image.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMGNOW_SSE2
+#include <emmintrin.h>
+#endif
+
+// Translucent pixels are usually found early, so the scan gives up on
+// a frame as soon as a block of this many pixels contains one.
+constexpr size_t ALPHA_SCAN_BLOCK = 4096;
+
+static AlphaType ScanAlpha(const uint8_t* rgba, size_t count) {
+	bool opaque = true;
+	size_t i = 0;
+#ifdef IMGNOW_SSE2
+	// Four pixels at a time. Each 32 bit lane is masked down to its alpha byte,
+	// which is then compared against 255 and 0.
+	const __m128i alphaMask = _mm_set1_epi32((int)0xFF000000);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i allOpaque = _mm_set1_epi32(-1);
+	while (i + 4 <= count) {
+		__m128i allBinary = _mm_set1_epi32(-1);
+		size_t end = std::min(count & ~(size_t)3, i + ALPHA_SCAN_BLOCK);
+		for (; i < end; i += 4) {
+			__m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i*)(rgba + i * 4)), alphaMask);
+			__m128i isOpaque = _mm_cmpeq_epi32(a, alphaMask);
+			allOpaque = _mm_and_si128(allOpaque, isOpaque);
+			allBinary = _mm_and_si128(allBinary, _mm_or_si128(isOpaque, _mm_cmpeq_epi32(a, zero)));
+		}
+		if (_mm_movemask_epi8(allBinary) != 0xFFFF)
+			return AlphaType::Translucent;
+	}
+	opaque = _mm_movemask_epi8(allOpaque) == 0xFFFF;
+#endif
+	for (; i < count; i++) {
+		uint8_t a = rgba[i * 4 + 3];
+		if (a != 0 && a != 255)
+			return AlphaType::Translucent;
+		opaque &= a == 255;
+	}
+	return opaque ? AlphaType::Opaque : AlphaType::Binary;
+}
+
 Image::Image(const char* path) {
 	// Try to read as gif
 	// Note: This uses stbi__XXX functions which are not part of the public API.
@@ -57,6 +100,63 @@ Image::Image(const char* path) {
 		duration += dur;
 	}
 	duration = std::max(1, duration);
+
+	ClassifyAlpha();
+}
+
+Image::Image(int width, int height, int channels, std::shared_ptr<uint8_t> rgba) :
+	width(width),
+	height(height),
+	channels(channels),
+	duration(1),
+	delays({ 1 }),
+	data(std::move(rgba)) {
+	ClassifyAlpha();
+}
+
+Image::Image(int width, int height, std::shared_ptr<uint8_t> rgba, AlphaType alphaType) :
+	width(width),
+	height(height),
+	channels(4),
+	duration(1),
+	delays({ 1 }),
+	alphaTypes({ alphaType }),
+	data(std::move(rgba)) {
+}
+
+void Image::ClassifyAlpha() {
+	alphaTypes.clear();
+	if (!data)
+		return;
+	size_t frameSize = (size_t)width * height;
+	for (size_t n = 0; n < delays.size(); n++) {
+		if (channels == 1 || channels == 3) {
+			// stb_image fills in alpha 255 when the file has none
+			alphaTypes.push_back(AlphaType::Opaque);
+		} else {
+			alphaTypes.push_back(ScanAlpha(data.get() + frameSize * n * 4, frameSize));
+		}
+	}
+}
+
+Image Image::FromError(std::string error) {
+	Image image;
+	image.error = std::move(error);
+	return image;
+}
+
+bool Image::HasImageExtension(const std::string& path) {
+	static const char* const extensions[] = {
+		"jpeg", "jpg", "png", "bmp", "tga", "gif", "hdr", "psd", "pic", "pgm", "ppm",
+	};
+	size_t dot = path.find_last_of('.');
+	if (dot == std::string::npos)
+		return false;
+	std::string ext = path.substr(dot + 1);
+	for (char& c : ext) {
+		c = (char)std::tolower((unsigned char)c);
+	}
+	return std::find(std::begin(extensions), std::end(extensions), ext) != std::end(extensions);
 }
 
 int Image::GetWidth() const {
@@ -96,10 +196,18 @@ SDL_Colour Image::GetPixel(int x, int y, size_t frame) const {
 	return { pixel[0], pixel[1], pixel[2], pixel[3] };
 }
 
+AlphaType Image::GetAlphaType(size_t frame) const {
+	return frame < alphaTypes.size() ? alphaTypes[frame] : AlphaType::Translucent;
+}
+
 const uint8_t* Image::GetPixels() const {
 	return data.get();
 }
 
+std::shared_ptr<const uint8_t> Image::SharePixels() const {
+	return data;
+}
+
 bool Image::Valid() const {
 	return (bool)data;
 }
@@ -107,3 +215,44 @@ bool Image::Valid() const {
 const std::string& Image::Error() const {
 	return error;
 }
+
+const Image* Image::GetThumbnail() const {
+	return thumbnail.get();
+}
+
+void Image::SetThumbnail(Image thumbnail) {
+	this->thumbnail = std::make_shared<const Image>(std::move(thumbnail));
+}
+
+Image Image::Downscale(int maxSize) const {
+	float ratio = std::min(1.0f, (float)maxSize / std::max(width, height));
+	int dw = std::max(1, (int)(width * ratio));
+	int dh = std::max(1, (int)(height * ratio));
+	std::shared_ptr<uint8_t> pixels(new uint8_t[(size_t)dw * dh * 4], std::default_delete<uint8_t[]>());
+
+	// Average the block of source pixels that each destination pixel covers
+	for (int y = 0; y < dh; y++) {
+		int sy0 = (int)((int64_t)y * height / dh);
+		int sy1 = std::max(sy0 + 1, (int)((int64_t)(y + 1) * height / dh));
+		for (int x = 0; x < dw; x++) {
+			int sx0 = (int)((int64_t)x * width / dw);
+			int sx1 = std::max(sx0 + 1, (int)((int64_t)(x + 1) * width / dw));
+			uint32_t sum[4]{};
+			for (int sy = sy0; sy < sy1; sy++) {
+				const uint8_t* p = data.get() + ((size_t)sy * width + sx0) * 4;
+				for (int sx = sx0; sx < sx1; sx++, p += 4) {
+					sum[0] += p[0];
+					sum[1] += p[1];
+					sum[2] += p[2];
+					sum[3] += p[3];
+				}
+			}
+			uint32_t count = (uint32_t)((sy1 - sy0) * (sx1 - sx0));
+			uint8_t* q = pixels.get() + ((size_t)y * dw + x) * 4;
+			for (int c = 0; c < 4; c++) {
+				q[c] = (uint8_t)((sum[c] + count / 2) / count);
+			}
+		}
+	}
+	return Image(dw, dh, channels, std::move(pixels));
+}
@@ -8,9 +8,21 @@
 #include <vector>
 #include "SDL.h"
 
+// How a frame uses its alpha channel
+enum class AlphaType {
+	Opaque,      // Every pixel has alpha 255
+	Binary,      // Every pixel has alpha 0 or 255
+	Translucent,
+};
+
 struct Image {
 	Image() = default;
 	Image(const char* path);
+	Image(int width, int height, int channels, std::shared_ptr<uint8_t> rgba); // Single frame of existing pixels
+	Image(int width, int height, std::shared_ptr<uint8_t> rgba, AlphaType alphaType); // As above, without scanning the alpha
+	static Image FromError(std::string error);
+	static bool HasImageExtension(const std::string& path); // Case insensitive, for formats stb_image can decode
+	Image Downscale(int maxSize) const; // Box filtered copy of the first frame that fits in maxSize x maxSize
 	Image(const Image&) = delete;
 	Image(Image&&) noexcept = default;
 	Image& operator=(const Image&) = delete;
@@ -20,19 +32,26 @@ struct Image {
 	float GetAspectRatio() const;
 	int GetChannels() const;
 	SDL_Colour GetPixel(int x, int y, size_t frame) const;
+	AlphaType GetAlphaType(size_t frame) const;
 	const uint8_t* GetPixels() const;
+	std::shared_ptr<const uint8_t> SharePixels() const; // Keeps the pixels alive for work on other threads
 	bool Valid() const;
 	const std::string& Error() const;
+	const Image* GetThumbnail() const; // Null if the image is small enough to be its own thumbnail
+	void SetThumbnail(Image thumbnail);
 	
 	size_t GetFrameCount() const;
 	int GetGifDuration() const;
 	int GetGifDelay(size_t frame) const;
 private:
+	void ClassifyAlpha(); // Fills alphaTypes, run once the pixels are final
 	int width = 0;
 	int height = 0;
 	int channels = 0;
 	int duration = 0;
 	std::vector<int> delays;
+	std::vector<AlphaType> alphaTypes; // Per frame
 	std::shared_ptr<uint8_t> data; // Unique but uses custom deleter
+	std::shared_ptr<const Image> thumbnail;
 	std::string error;
 };
@@ -0,0 +1,197 @@
+#include "imagehash.h"
+#include <cstring> // memcpy
+#include <algorithm>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMGNOW_SSE2
+#include <emmintrin.h>
+#endif
+
+constexpr size_t STRIPE_SIZE = 64;
+constexpr size_t STRIPES_PER_SCRAMBLE = 1024;
+constexpr uint64_t SCRAMBLE_PRIME = 0x9E3779B1;
+constexpr int DHASH_COLUMNS = 9;
+constexpr int DHASH_ROWS = 8;
+constexpr uint64_t DHASH_MARGIN = 3 * 256; // In luma levels scaled by 256
+
+// Stripes of 64 bytes are folded into eight 64 bit accumulators. Each word is mixed with a key and its
+// halves are multiplied together, and the accumulators are scrambled now and then so that
+// the high bits of the products spread into the low bits.
+alignas(16) static const uint64_t KEYS[8] = {
+	0xBE4BA423396CFEB8, 0x1CAD21F72C81017C, 0xDB979083E96DD4DE, 0x1F67B3B7A4A44072,
+	0x78E5C0CC4EE679CB, 0x2172FFCC7DD05A82, 0x8E2443F7744608B8, 0x4C263A81E69035E0,
+};
+
+static uint64_t Mix64(uint64_t x) {
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EB;
+	x ^= x >> 31;
+	return x;
+}
+
+static void AccumulateStripe(uint64_t* acc, const uint8_t* p) {
+	uint64_t words[8];
+	std::memcpy(words, p, STRIPE_SIZE);
+	for (int i = 0; i < 8; i++) {
+		uint64_t k = words[i] ^ KEYS[i];
+		acc[i] += (k & 0xFFFFFFFF) * (k >> 32) + words[i ^ 1];
+	}
+}
+
+#ifdef IMGNOW_SSE2
+// Same as AccumulateStripe and Scramble, two accumulators per register
+static void AccumulateStripes(__m128i* acc, const uint8_t* p, size_t count) {
+	for (size_t s = 0; s < count; s++, p += STRIPE_SIZE) {
+		for (int i = 0; i < 4; i++) {
+			__m128i v = _mm_loadu_si128((const __m128i*)p + i);
+			__m128i k = _mm_xor_si128(v, _mm_load_si128((const __m128i*)KEYS + i));
+			__m128i product = _mm_mul_epu32(k, _mm_shuffle_epi32(k, _MM_SHUFFLE(2, 3, 0, 1)));
+			acc[i] = _mm_add_epi64(acc[i], _mm_add_epi64(product, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2))));
+		}
+	}
+}
+
+static void Scramble(__m128i* acc) {
+	const __m128i prime = _mm_set1_epi32((int)SCRAMBLE_PRIME);
+	for (int i = 0; i < 4; i++) {
+		__m128i x = _mm_xor_si128(acc[i], _mm_srli_epi64(acc[i], 47));
+		x = _mm_xor_si128(x, _mm_load_si128((const __m128i*)KEYS + i));
+		__m128i lo = _mm_mul_epu32(x, prime);
+		__m128i hi = _mm_mul_epu32(_mm_srli_epi64(x, 32), prime);
+		acc[i] = _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+	}
+}
+#else
+static void Scramble(uint64_t* acc) {
+	for (int i = 0; i < 8; i++) {
+		acc[i] = (acc[i] ^ acc[i] >> 47 ^ KEYS[i]) * SCRAMBLE_PRIME;
+	}
+}
+#endif
+
+uint64_t HashBytes(const uint8_t* data, size_t size, uint64_t seed) {
+	alignas(16) uint64_t acc[8];
+	for (int i = 0; i < 8; i++) {
+		acc[i] = KEYS[7 - i] ^ seed;
+	}
+	size_t stripes = size / STRIPE_SIZE;
+	const uint8_t* p = data;
+#ifdef IMGNOW_SSE2
+	__m128i vacc[4];
+	for (int i = 0; i < 4; i++) {
+		vacc[i] = _mm_load_si128((const __m128i*)acc + i);
+	}
+	for (size_t s = 0; s < stripes; s += STRIPES_PER_SCRAMBLE) {
+		size_t count = std::min(STRIPES_PER_SCRAMBLE, stripes - s);
+		AccumulateStripes(vacc, p, count);
+		p += count * STRIPE_SIZE;
+		if (count == STRIPES_PER_SCRAMBLE) {
+			Scramble(vacc);
+		}
+	}
+	for (int i = 0; i < 4; i++) {
+		_mm_store_si128((__m128i*)acc + i, vacc[i]);
+	}
+#else
+	for (size_t s = 0; s < stripes; s++, p += STRIPE_SIZE) {
+		AccumulateStripe(acc, p);
+		if ((s + 1) % STRIPES_PER_SCRAMBLE == 0) {
+			Scramble(acc);
+		}
+	}
+#endif
+
+	// The tail is padded with zeros, the size tells it apart from real zeros
+	uint8_t tail[STRIPE_SIZE] = {};
+	std::memcpy(tail, p, size % STRIPE_SIZE);
+	AccumulateStripe(acc, tail);
+
+	uint64_t h = Mix64(size ^ seed);
+	for (int i = 0; i < 8; i++) {
+		h = Mix64(h ^ acc[i]);
+	}
+	return h;
+}
+
+// Brightness with the same weights as the false colour view, scaled by 256
+static void RowLuma(const uint8_t* row, int width, uint32_t* luma) {
+	int x = 0;
+#ifdef IMGNOW_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i weights = _mm_setr_epi16(77, 150, 29, 0, 77, 150, 29, 0);
+	for (; x + 4 <= width; x += 4) {
+		__m128i p = _mm_loadu_si128((const __m128i*)(row + x * 4));
+		// Red and green of a pixel land in one lane and blue in the next
+		__m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(p, zero), weights);
+		__m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(p, zero), weights);
+		lo = _mm_add_epi32(lo, _mm_srli_epi64(lo, 32));
+		hi = _mm_add_epi32(hi, _mm_srli_epi64(hi, 32));
+		__m128i sums = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(2, 0, 2, 0)));
+		_mm_storeu_si128((__m128i*)(luma + x), sums);
+	}
+#endif
+	for (; x < width; x++) {
+		const uint8_t* p = row + x * 4;
+		luma[x] = 77 * p[0] + 150 * p[1] + 29 * p[2];
+	}
+}
+
+uint64_t DifferenceHash(const uint8_t* rgba, int width, int height) {
+	if (width <= 0 || height <= 0)
+		return 0;
+
+	// Box average of each cell. Images narrower than the grid repeat columns.
+	uint64_t sums[DHASH_ROWS][DHASH_COLUMNS] = {};
+	uint32_t counts[DHASH_ROWS][DHASH_COLUMNS] = {};
+	std::vector<int> cellOf(width);
+	for (int x = 0; x < width; x++) {
+		cellOf[x] = x * DHASH_COLUMNS / width;
+	}
+	std::vector<uint32_t> luma(width);
+	for (int y = 0; y < height; y++) {
+		RowLuma(rgba + (size_t)y * width * 4, width, luma.data());
+		int row = y * DHASH_ROWS / height;
+		for (int x = 0; x < width; x++) {
+			sums[row][cellOf[x]] += luma[x];
+			counts[row][cellOf[x]]++;
+		}
+	}
+	for (int row = 0; row < DHASH_ROWS; row++) {
+		if (height < DHASH_ROWS && !counts[row][0]) {
+			int source = std::min(row * height / DHASH_ROWS, height - 1) * DHASH_ROWS / height;
+			std::memcpy(sums[row], sums[source], sizeof(sums[row]));
+			std::memcpy(counts[row], counts[source], sizeof(counts[row]));
+		}
+		for (int column = 0; column < DHASH_COLUMNS; column++) {
+			if (!counts[row][column]) {
+				int source = std::min(column * width / DHASH_COLUMNS, width - 1);
+				sums[row][column] = sums[row][cellOf[source]];
+				counts[row][column] = counts[row][cellOf[source]];
+			}
+		}
+	}
+
+	// Flat areas are common and would otherwise set bits at random, so neighbours
+	// only count as brighter by more than a small margin
+	uint64_t hash = 0;
+	for (int row = 0; row < DHASH_ROWS; row++) {
+		for (int column = 0; column < DHASH_COLUMNS - 1; column++) {
+			uint64_t left = sums[row][column] / std::max(1u, counts[row][column]);
+			uint64_t right = sums[row][column + 1] / std::max(1u, counts[row][column + 1]);
+			hash = hash << 1 | (right > left + DHASH_MARGIN);
+		}
+	}
+	return hash;
+}
+
+ImageHashes ComputeImageHashes(const uint8_t* pixels, int width, int height, size_t frameCount,
+	const uint8_t* thumbnail, int thumbnailWidth, int thumbnailHeight) {
+	ImageHashes hashes;
+	uint64_t seed = (uint64_t)width << 32 | (uint32_t)height;
+	hashes.content = HashBytes(pixels, (size_t)width * height * 4 * frameCount, seed);
+	hashes.perceptual = DifferenceHash(thumbnail, thumbnailWidth, thumbnailHeight);
+	return hashes;
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+struct ImageHashes {
+	uint64_t content = 0; // Of the size and every frame's pixels, equal for exact duplicates
+	uint64_t perceptual = 0; // dHash of the first frame, differs in few bits for near duplicates
+};
+
+// Fast non-cryptographic hash, vectorised with SSE2 where available
+uint64_t HashBytes(const uint8_t* data, size_t size, uint64_t seed);
+
+// Compares the brightness of neighbouring cells in a 9x8 grid of the image,
+// which survives scaling, recompression and small colour changes
+uint64_t DifferenceHash(const uint8_t* rgba, int width, int height);
+
+// thumbnail is a downscaled copy of the first frame, or the image itself if it is small
+ImageHashes ComputeImageHashes(const uint8_t* pixels, int width, int height, size_t frameCount,
+	const uint8_t* thumbnail, int thumbnailWidth, int thumbnailHeight);
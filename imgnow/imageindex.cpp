@@ -0,0 +1,209 @@
+#include "imageindex.h"
+#include <algorithm>
+#include <bit>
+#include <filesystem>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+// Largest number of differing perceptual hash bits for images to count as near duplicates.
+// Below the number of buckets, so every pair is found by the bucket search.
+constexpr int NEAR_DISTANCE = 6;
+
+FileIdentity GetFileIdentity(const std::string& path) {
+	FileIdentity identity;
+#ifndef _WIN32
+	struct stat st;
+	if (stat(path.c_str(), &st) == 0) {
+		identity.device = (uint64_t)st.st_dev;
+		identity.inode = (uint64_t)st.st_ino;
+		identity.valid = true;
+	}
+#endif
+	return identity;
+}
+
+ResolvedFile ResolveFile(const std::string& path) {
+	ResolvedFile file;
+	std::error_code ec;
+	std::filesystem::path fullPath = std::filesystem::canonical(path, ec);
+	if (ec) {
+		file.error = ec.message();
+		return file;
+	}
+	file.fullPath = fullPath.string();
+	file.name = fullPath.filename().string();
+	file.identity = GetFileIdentity(file.fullPath);
+	return file;
+}
+
+size_t ImageIndex::IdentityHash::operator()(const FileIdentity& identity) const {
+	return std::hash<uint64_t>()(identity.inode * 0x9E3779B97F4A7C15 ^ identity.device);
+}
+
+uint64_t ImageIndex::AddFile(uint64_t id, const std::string& path, const FileIdentity& identity) {
+	if (auto it = paths.find(path); it != paths.end())
+		return it->second;
+	if (identity.valid) {
+		if (auto it = identities.find(identity); it != identities.end())
+			return it->second;
+		identities[identity] = id;
+	}
+	paths[path] = id;
+	entries[id] = { path, identity, std::nullopt, {}, {} };
+	return 0;
+}
+
+void ImageIndex::SetHashes(uint64_t id, const ImageHashes& hashes) {
+	auto it = entries.find(id);
+	if (it == entries.end())
+		return;
+	Entry& entry = it->second;
+	Unlink(id, entry);
+	entry.hashes = hashes;
+	contents[hashes.content]++;
+
+	// Images with the same perceptual hash are chained together and share the links of the first
+	// one to other hashes, since a folder of identical frames would otherwise link every pair
+	std::vector<uint64_t>& same = perceptuals[hashes.perceptual];
+	if (!same.empty()) {
+		Link(id, same.back());
+		same.push_back(id);
+		dirty = true;
+		return;
+	}
+	same.push_back(id);
+	for (int i = 0; i < 8; i++) {
+		auto& bucket = buckets[i][hashes.perceptual >> (i * 8) & 0xFF];
+		for (uint64_t other : bucket) {
+			// Close hashes share several bytes, only link them from the first
+			uint64_t common = ~(hashes.perceptual ^ other);
+			bool first = true;
+			for (int j = 0; j < i; j++) {
+				first = first && (common >> (j * 8) & 0xFF) != 0xFF;
+			}
+			if (first && std::popcount(hashes.perceptual ^ other) <= NEAR_DISTANCE) {
+				Link(id, perceptuals[other].front());
+			}
+		}
+		bucket.push_back(hashes.perceptual);
+	}
+	dirty = true;
+}
+
+void ImageIndex::Link(uint64_t a, uint64_t b) {
+	auto& links = entries[a].neighbours;
+	if (a != b && std::find(links.begin(), links.end(), b) == links.end()) {
+		links.push_back(b);
+		entries[b].neighbours.push_back(a);
+	}
+}
+
+void ImageIndex::Unlink(uint64_t id, Entry& entry) {
+	if (!entry.hashes)
+		return;
+	const ImageHashes& hashes = *entry.hashes;
+	if (--contents[hashes.content] == 0) {
+		contents.erase(hashes.content);
+	}
+	std::vector<uint64_t> neighbours = std::move(entry.neighbours);
+	entry.neighbours.clear();
+	for (uint64_t other : neighbours) {
+		auto& links = entries[other].neighbours;
+		links.erase(std::find(links.begin(), links.end(), id));
+	}
+
+	// Images linked through this one are handed over to another image with the same hash
+	auto same = perceptuals.find(hashes.perceptual);
+	same->second.erase(std::find(same->second.begin(), same->second.end(), id));
+	if (same->second.empty()) {
+		perceptuals.erase(same);
+		for (int i = 0; i < 8; i++) {
+			auto& bucket = buckets[i][hashes.perceptual >> (i * 8) & 0xFF];
+			bucket.erase(std::find(bucket.begin(), bucket.end(), hashes.perceptual));
+		}
+	} else {
+		for (uint64_t other : neighbours) {
+			Link(other, same->second.front());
+		}
+	}
+	entry.hashes.reset();
+	dirty = true;
+}
+
+void ImageIndex::Remove(uint64_t id) {
+	auto it = entries.find(id);
+	if (it == entries.end())
+		return;
+	Entry& entry = it->second;
+	Unlink(id, entry);
+	paths.erase(entry.path);
+	if (entry.identity.valid) {
+		identities.erase(entry.identity);
+	}
+	entries.erase(it);
+}
+
+uint64_t ImageIndex::FindFile(const std::string& path) const {
+	auto it = paths.find(path);
+	return it == paths.end() ? 0 : it->second;
+}
+
+void ImageIndex::Regroup() {
+	if (!dirty)
+		return;
+	dirty = false;
+
+	// Groups are numbered in order of their lowest id, which keeps them stable as images are added
+	std::vector<uint64_t> ids;
+	for (const auto& [id, entry] : entries) {
+		if (!entry.neighbours.empty()) {
+			ids.push_back(id);
+		}
+	}
+	std::sort(ids.begin(), ids.end());
+
+	std::unordered_map<uint64_t, DuplicateInfo> groups;
+	uint32_t groupCount = 0;
+	std::vector<uint64_t> stack;
+	for (uint64_t id : ids) {
+		if (groups.contains(id))
+			continue;
+		groupCount++;
+		stack.push_back(id);
+		groups[id] = {};
+		while (!stack.empty()) {
+			const Entry& entry = entries[stack.back()];
+			groups[stack.back()] = { groupCount, contents[entry.hashes->content] > 1 };
+			stack.pop_back();
+			for (uint64_t other : entry.neighbours) {
+				if (groups.try_emplace(other).second) {
+					stack.push_back(other);
+				}
+			}
+		}
+	}
+
+	bool changed = false;
+	for (auto& [id, entry] : entries) {
+		auto group = groups.find(id);
+		DuplicateInfo duplicates = group == groups.end() ? DuplicateInfo{} : group->second;
+		if (entry.duplicates.group != duplicates.group || entry.duplicates.exact != duplicates.exact) {
+			entry.duplicates = duplicates;
+			changed = true;
+		}
+	}
+	if (changed) {
+		version++;
+	}
+}
+
+DuplicateInfo ImageIndex::GetDuplicates(uint64_t id) const {
+	auto it = entries.find(id);
+	return it == entries.end() ? DuplicateInfo{} : it->second.duplicates;
+}
+
+uint64_t ImageIndex::GetVersion() const {
+	return version;
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <array>
+#include <unordered_map>
+#include <optional>
+#include "imagehash.h"
+
+// Device and inode of a file, the same for every path that leads to it
+// including hard links. Never valid on Windows.
+struct FileIdentity {
+	uint64_t device = 0;
+	uint64_t inode = 0;
+	bool valid = false;
+	bool operator==(const FileIdentity&) const = default;
+};
+
+FileIdentity GetFileIdentity(const std::string& path); // Blocking
+
+// Where a path leads. Resolving can take seconds on network mounts, so it is done on an I/O thread.
+struct ResolvedFile {
+	std::string fullPath; // Canonical
+	std::string name;
+	FileIdentity identity;
+	std::string error; // Non-empty if the file can't be found, in which case the rest is empty
+};
+
+ResolvedFile ResolveFile(const std::string& path); // Blocking
+
+struct DuplicateInfo {
+	uint32_t group = 0; // Non-zero and shared by images that look alike
+	bool exact = false; // Another image in the group has exactly the same pixels
+};
+
+// Finds open images by canonical path and file identity, and groups images
+// whose pixels are identical or whose perceptual hashes are close.
+struct ImageIndex {
+	// Adds the file unless it is already open, in which case the id of the open image is returned instead
+	uint64_t AddFile(uint64_t id, const std::string& path, const FileIdentity& identity);
+	void SetHashes(uint64_t id, const ImageHashes& hashes); // Added files only, finds the images that look alike
+	void Remove(uint64_t id);
+	uint64_t FindFile(const std::string& path) const; // 0 if not open
+	void Regroup(); // Brings the group numbers up to date after SetHashes and Remove
+	DuplicateInfo GetDuplicates(uint64_t id) const;
+	uint64_t GetVersion() const; // Incremented whenever the groups change
+private:
+	struct IdentityHash {
+		size_t operator()(const FileIdentity& identity) const;
+	};
+	struct Entry {
+		std::string path;
+		FileIdentity identity;
+		std::optional<ImageHashes> hashes;
+		std::vector<uint64_t> neighbours; // Images that look alike, groups are the connected sets
+		DuplicateInfo duplicates;
+	};
+	void Link(uint64_t a, uint64_t b);
+	void Unlink(uint64_t id, Entry& entry); // Removes the hashes and neighbours
+	std::unordered_map<uint64_t, Entry> entries;
+	std::unordered_map<std::string, uint64_t> paths;
+	std::unordered_map<FileIdentity, uint64_t, IdentityHash> identities;
+	std::unordered_map<uint64_t, size_t> contents; // Number of images with each content hash
+	std::unordered_map<uint64_t, std::vector<uint64_t>> perceptuals; // Images with each perceptual hash
+	// Distinct perceptual hashes by each of their bytes. Hashes that differ in fewer bits
+	// than there are bytes share at least one byte, so only these buckets need to be searched.
+	std::array<std::array<std::vector<uint64_t>, 256>, 8> buckets;
+	bool dirty = false;
+	uint64_t version = 0;
+};
@@ -1,12 +1,77 @@
 #include "SDL.h"
 #include "app.h"
 #include "net.h"
+#include "bench.h"
+#include "options.h"
+#include "export.h"
+#include <stdexcept>
+#include <algorithm>
+#include <thread>
+#include <cstdio>
+
+// Print the replies to requests sent to another instance.
+// Returns the exit code, which is non-zero if anything failed.
+static int PrintReplies(MessageClient& client, size_t count) {
+	int exitCode = 0;
+	for (size_t i = 0; i < count; i++) {
+		Reply reply = client.Receive();
+		for (const auto& entry : reply.entries) {
+			std::printf("%s\t%s\n", GetResultName(entry.result), entry.text.c_str());
+			if (entry.result == Result::Failed) {
+				exitCode = 1;
+			}
+		}
+	}
+	std::fflush(stdout);
+	return exitCode;
+}
+
+// Decode a single file and write it out again without creating a window.
+// Returns the exit code.
+static int ExportFile(const Options& options) {
+	if (options.paths.size() != 1) {
+		std::fputs("imgnow: --export needs exactly one file\n", stderr);
+		return 1;
+	}
+	ExportFormat format = GuessExportFormat(options.exportPath);
+	if (!options.exportFormat.empty() && !ParseExportFormat(options.exportFormat, format)) {
+		std::fprintf(stderr, "imgnow: unknown export format '%s', expected png, qoi or raw\n", options.exportFormat.c_str());
+		return 1;
+	}
+
+	Image image(options.paths[0].c_str());
+	if (!image.Valid()) {
+		std::fprintf(stderr, "imgnow: %s: %s\n", options.paths[0].c_str(), image.Error().c_str());
+		return 1;
+	}
+	ExportSource source = { image.SharePixels(), (size_t)image.GetWidth(), image.GetWidth(), image.GetHeight() };
+	ThreadPool pool((int)std::thread::hardware_concurrency() - 1);
+	std::string error = ExportImage(source, format, options.exportPath, pool);
+	if (!error.empty()) {
+		std::fprintf(stderr, "imgnow: %s\n", error.c_str());
+		return 1;
+	}
+	return 0;
+}
+
+static int run(int argc, char** argv) {
+	Options options(argc, argv);
+	if (!options.exportPath.empty()) {
+		return ExportFile(options);
+	}
+	if (options.benchOpen) {
+		Benchmark::UseHeadlessVideo();
+	}
 
-static void run(int argc, char** argv) {
 	// Load configuration and tcp port for interprocess communication
 	Config config;
 	uint16_t port = (uint16_t)config.GetOr("port", 29395);
-	
+
+	std::shared_ptr<Benchmark> bench;
+	if (options.benchOpen) {
+		bench = std::make_shared<Benchmark>(options.paths, options.benchIpc, port);
+	}
+
 	// Initialize networking and automatically cleanup with the destructor
 	NetInstance net;
 
@@ -14,28 +79,70 @@ static void run(int argc, char** argv) {
 	std::unique_ptr<MessageServer> msgServer;
 	try {
 		msgServer = std::make_unique<MessageServer>(port);
-	} catch (SDLNetException&) {}
+	} catch (NetException&) {}
 	
-	if (!msgServer && argc > 1) {
-		// Another instance is already running so tell that instance what files to open and exit
+	bool resident = options.resident || config.GetOr("resident", false);
+	// An instance watching a directory always runs on its own
+	bool handOver = (!options.paths.empty() || !options.commands.empty() || resident) && options.watchDirs.empty();
+	if (!msgServer && handOver && !options.benchIpc) {
+		// Another instance is already running so tell that instance what to do and exit
 		try {
 			MessageClient client(port);
-			for (int i = 1; i < argc; i++) {
-				client.Send(argv[i]);
+			double connected = Benchmark::Now();
+			size_t replyCount = 0;
+			if (!options.paths.empty() || options.commands.empty()) {
+				// Without files this brings the window of a background instance back
+				Request request;
+				request.command = options.paths.empty() ? Command::Show : Command::Open;
+				request.paths = options.paths;
+				client.Send(std::move(request));
+				replyCount += options.wait;
+			}
+			for (const auto& command : options.commands) {
+				client.Send(command);
+				replyCount++;
+			}
+			if (options.benchOpen) {
+				Benchmark::PrintClientResult(connected, Benchmark::Now(), options.paths.size());
+			}
+			return PrintReplies(client, replyCount);
+		} catch (NetException& ex) {
+			if (!options.commands.empty()) {
+				std::fprintf(stderr, "imgnow: %s\n", ex.what());
+				return 1;
 			}
-			return;
-		} catch (SDLNetException&) {
 			// Failed to send message to other instance so just continue and start the app normally
 		}
 	}
+
+	if (!options.commands.empty()) {
+		std::fputs("imgnow: no running instance to send commands to\n", stderr);
+		return 1;
+	}
+
+	if (options.benchIpc && !msgServer)
+		throw std::runtime_error("--bench-ipc requires that no other instance is running.");
 	
-	App(argc, argv, std::move(config), std::move(msgServer)).Run();
+	// This process owns the window, so start decoding straight away to overlap with creating the window
+	// and renderer. Not done any earlier, since a second instance only hands its files over.
+	// With --bench-ipc the files arrive through the message server instead.
+	auto loader = std::make_shared<ThreadPool>((int)std::thread::hardware_concurrency() - 1);
+	std::vector<PendingImage> pending;
+	if (!options.benchIpc) {
+		for (const auto& path : options.paths) {
+			if (std::none_of(pending.begin(), pending.end(), [&](const PendingImage& p) { return p.path == path; })) {
+				pending.push_back({ path, App::DecodeAsync(*loader, path, bench) });
+			}
+		}
+	}
+
+	App(options, std::move(pending), std::move(config), std::move(msgServer), std::move(loader), std::move(bench)).Run();
+	return 0;
 }
 
 int main(int argc, char** argv) {
 	try {
-		run(argc, argv);
-		return 0;
+		return run(argc, argv);
 	} catch (std::exception& ex) {
 		SDL_ShowSimpleMessageBox(0, "Error", ex.what(), nullptr);
 		return 1;
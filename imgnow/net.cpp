@@ -1,5 +1,19 @@
 #pragma once
 #include "net.h"
+#include <cstring>
+#include <algorithm>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstddef>
+#endif
 
 NetInstance::NetInstance() {
 	SDLNet_Init(); // Ignore error
@@ -13,7 +27,15 @@ const char* SDLNetException::what() const noexcept {
 	return SDLNet_GetError();
 }
 
-TcpServer::TcpServer(uint16_t port, TcpRecvCallback recvCallback) :
+SocketException::SocketException() :
+	message(std::strerror(errno)) {
+}
+
+const char* SocketException::what() const noexcept {
+	return message.c_str();
+}
+
+TcpServer::TcpServer(uint16_t port, RecvCallback recvCallback) :
 	recvCallback(recvCallback) {
 	IPaddress ip{};
 	ip.host = SDL_SwapBE32(INADDR_LOOPBACK);
@@ -39,8 +61,9 @@ TcpServer::~TcpServer() {
 	SDLNet_FreeSocketSet(socketSet);
 }
 	
-TcpServer::Client::Client(TCPsocket socket) :
-	socket(socket) {
+TcpServer::Client::Client(TCPsocket socket, uint64_t id) :
+	socket(socket),
+	id(id) {
 }
 	
 void TcpServer::Run() {
@@ -58,60 +81,404 @@ void TcpServer::Run() {
 				throw SDLNetException();
 
 			SDLNet_TCP_AddSocket(socketSet, clientSocket);
-			clients.push_back(Client(clientSocket));
+			std::lock_guard<std::mutex> lock(clientsMutex);
+			clients.push_back(Client(clientSocket, nextClientId++));
 		}
 
-		for (auto it = clients.begin(); it != clients.end(); ++it) {
-			Client& client = *it;
+		for (size_t i = 0; i < clients.size(); i++) {
+			Client client = clients[i];
 			if (!SDLNet_SocketReady(client.socket))
 				continue;
-			char buffer[1024];
+			uint8_t buffer[1024];
 			int numBytes = SDLNet_TCP_Recv(client.socket, buffer, sizeof(buffer));
 			if (numBytes <= 0) {
-				SDLNet_TCP_DelSocket(socketSet, it->socket);
-				SDLNet_TCP_Close(it->socket);
-				it = clients.erase(it);
-				if (it == clients.end())
-					break;
+				{
+					std::lock_guard<std::mutex> lock(clientsMutex);
+					SDLNet_TCP_DelSocket(socketSet, client.socket);
+					SDLNet_TCP_Close(client.socket);
+					clients.erase(clients.begin() + i);
+				}
+				recvCallback(client.id, nullptr, 0);
+				i--;
 			} else {
-				client.data.insert(client.data.end(), buffer, buffer + numBytes);
-				recvCallback(client.data);
+				recvCallback(client.id, buffer, (size_t)numBytes);
 			}
 		}
 	}
 }
 
-MessageServer::MessageServer(uint16_t port) :
-	server(port, [this](auto& data) { this->OnRecv(data); }) {
+void TcpServer::Send(uint64_t client, const std::vector<uint8_t>& data) {
+	std::lock_guard<std::mutex> lock(clientsMutex);
+	for (const auto& c : clients) {
+		if (c.id == client) {
+			SDLNet_TCP_Send(c.socket, data.data(), (int)data.size());
+			break;
+		}
+	}
 }
 
-std::vector<std::string> MessageServer::GetMessages() {
-	std::lock_guard<std::mutex> lock(mutex);
-	std::vector<std::string> copy = std::move(messages);
-	messages.clear();
-	return copy;
+#ifdef __linux__
+static sockaddr_un MakeAbstractAddress(const std::string& name, socklen_t& len) {
+	// Abstract socket names start with a null byte and don't exist on the filesystem,
+	// so they disappear automatically when the owning process exits.
+	sockaddr_un addr{};
+	addr.sun_family = AF_UNIX;
+	size_t n = std::min(name.size(), sizeof(addr.sun_path) - 1);
+	std::memcpy(addr.sun_path + 1, name.data(), n);
+	len = (socklen_t)(offsetof(sockaddr_un, sun_path) + 1 + n);
+	return addr;
 }
-	
-void MessageServer::OnRecv(std::vector<uint8_t>& data) {
+
+static std::string GetSocketName(uint16_t port) {
+	// Abstract sockets are shared between users so include the user id
+	return "imgnow." + std::to_string(getuid()) + "." + std::to_string(port);
+}
+
+UnixServer::UnixServer(const std::string& name, RecvCallback recvCallback) :
+	recvCallback(recvCallback) {
+	socklen_t len = 0;
+	sockaddr_un addr = MakeAbstractAddress(name, len);
+
+	server = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (server == -1)
+		throw SocketException();
+
+	if (bind(server, (sockaddr*)&addr, len) == -1 || listen(server, SOMAXCONN) == -1) {
+		SocketException ex;
+		close(server);
+		throw ex;
+	}
+
+	epoll = epoll_create1(EPOLL_CLOEXEC);
+	stopEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (epoll == -1 || stopEvent == -1) {
+		SocketException ex;
+		close(server);
+		close(epoll);
+		close(stopEvent);
+		throw ex;
+	}
+
+	epoll_event ev{};
+	ev.events = EPOLLIN;
+	ev.data.fd = server;
+	epoll_ctl(epoll, EPOLL_CTL_ADD, server, &ev);
+	ev.data.fd = stopEvent;
+	epoll_ctl(epoll, EPOLL_CTL_ADD, stopEvent, &ev);
+
+	runThread = std::thread(&UnixServer::Run, this);
+}
+
+UnixServer::~UnixServer() {
+	uint64_t one = 1;
+	(void)write(stopEvent, &one, sizeof(one));
+	runThread.join();
+	for (const auto& [client, id] : clients) {
+		close(client);
+	}
+	for (const auto& [id, fds] : receivedFds) {
+		for (int fd : fds) {
+			if (fd >= 0) {
+				close(fd);
+			}
+		}
+	}
+	close(server);
+	close(stopEvent);
+	close(epoll);
+}
+
+void UnixServer::Run() {
+	epoll_event events[64];
 	while (true) {
-		if (data.size() < 4)
+		int numReady = epoll_wait(epoll, events, (int)std::size(events), acceptPaused ? ACCEPT_RETRY_MS : -1);
+		if (numReady == -1) {
+			if (errno == EINTR)
+				continue;
 			return;
+		}
+		if (numReady == 0) {
+			PauseAccept(false);
+			continue;
+		}
+
+		for (int i = 0; i < numReady; i++) {
+			int fd = events[i].data.fd;
+			if (fd == stopEvent) {
+				return;
+			} else if (fd == server) {
+				Accept();
+			} else {
+				if (events[i].events & EPOLLOUT) {
+					Flush(fd);
+				}
+				if (events[i].events & ~EPOLLOUT) {
+					Recv(fd);
+				}
+			}
+		}
+	}
+}
 
-		// Little endian
-		uint32_t len = data[0] | (data[1] << 8) | (data[2] << 16) | (data[3] << 24);
-		if (data.size() < (size_t)len + 4)
+void UnixServer::Accept() {
+	while (true) {
+		int client = accept4(server, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (client == -1 && (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)) {
+			// The connection stays pending and the listening socket stays readable,
+			// so stop polling it for a while instead of spinning
+			PauseAccept(true);
 			return;
+		}
+		if (client == -1)
+			return; // Accepted everything that was pending
 
-		std::string str((char*)data.data() + 4, len);
-		{
-			std::lock_guard<std::mutex> lock(mutex);
-			messages.push_back(std::move(str));
+		// The abstract namespace is shared by every user, only accept our own processes
+		ucred cred{};
+		socklen_t credLen = sizeof(cred);
+		if (getsockopt(client, SOL_SOCKET, SO_PEERCRED, &cred, &credLen) == -1 || cred.uid != getuid()) {
+			close(client);
+			continue;
+		}
+
+		epoll_event ev{};
+		ev.events = EPOLLIN | EPOLLRDHUP;
+		ev.data.fd = client;
+		if (epoll_ctl(epoll, EPOLL_CTL_ADD, client, &ev) == -1) {
+			close(client);
+			continue;
 		}
 
-		data.erase(data.begin(), data.begin() + len + 4);
+		std::lock_guard<std::mutex> lock(clientsMutex);
+		uint64_t id = nextClientId++;
+		clients[client] = id;
+		sockets[id] = client;
 	}
 }
+
+void UnixServer::PauseAccept(bool paused) {
+	if (acceptPaused == paused)
+		return;
+	acceptPaused = paused;
+	epoll_event ev{};
+	ev.events = paused ? 0 : EPOLLIN;
+	ev.data.fd = server;
+	epoll_ctl(epoll, EPOLL_CTL_MOD, server, &ev);
+}
+
+void UnixServer::Recv(int client) {
+	auto it = clients.find(client);
+	if (it == clients.end())
+		return;
+	uint64_t id = it->second;
+
+	while (true) {
+		uint8_t buffer[4096];
+		alignas(cmsghdr) uint8_t control[CMSG_SPACE(sizeof(int) * 16)];
+		iovec iov{ buffer, sizeof(buffer) };
+		msghdr msg{};
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		ssize_t numBytes = recvmsg(client, &msg, MSG_CMSG_CLOEXEC);
+
+		// Keep descriptors passed with the data in order until a request claims them.
+		// The kernel drops the descriptors that didn't fit from the end, so the requests they
+		// belong to come after the ones that arrived, and the first of them gets LOST_FD instead of someone else's.
+		if (numBytes > 0) {
+			for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+				if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+					continue;
+				size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+				for (size_t i = 0; i < count; i++) {
+					int fd;
+					std::memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+					receivedFds[id].push_back(fd);
+				}
+			}
+			if (msg.msg_flags & MSG_CTRUNC) {
+				receivedFds[id].push_back(LOST_FD);
+			}
+		}
+
+		if (numBytes > 0) {
+			recvCallback(id, buffer, (size_t)numBytes);
+		} else if (numBytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return;
+		} else if (numBytes == -1 && errno == EINTR) {
+			continue;
+		} else {
+			Disconnect(client);
+			recvCallback(id, nullptr, 0);
+			return;
+		}
+	}
+}
+
+int UnixServer::TakeFd(uint64_t client) {
+	auto it = receivedFds.find(client);
+	if (it == receivedFds.end() || it->second.empty())
+		return -1;
+	int fd = it->second.front();
+	it->second.pop_front();
+	return fd;
+}
+
+void UnixServer::Disconnect(int client) {
+	std::lock_guard<std::mutex> lock(clientsMutex);
+	epoll_ctl(epoll, EPOLL_CTL_DEL, client, nullptr);
+	close(client);
+	uint64_t id = clients[client];
+	for (int fd : receivedFds[id]) {
+		if (fd >= 0) {
+			close(fd);
+		}
+	}
+	receivedFds.erase(id);
+	unsent.erase(id);
+	sockets.erase(id);
+	clients.erase(client);
+	PauseAccept(false); // A descriptor was freed
+}
+
+void UnixServer::Send(uint64_t client, const std::vector<uint8_t>& data) {
+	std::lock_guard<std::mutex> lock(clientsMutex);
+	auto it = sockets.find(client);
+	if (it == sockets.end())
+		return; // Already disconnected
 	
+	// Whatever doesn't fit in the socket's buffer is queued and sent by the run thread,
+	// so a client that stops reading its replies never holds up the caller
+	RingBuffer& buffer = unsent[client];
+	bool wasEmpty = buffer.Size() == 0;
+	buffer.Write(data.data(), data.size());
+	if (!wasEmpty)
+		return; // Already waiting for room
+	SendPending(it->second, buffer);
+	if (buffer.Size() > MAX_UNSENT_BYTES) {
+		// The run thread sees the hang up and disconnects the client
+		shutdown(it->second, SHUT_RDWR);
+		buffer.Discard(buffer.Size());
+	} else if (buffer.Size() != 0) {
+		epoll_event ev{};
+		ev.events = EPOLLIN | EPOLLRDHUP | EPOLLOUT;
+		ev.data.fd = it->second;
+		epoll_ctl(epoll, EPOLL_CTL_MOD, it->second, &ev);
+	}
+}
+
+void UnixServer::Flush(int client) {
+	std::lock_guard<std::mutex> lock(clientsMutex);
+	auto it = clients.find(client);
+	if (it == clients.end())
+		return;
+	RingBuffer& buffer = unsent[it->second];
+	SendPending(client, buffer);
+	if (buffer.Size() == 0) {
+		epoll_event ev{};
+		ev.events = EPOLLIN | EPOLLRDHUP;
+		ev.data.fd = client;
+		epoll_ctl(epoll, EPOLL_CTL_MOD, client, &ev);
+	}
+}
+
+void UnixServer::SendPending(int socket, RingBuffer& buffer) {
+	while (buffer.Size() != 0) {
+		uint8_t chunk[16384];
+		size_t size = std::min(buffer.Size(), sizeof(chunk));
+		buffer.Peek(chunk, 0, size);
+		ssize_t n = ::send(socket, chunk, size, MSG_NOSIGNAL);
+		if (n >= 0) {
+			buffer.Discard((size_t)n);
+		} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return;
+		} else if (errno != EINTR) {
+			// Broken connection, the run thread disconnects the client once it reads the error
+			buffer.Discard(buffer.Size());
+			return;
+		}
+	}
+}
+#endif
+
+MessageServer::MessageServer(uint16_t port) :
+#ifdef __linux__
+	server(GetSocketName(port), [this](uint64_t client, const uint8_t* data, size_t size) { OnRecv(client, data, size); }) {
+#else
+	server(port, [this](uint64_t client, const uint8_t* data, size_t size) { OnRecv(client, data, size); }) {
+#endif
+}
+
+std::vector<Request> MessageServer::GetRequests() {
+	std::lock_guard<std::mutex> lock(mutex);
+	std::vector<Request> copy = std::move(requests);
+	requests.clear();
+	return copy;
+}
+
+void MessageServer::SendReply(uint64_t client, const Reply& reply) {
+	server.Send(client, EncodeReply(reply));
+}
+
+void MessageServer::SetNotify(std::function<void()> notify) {
+	std::lock_guard<std::mutex> lock(mutex);
+	this->notify = std::move(notify);
+}
+	
+void MessageServer::OnRecv(uint64_t client, const uint8_t* data, size_t size) {
+	if (size == 0) {
+		buffers.erase(client);
+		return;
+	}
+
+	RingBuffer& buffer = buffers[client];
+	buffer.Write(data, size);
+
+	std::vector<Request> received;
+	if (!DecodeRequests(buffer, received)) {
+		// Garbage, ignore anything else from this client
+		buffer.Discard(buffer.Size());
+	}
+	if (received.empty())
+		return;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	for (auto& request : received) {
+		request.client = client;
+#ifdef __linux__
+		if (request.command == Command::Push) {
+			request.fd = server.TakeFd(client);
+		}
+#endif
+		requests.push_back(std::move(request));
+	}
+
+	// Wake up the main loop so that it doesn't have to wait for its next frame
+	if (notify) {
+		notify();
+	}
+}
+
+#ifdef __linux__
+MessageClient::MessageClient(uint16_t port) {
+	socklen_t len = 0;
+	sockaddr_un addr = MakeAbstractAddress(GetSocketName(port), len);
+
+	socket = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (socket == -1)
+		throw SocketException();
+
+	if (connect(socket, (sockaddr*)&addr, len) == -1) {
+		SocketException ex;
+		close(socket);
+		throw ex;
+	}
+}
+
+MessageClient::~MessageClient() {
+	close(socket);
+}
+#else
 MessageClient::MessageClient(uint16_t port) {
 	IPaddress ip{};
 	ip.host = SDL_SwapBE32(INADDR_LOOPBACK);
@@ -125,14 +492,137 @@ MessageClient::MessageClient(uint16_t port) {
 MessageClient::~MessageClient() {
 	SDLNet_TCP_Close(socket);
 }
+#endif
+
+uint32_t MessageClient::Send(Request request) {
+	request.id = nextRequestId++;
+	SendBytes(EncodeRequest(request));
+	return request.id;
+}
+
+#ifdef __linux__
+uint32_t MessageClient::Push(const std::string& slot, int fd) {
+	Request request;
+	request.id = nextRequestId++;
+	request.command = Command::Push;
+	request.slot = slot;
+	SendBytes(EncodeRequest(request), fd);
+	return request.id;
+}
+
+void MessageClient::SendBytes(const std::vector<uint8_t>& data, int fd) {
+	size_t sent = 0;
+	if (fd != -1) {
+		// Attach the descriptor to the first byte of the frame
+		alignas(cmsghdr) uint8_t control[CMSG_SPACE(sizeof(int))]{};
+		iovec iov{ (void*)data.data(), data.size() };
+		msghdr msg{};
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+		ssize_t n;
+		do {
+			n = sendmsg(socket, &msg, MSG_NOSIGNAL);
+		} while (n == -1 && errno == EINTR);
+		if (n == -1)
+			throw SocketException();
+		sent = (size_t)n;
+	}
+	while (sent < data.size()) {
+		ssize_t n = ::send(socket, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			throw SocketException();
+		}
+		sent += (size_t)n;
+	}
+}
+
+void MessageClient::ReceiveBytes() {
+	uint8_t buffer[4096];
+	ssize_t n;
+	do {
+		n = recv(socket, buffer, sizeof(buffer), 0);
+	} while (n == -1 && errno == EINTR);
+	if (n == 0) {
+		errno = ECONNRESET;
+	}
+	if (n <= 0)
+		throw SocketException();
+	received.Write(buffer, (size_t)n);
+	if (!DecodeReplies(received, replies)) {
+		errno = EPROTO;
+		throw SocketException();
+	}
+}
+
+bool MessageClient::WaitForReply(uint32_t timeoutMs) {
+	while (replies.empty()) {
+		pollfd pfd{ socket, POLLIN, 0 };
+		int ready = poll(&pfd, 1, (int)timeoutMs);
+		if (ready == -1 && errno == EINTR)
+			continue;
+		if (ready == -1)
+			throw SocketException();
+		if (ready == 0)
+			return false;
+		ReceiveBytes();
+	}
+	return true;
+}
+#else
+void MessageClient::SendBytes(const std::vector<uint8_t>& data, int fd) {
+	if (SDLNet_TCP_Send(socket, data.data(), (int)data.size()) < (int)data.size())
+		throw SDLNetException();
+}
+
+void MessageClient::ReceiveBytes() {
+	uint8_t buffer[4096];
+	int n = SDLNet_TCP_Recv(socket, buffer, sizeof(buffer));
+	if (n <= 0)
+		throw SDLNetException();
+	received.Write(buffer, (size_t)n);
+	if (!DecodeReplies(received, replies))
+		throw SDLNetException();
+}
 
-void MessageClient::Send(std::string_view data) {
-	uint32_t len = (uint32_t)data.size();
-	std::vector<uint8_t> buffer;
-	buffer.push_back(len & 0xFF);
-	buffer.push_back((len >> 8) & 0xFF);
-	buffer.push_back((len >> 16) & 0xFF);
-	buffer.push_back((len >> 24) & 0xFF);
-	buffer.insert(buffer.end(), data.begin(), data.end());
-	SDLNet_TCP_Send(socket, buffer.data(), (int)buffer.size());
-}
\ No newline at end of file
+bool MessageClient::WaitForReply(uint32_t timeoutMs) {
+	SDLNet_SocketSet set = SDLNet_AllocSocketSet(1);
+	if (!set)
+		throw SDLNetException();
+	SDLNet_TCP_AddSocket(set, socket);
+	while (replies.empty()) {
+		int ready = SDLNet_CheckSockets(set, timeoutMs);
+		if (ready <= 0) {
+			SDLNet_FreeSocketSet(set);
+			if (ready == -1)
+				throw SDLNetException();
+			return false;
+		}
+		try {
+			ReceiveBytes();
+		} catch (SDLNetException&) {
+			SDLNet_FreeSocketSet(set);
+			throw;
+		}
+	}
+	SDLNet_FreeSocketSet(set);
+	return true;
+}
+#endif
+
+Reply MessageClient::Receive() {
+	while (replies.empty()) {
+		ReceiveBytes();
+	}
+	Reply reply = std::move(replies.front());
+	replies.erase(replies.begin());
+	return reply;
+}
@@ -6,7 +6,11 @@
 #include <functional>
 #include <string>
 #include <mutex>
+#include <atomic>
 #include <exception>
+#include <unordered_map>
+#include <deque>
+#include "protocol.h"
 
 struct NetInstance {
 	NetInstance();
@@ -15,46 +19,120 @@ struct NetInstance {
 	NetInstance& operator=(const NetInstance&) = delete;
 };
 
-struct SDLNetException : std::exception {
+struct NetException : std::exception {
+};
+
+struct SDLNetException : NetException {
+	const char* what() const noexcept override;
+};
+
+struct SocketException : NetException {
+	SocketException(); // Uses errno
 	const char* what() const noexcept override;
+private:
+	std::string message;
 };
 
-using TcpRecvCallback = std::function<void(std::vector<uint8_t>&)>;
+// Called from the server thread with data received from a client.
+// A call with no data means that the client disconnected.
+using RecvCallback = std::function<void(uint64_t client, const uint8_t* data, size_t size)>;
 
 struct TcpServer {
-	TcpServer(uint16_t port, TcpRecvCallback recvCallback);
+	TcpServer(uint16_t port, RecvCallback recvCallback);
 	~TcpServer();
+	void Send(uint64_t client, const std::vector<uint8_t>& data); // Thread safe
 private:
 	struct Client {
 		TCPsocket socket;
-		std::vector<uint8_t> data;
-		explicit Client(TCPsocket socket);
+		uint64_t id;
+		Client(TCPsocket socket, uint64_t id);
 	};
 	
 	static constexpr size_t MAX_CLIENTS = 16;
 	SDLNet_SocketSet socketSet;
 	TCPsocket server;
 	std::vector<Client> clients;
+	std::mutex clientsMutex;
+	uint64_t nextClientId = 1;
 	std::thread runThread;
 	std::atomic_bool running = true;
-	TcpRecvCallback recvCallback;
+	RecvCallback recvCallback;
 	void Run();
 };
 
+#ifdef __linux__
+constexpr int LOST_FD = -2; // From TakeFd when descriptors sent by the client didn't fit and were dropped
+constexpr size_t MAX_UNSENT_BYTES = 16 << 20; // Clients with more replies waiting than this are disconnected
+constexpr int ACCEPT_RETRY_MS = 500; // Accepting pauses this long after running out of descriptors
+
+// Server on an abstract unix domain socket. Clients are multiplexed with epoll
+// so there is no limit on the number of clients and no polling interval.
+struct UnixServer {
+	UnixServer(const std::string& name, RecvCallback recvCallback);
+	~UnixServer();
+	void Send(uint64_t client, const std::vector<uint8_t>& data); // Thread safe, never blocks
+	int TakeFd(uint64_t client); // Next descriptor received from the client, LOST_FD or -1. Server thread only.
+private:
+	int server = -1;
+	int epoll = -1;
+	int stopEvent = -1; // eventfd used to wake the run thread for shutdown
+	std::unordered_map<int, uint64_t> clients; // Socket to client id
+	std::unordered_map<uint64_t, int> sockets; // Client id to socket
+	std::unordered_map<uint64_t, std::deque<int>> receivedFds;
+	std::unordered_map<uint64_t, RingBuffer> unsent; // Written out by the run thread once the socket has room
+	std::mutex clientsMutex;
+	uint64_t nextClientId = 1;
+	std::thread runThread;
+	RecvCallback recvCallback;
+	bool acceptPaused = false; // The listening socket is left out of epoll until descriptors are free again
+	void Run();
+	void Accept();
+	void PauseAccept(bool paused);
+	void Recv(int client);
+	void Flush(int client);
+	void SendPending(int socket, RingBuffer& buffer); // With clientsMutex held
+	void Disconnect(int client);
+};
+#endif
+
 struct MessageServer {
 	MessageServer(uint16_t port);
-	std::vector<std::string> GetMessages();
+	std::vector<Request> GetRequests();
+	void SendReply(uint64_t client, const Reply& reply);
+	void SetNotify(std::function<void()> notify); // Called from the server thread when requests arrive
 private:
-	TcpServer server;
-	std::vector<std::string> messages;
+	std::unordered_map<uint64_t, RingBuffer> buffers; // Only accessed by the server thread
+	std::vector<Request> requests;
+	std::function<void()> notify;
 	std::mutex mutex;
-	void OnRecv(std::vector<uint8_t>& data);
+#ifdef __linux__
+	UnixServer server;
+#else
+	TcpServer server;
+#endif
+	void OnRecv(uint64_t client, const uint8_t* data, size_t size);
 };
 
 struct MessageClient {
 	MessageClient(uint16_t port);
 	~MessageClient();
-	void Send(std::string_view data);
+	MessageClient(const MessageClient&) = delete;
+	MessageClient& operator=(const MessageClient&) = delete;
+	uint32_t Send(Request request); // Returns the request id
+#ifdef __linux__
+	uint32_t Push(const std::string& slot, int fd); // Show a SharedImage, see shm.h
+#endif
+	Reply Receive(); // Blocks until the next reply arrives
+	bool WaitForReply(uint32_t timeoutMs); // False if nothing arrived within the timeout, otherwise Receive doesn't block
 private:
+#ifdef __linux__
+	int socket = -1;
+#else
 	TCPsocket socket;
-};
\ No newline at end of file
+#endif
+	uint32_t nextRequestId = 1;
+	RingBuffer received;
+	std::vector<Reply> replies;
+	void SendBytes(const std::vector<uint8_t>& data, int fd = -1);
+	void ReceiveBytes(); // Blocks until some bytes arrive and decodes any complete replies
+};
@@ -0,0 +1,66 @@
+#include "options.h"
+#include <string_view>
+#include <charconv>
+
+// Parses "--name=value". Returns false if arg isn't the option or the value is invalid.
+template <typename T>
+static bool ParseValue(std::string_view arg, std::string_view name, T& value) {
+	if (!arg.starts_with(name) || arg.size() <= name.size() || arg[name.size()] != '=')
+		return false;
+	std::string_view str = arg.substr(name.size() + 1);
+	auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
+	return ec == std::errc() && ptr == str.data() + str.size();
+}
+
+static Request MakeCommand(Command command, int32_t index = CURRENT_IMAGE) {
+	Request request;
+	request.command = command;
+	request.index = index;
+	return request;
+}
+
+Options::Options(int argc, char** argv) {
+	bool endOfOptions = false;
+	for (int i = 1; i < argc; i++) {
+		std::string_view arg = argv[i];
+		if (endOfOptions || !arg.starts_with("--")) {
+			paths.push_back(argv[i]);
+		} else if (arg == "--") {
+			endOfOptions = true;
+		} else if (arg == "--bench-open") {
+			benchOpen = true;
+		} else if (arg == "--bench-ipc") {
+			benchOpen = true;
+			benchIpc = true;
+		} else if (arg == "--resident") {
+			resident = true;
+		} else if (arg == "--wait") {
+			wait = true;
+		} else if (arg.starts_with("--watch-dir=") && arg.size() > 12) {
+			watchDirs.emplace_back(arg.substr(12));
+		} else if (arg.starts_with("--export=") && arg.size() > 9) {
+			exportPath = arg.substr(9);
+		} else if (arg.starts_with("--export-format=") && arg.size() > 16) {
+			exportFormat = arg.substr(16);
+		} else if (arg == "--status") {
+			commands.push_back(MakeCommand(Command::Status));
+		} else if (arg == "--close") {
+			commands.push_back(MakeCommand(Command::Close));
+		} else if (arg == "--reload") {
+			commands.push_back(MakeCommand(Command::Reload));
+		} else if (int32_t index; ParseValue(arg, "--activate", index)) {
+			commands.push_back(MakeCommand(Command::Activate, index));
+		} else if (int32_t index; ParseValue(arg, "--close", index)) {
+			commands.push_back(MakeCommand(Command::Close, index));
+		} else if (int32_t index; ParseValue(arg, "--reload", index)) {
+			commands.push_back(MakeCommand(Command::Reload, index));
+		} else if (float zoom; ParseValue(arg, "--zoom", zoom)) {
+			Request request = MakeCommand(Command::SetZoom);
+			request.zoom = zoom;
+			commands.push_back(request);
+		} else {
+			// Unknown option, it might be a file that happens to start with "--"
+			paths.push_back(argv[i]);
+		}
+	}
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "protocol.h"
+
+// Command line options. Anything that isn't a recognised option is treated as a file to open.
+struct Options {
+	Options(int argc, char** argv);
+	std::vector<std::string> paths;
+	bool benchOpen = false; // --bench-open: measure time to first pixel, print json and exit
+	bool benchIpc = false;  // --bench-ipc: with --bench-open, send the files through MessageClient
+	bool resident = false;  // --resident: keep running in the background when the window is closed
+	bool wait = false;      // --wait: wait for the running instance to load the files and print the results
+	std::vector<std::string> watchDirs; // --watch-dir=DIR: open images as they are written into DIR
+	std::string exportPath;   // --export=PATH: convert the file to PATH without a window, - for stdout
+	std::string exportFormat; // --export-format=png|qoi|raw: otherwise chosen from the extension of PATH
+	std::vector<Request> commands; // --status, --activate=N, --close[=N], --reload[=N], --zoom=X
+};
@@ -0,0 +1,152 @@
+#include "overlay.h"
+#include <cmath>
+#include <algorithm>
+#include <array>
+
+constexpr int CHECKER_SIZE = 8; // Same as Compositor
+constexpr uint32_t CHECKER_LIGHT = 0xFFFFFFFF;
+constexpr uint32_t CHECKER_DARK = 0xFFBFBFBF;
+constexpr uint32_t LINE_PIXEL = 0xFFFFFFFF; // Tinted by the colour and alpha mod
+
+OverlayRenderer::OverlayRenderer(SDL_Renderer* renderer) :
+	renderer(renderer) {
+}
+
+OverlayRenderer::~OverlayRenderer() {
+	for (SDL_Texture* tex : { checkerboard, columns.texture, rows.texture }) {
+		if (tex) {
+			SDL_DestroyTexture(tex);
+		}
+	}
+}
+
+void OverlayRenderer::DrawCheckerboard(const SDL_Rect& rc, SDL_Point origin, SDL_Point clientSize) {
+	SDL_Rect window = { 0, 0, clientSize.x, clientSize.y };
+	SDL_Rect clipped{};
+	if (!SDL_IntersectRect(&rc, &window, &clipped))
+		return;
+
+	// Two squares of slack on each axis for the phase below
+	SDL_Point size = { clientSize.x / CHECKER_SIZE + 3, clientSize.y / CHECKER_SIZE + 3 };
+	if (!checkerboard || size.x != checkerboardSize.x || size.y != checkerboardSize.y) {
+		if (checkerboard) {
+			SDL_DestroyTexture(checkerboard);
+		}
+		checkerboard = SDL_CreateTexture(
+			renderer,
+			SDL_PixelFormatEnum::SDL_PIXELFORMAT_ABGR8888,
+			SDL_TEXTUREACCESS_STATIC,
+			size.x,
+			size.y);
+		checkerboardSize = size;
+		if (!checkerboard)
+			return;
+		std::vector<uint32_t> pixels((size_t)size.x * size.y);
+		for (int y = 0; y < size.y; y++) {
+			for (int x = 0; x < size.x; x++) {
+				pixels[(size_t)y * size.x + x] = (x + y) % 2 ? CHECKER_LIGHT : CHECKER_DARK;
+			}
+		}
+		SDL_UpdateTexture(checkerboard, nullptr, pixels.data(), size.x * 4);
+		SDL_SetTextureScaleMode(checkerboard, SDL_ScaleModeNearest);
+		SDL_SetTextureBlendMode(checkerboard, SDL_BLENDMODE_NONE);
+	}
+
+	// Stretched so that each texel covers one square, with texture coordinates
+	// that cut the squares at the edges of the rect
+	float left = (float)clipped.x;
+	float top = (float)clipped.y;
+	float right = (float)(clipped.x + clipped.w);
+	float bottom = (float)(clipped.y + clipped.h);
+	// Shifted by whole pairs of squares so that a dark square starts at origin
+	constexpr int PERIOD = 2 * CHECKER_SIZE;
+	float phaseX = (float)(PERIOD - (origin.x % PERIOD + PERIOD) % PERIOD);
+	float phaseY = (float)(PERIOD - (origin.y % PERIOD + PERIOD) % PERIOD);
+	float du = 1.0f / (CHECKER_SIZE * size.x);
+	float dv = 1.0f / (CHECKER_SIZE * size.y);
+	float u0 = (left + phaseX) * du;
+	float v0 = (top + phaseY) * dv;
+	float u1 = (right + phaseX) * du;
+	float v1 = (bottom + phaseY) * dv;
+	SDL_Colour white = { 255, 255, 255, 255 };
+	std::array<SDL_Vertex, 4> vertices = { {
+		{ { left, top }, white, { u0, v0 } },
+		{ { right, top }, white, { u1, v0 } },
+		{ { left, bottom }, white, { u0, v1 } },
+		{ { right, bottom }, white, { u1, v1 } },
+	} };
+	static const int INDICES[] = { 0, 1, 2, 2, 1, 3 };
+	SDL_RenderGeometry(renderer, checkerboard, vertices.data(), (int)vertices.size(), INDICES, 6);
+}
+
+bool OverlayRenderer::UpdateLines(Lines& lines, bool horizontal, int length, int start, int count, float spacing) {
+	if (!lines.texture || lines.length != length) {
+		if (lines.texture) {
+			SDL_DestroyTexture(lines.texture);
+		}
+		lines.texture = SDL_CreateTexture(
+			renderer,
+			SDL_PixelFormatEnum::SDL_PIXELFORMAT_ABGR8888,
+			SDL_TEXTUREACCESS_STREAMING,
+			horizontal ? 1 : length,
+			horizontal ? length : 1);
+		lines.length = length;
+		lines.count = -1; // Force the texels to be filled
+		if (!lines.texture)
+			return false;
+		SDL_SetTextureScaleMode(lines.texture, SDL_ScaleModeNearest);
+		SDL_SetTextureBlendMode(lines.texture, SDL_BLENDMODE_BLEND);
+	}
+	if (lines.start == start && lines.count == count && lines.spacing == spacing)
+		return true;
+
+	// Only the lines inside the window are visited
+	lines.pixels.assign(length, 0);
+	int first = std::max(0, (int)std::floor(-start / spacing));
+	for (int k = first; k <= count; k++) {
+		int p = (int)std::floor(start + k * spacing);
+		if (p >= length)
+			break;
+		if (p >= 0) {
+			lines.pixels[p] = LINE_PIXEL;
+		}
+	}
+	SDL_UpdateTexture(lines.texture, nullptr, lines.pixels.data(), horizontal ? 4 : length * 4);
+	lines.start = start;
+	lines.count = count;
+	lines.spacing = spacing;
+	return true;
+}
+
+void OverlayRenderer::DrawGrid(const SDL_Rect& imageRect, float scale, SDL_Point clientSize, SDL_Colour colour) {
+	auto [cw, ch] = clientSize;
+	if (cw <= 0 || ch <= 0 || scale <= 0)
+		return;
+
+	// The last line sits just past the edge of the image
+	int left = std::max(imageRect.x, 0);
+	int right = std::min(imageRect.x + imageRect.w + 1, cw);
+	int top = std::max(imageRect.y, 0);
+	int bottom = std::min(imageRect.y + imageRect.h + 1, ch);
+	if (left >= right || top >= bottom)
+		return;
+
+	// A row of texels for the vertical lines stretched down the image, and a column of
+	// texels for the horizontal lines stretched across it
+	int countX = (int)std::lround(imageRect.w / scale);
+	int countY = (int)std::lround(imageRect.h / scale);
+	if (UpdateLines(columns, false, cw, imageRect.x, countX, scale)) {
+		SDL_SetTextureColorMod(columns.texture, colour.r, colour.g, colour.b);
+		SDL_SetTextureAlphaMod(columns.texture, colour.a);
+		SDL_Rect src = { left, 0, right - left, 1 };
+		SDL_Rect dst = { left, top, right - left, bottom - top };
+		SDL_RenderCopy(renderer, columns.texture, &src, &dst);
+	}
+	if (UpdateLines(rows, true, ch, imageRect.y, countY, scale)) {
+		SDL_SetTextureColorMod(rows.texture, colour.r, colour.g, colour.b);
+		SDL_SetTextureAlphaMod(rows.texture, colour.a);
+		SDL_Rect src = { 0, top, 1, bottom - top };
+		SDL_Rect dst = { left, top, right - left, bottom - top };
+		SDL_RenderCopy(renderer, rows.texture, &src, &dst);
+	}
+}
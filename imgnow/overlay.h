@@ -0,0 +1,36 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include "SDL.h"
+
+// Draws the checkerboard behind transparent images and the pixel grid from small cached
+// textures, so that neither needs a list of rects or lines to be built while panning.
+// The textures are only recreated when the window is resized.
+struct OverlayRenderer {
+	explicit OverlayRenderer(SDL_Renderer* renderer);
+	~OverlayRenderer();
+	OverlayRenderer(const OverlayRenderer&) = delete;
+	OverlayRenderer& operator=(const OverlayRenderer&) = delete;
+	// Fills rc with 8 pixel squares aligned to origin, so they move with the image
+	void DrawCheckerboard(const SDL_Rect& rc, SDL_Point origin, SDL_Point clientSize);
+	// Draws a line before every image pixel of imageRect and after the last one.
+	// scale is the size of an image pixel on screen.
+	void DrawGrid(const SDL_Rect& imageRect, float scale, SDL_Point clientSize, SDL_Colour colour);
+private:
+	// The position of each line along one axis of the window
+	struct Lines {
+		SDL_Texture* texture = nullptr;
+		int length = 0;
+		int start = 0;
+		int count = 0;
+		float spacing = 0;
+		std::vector<uint32_t> pixels;
+	};
+	// Returns false if the texture couldn't be created
+	bool UpdateLines(Lines& lines, bool horizontal, int length, int start, int count, float spacing);
+	SDL_Renderer* renderer;
+	SDL_Texture* checkerboard = nullptr; // One texel per square
+	SDL_Point checkerboardSize{};
+	Lines columns;
+	Lines rows;
+};
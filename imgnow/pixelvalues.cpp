@@ -0,0 +1,59 @@
+#include "pixelvalues.h"
+#include <algorithm>
+
+// Bounds memory when panning over noisy images
+constexpr size_t MAX_CACHED_LABELS = 1 << 14;
+
+std::string_view PixelLabel::GetLine(int i) const {
+	return { text + start[i], length[i] };
+}
+
+static void Split(PixelLabel& label, size_t size) {
+	auto add = [&](size_t begin, size_t end) {
+		if (label.lineCount == PixelLabel::MAX_LINES || end <= begin)
+			return;
+		label.start[label.lineCount] = (uint8_t)begin;
+		label.length[label.lineCount] = (uint8_t)(end - begin);
+		label.maxLength = std::max(label.maxLength, (int)(end - begin));
+		label.lineCount++;
+	};
+
+	std::string_view text(label.text, size);
+	if (text.size() >= 2 && text.front() == '(' && text.back() == ')') {
+		// Tuples such as (255, 128, 0) have one line per element
+		size_t begin = 1;
+		while (begin < text.size() - 1) {
+			size_t comma = text.find(',', begin);
+			size_t end = comma == std::string_view::npos ? text.size() - 1 : comma;
+			add(begin, end);
+			begin = end + 1;
+			while (begin < text.size() && text[begin] == ' ') {
+				begin++;
+			}
+		}
+	} else if (text.size() == 6 || text.size() == 8) {
+		// Hex has one line per channel
+		for (size_t i = 0; i < text.size(); i += 2) {
+			add(i, i + 2);
+		}
+	} else {
+		add(0, text.size());
+	}
+}
+
+const PixelLabel& PixelLabelCache::Get(const ColourFormatter& formatter, SDL_Colour colour) {
+	if (format != formatter.GetFormat() || alphaEnabled != formatter.alphaEnabled || labels.size() >= MAX_CACHED_LABELS) {
+		labels.clear();
+		format = formatter.GetFormat();
+		alphaEnabled = formatter.alphaEnabled;
+	}
+
+	uint32_t key = (uint32_t)colour.r | (uint32_t)colour.g << 8 | (uint32_t)colour.b << 16 | (uint32_t)colour.a << 24;
+	auto [it, inserted] = labels.try_emplace(key);
+	PixelLabel& label = it->second;
+	if (inserted) {
+		size_t size = formatter.FormatColour(colour, label.text, sizeof(label.text));
+		Split(label, size);
+	}
+	return label;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <stdint.h>
+#include <string_view>
+#include <unordered_map>
+#include "SDL.h"
+#include "colourfmt.h"
+
+// The value of a pixel split into one line per channel, for drawing inside its cell at high zoom
+struct PixelLabel {
+	static constexpr int MAX_LINES = 5; // CMYKA
+	char text[64] = {};
+	uint8_t start[MAX_LINES] = {};
+	uint8_t length[MAX_LINES] = {};
+	int lineCount = 0;
+	int maxLength = 0; // Characters in the longest line
+	std::string_view GetLine(int i) const;
+};
+
+// Formats each distinct colour once. Images usually have far fewer distinct colours
+// on screen than visible pixels, so most frames format nothing at all.
+struct PixelLabelCache {
+	// Valid until the next call
+	const PixelLabel& Get(const ColourFormatter& formatter, SDL_Colour colour);
+private:
+	std::unordered_map<uint32_t, PixelLabel> labels;
+	int format = -1; // Of the cached labels
+	bool alphaEnabled = false;
+};
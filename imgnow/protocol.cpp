@@ -0,0 +1,278 @@
+#include "protocol.h"
+#include <cstring>
+#include <algorithm>
+
+namespace {
+	struct Writer {
+		std::vector<uint8_t> data;
+		void U8(uint8_t v) {
+			data.push_back(v);
+		}
+		void U32(uint32_t v) {
+			for (int i = 0; i < 4; i++) {
+				data.push_back((v >> (8 * i)) & 0xFF);
+			}
+		}
+		void String(std::string_view s) {
+			U32((uint32_t)s.size());
+			data.insert(data.end(), s.begin(), s.end());
+		}
+	};
+
+	struct Reader {
+		const uint8_t* data;
+		size_t size;
+		size_t pos = 0;
+		bool ok = true;
+		uint8_t U8() {
+			if (pos + 1 > size) {
+				ok = false;
+				return 0;
+			}
+			return data[pos++];
+		}
+		uint32_t U32() {
+			if (pos + 4 > size) {
+				ok = false;
+				return 0;
+			}
+			uint32_t v = data[pos] | (data[pos + 1] << 8) | (data[pos + 2] << 16) | ((uint32_t)data[pos + 3] << 24);
+			pos += 4;
+			return v;
+		}
+		std::string String() {
+			uint32_t len = U32();
+			if (!ok || pos + len > size) {
+				ok = false;
+				return {};
+			}
+			std::string s((const char*)data + pos, len);
+			pos += len;
+			return s;
+		}
+	};
+}
+
+static std::vector<uint8_t> MakeFrame(const Writer& payload) {
+	Writer frame;
+	frame.data.insert(frame.data.end(), std::begin(PROTOCOL_MAGIC), std::end(PROTOCOL_MAGIC));
+	frame.U32((uint32_t)payload.data.size());
+	frame.data.insert(frame.data.end(), payload.data.begin(), payload.data.end());
+	return std::move(frame.data);
+}
+
+static uint32_t PeekU32(const RingBuffer& buffer, size_t offset) {
+	uint8_t b[4];
+	buffer.Peek(b, offset, 4);
+	return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static bool IsFrame(const RingBuffer& buffer) {
+	uint8_t magic[4];
+	buffer.Peek(magic, 0, 4);
+	return std::memcmp(magic, PROTOCOL_MAGIC, 4) == 0;
+}
+
+// Copies the next version 2 payload out of the buffer.
+// Returns false if it hasn't been completely received yet.
+static bool TakePayload(RingBuffer& buffer, std::vector<uint8_t>& payload, bool& malformed) {
+	if (buffer.Size() < 8)
+		return false;
+	uint32_t len = PeekU32(buffer, 4);
+	if (len > MAX_FRAME_SIZE) {
+		malformed = true;
+		return false;
+	}
+	if (buffer.Size() < 8 + (size_t)len)
+		return false;
+	payload.resize(len);
+	buffer.Peek(payload.data(), 8, len);
+	buffer.Discard(8 + (size_t)len);
+	return true;
+}
+
+const char* GetResultName(Result result) {
+	switch (result) {
+	case Result::Ok: return "ok";
+	case Result::Failed: return "failed";
+	case Result::Duplicate: return "duplicate";
+	case Result::Cancelled: return "cancelled";
+	case Result::Loading: return "loading";
+	default: return "unknown";
+	}
+}
+
+void RingBuffer::Write(const uint8_t* data, size_t count) {
+	if (size + count > buffer.size()) {
+		// Grow and unwrap
+		size_t capacity = std::max<size_t>(buffer.size(), 4096);
+		while (capacity < size + count) {
+			capacity *= 2;
+		}
+		std::vector<uint8_t> grown(capacity);
+		Peek(grown.data(), 0, size);
+		buffer = std::move(grown);
+		head = 0;
+	}
+
+	size_t mask = buffer.size() - 1;
+	size_t tail = (head + size) & mask;
+	size_t first = std::min(count, buffer.size() - tail);
+	std::memcpy(buffer.data() + tail, data, first);
+	std::memcpy(buffer.data(), data + first, count - first);
+	size += count;
+}
+
+void RingBuffer::Peek(uint8_t* dst, size_t offset, size_t count) const {
+	if (count == 0)
+		return;
+	size_t mask = buffer.size() - 1;
+	size_t start = (head + offset) & mask;
+	size_t first = std::min(count, buffer.size() - start);
+	std::memcpy(dst, buffer.data() + start, first);
+	std::memcpy(dst + first, buffer.data(), count - first);
+}
+
+void RingBuffer::Discard(size_t count) {
+	count = std::min(count, size);
+	size -= count;
+	head = size ? (head + count) & (buffer.size() - 1) : 0;
+}
+
+size_t RingBuffer::Size() const {
+	return size;
+}
+
+std::vector<uint8_t> EncodeRequest(const Request& request) {
+	Writer w;
+	w.U32(request.id);
+	w.U8((uint8_t)request.command);
+	switch (request.command) {
+	case Command::Open:
+		w.U32((uint32_t)request.paths.size());
+		for (const auto& path : request.paths) {
+			w.String(path);
+		}
+		break;
+	case Command::Activate:
+	case Command::Close:
+	case Command::Reload:
+		w.U32((uint32_t)request.index);
+		break;
+	case Command::SetZoom: {
+		uint32_t bits;
+		std::memcpy(&bits, &request.zoom, 4);
+		w.U32(bits);
+		break;
+	}
+	case Command::Push:
+		w.String(request.slot);
+		break;
+	default:
+		break;
+	}
+	return MakeFrame(w);
+}
+
+std::vector<uint8_t> EncodeReply(const Reply& reply) {
+	Writer w;
+	w.U32(reply.id);
+	w.U32((uint32_t)reply.entries.size());
+	for (const auto& entry : reply.entries) {
+		w.U8((uint8_t)entry.result);
+		w.String(entry.text);
+	}
+	return MakeFrame(w);
+}
+
+bool DecodeRequests(RingBuffer& buffer, std::vector<Request>& requests) {
+	std::vector<uint8_t> payload;
+	while (buffer.Size() >= 4) {
+		if (!IsFrame(buffer)) {
+			// Version 1 message
+			uint32_t len = PeekU32(buffer, 0);
+			if (len > MAX_FRAME_SIZE)
+				return false;
+			if (buffer.Size() < 4 + (size_t)len)
+				return true;
+			Request request;
+			request.legacy = true;
+			request.command = len ? Command::Open : Command::Show;
+			if (len) {
+				std::string path(len, '\0');
+				buffer.Peek((uint8_t*)path.data(), 4, len);
+				request.paths.push_back(std::move(path));
+			}
+			buffer.Discard(4 + (size_t)len);
+			requests.push_back(std::move(request));
+			continue;
+		}
+
+		bool malformed = false;
+		if (!TakePayload(buffer, payload, malformed))
+			return !malformed;
+
+		Reader r{ payload.data(), payload.size() };
+		Request request;
+		request.id = r.U32();
+		request.command = (Command)r.U8();
+		switch (request.command) {
+		case Command::Open: {
+			uint32_t count = r.U32();
+			for (uint32_t i = 0; i < count && r.ok; i++) {
+				request.paths.push_back(r.String());
+			}
+			break;
+		}
+		case Command::Activate:
+		case Command::Close:
+		case Command::Reload:
+			request.index = (int32_t)r.U32();
+			break;
+		case Command::SetZoom: {
+			uint32_t bits = r.U32();
+			std::memcpy(&request.zoom, &bits, 4);
+			break;
+		}
+		case Command::Push:
+			request.slot = r.String();
+			break;
+		case Command::Status:
+		case Command::Show:
+			break;
+		default:
+			return false;
+		}
+		if (!r.ok)
+			return false;
+		requests.push_back(std::move(request));
+	}
+	return true;
+}
+
+bool DecodeReplies(RingBuffer& buffer, std::vector<Reply>& replies) {
+	std::vector<uint8_t> payload;
+	while (buffer.Size() >= 4) {
+		if (!IsFrame(buffer))
+			return false;
+
+		bool malformed = false;
+		if (!TakePayload(buffer, payload, malformed))
+			return !malformed;
+
+		Reader r{ payload.data(), payload.size() };
+		Reply reply;
+		reply.id = r.U32();
+		uint32_t count = r.U32();
+		for (uint32_t i = 0; i < count && r.ok; i++) {
+			ReplyEntry entry;
+			entry.result = (Result)r.U8();
+			entry.text = r.String();
+			reply.entries.push_back(std::move(entry));
+		}
+		if (!r.ok)
+			return false;
+		replies.push_back(std::move(reply));
+	}
+	return true;
+}
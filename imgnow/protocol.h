@@ -0,0 +1,81 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// Wire format shared by MessageServer and MessageClient. All integers are little endian.
+//
+// Version 1 messages are a u32 length followed by a path to open. They are never acknowledged.
+//
+// Version 2 frames are PROTOCOL_MAGIC followed by a u32 payload length.
+// A request payload is a u32 request id, a u8 Command and the command's arguments.
+// A reply payload is the u32 request id followed by a u32 entry count and the entries,
+// where each entry is a u8 Result and a string. Strings are a u32 length followed by the bytes.
+//
+// Open:     u32 path count, paths. Replies once every path has finished loading
+//           with one entry per path holding the full path or the error.
+// Activate: i32 index.
+// Close:    i32 index, or CURRENT_IMAGE.
+// Reload:   i32 index, or CURRENT_IMAGE.
+// SetZoom:  f32 scale, applied to the visible image.
+// Status:   Replies with one "index\tpath\twidth\theight\tactive" entry per image.
+// Show:     Shows the window if it is hidden.
+// Push:     string slot. A memfd holding a SharedImageHeader and pixels (see shm.h) is passed
+//           alongside the frame as SCM_RIGHTS ancillary data. Only supported on Linux.
+
+constexpr uint8_t PROTOCOL_MAGIC[4] = { 'I', 'M', 'N', '2' };
+constexpr uint32_t MAX_FRAME_SIZE = 64 * 1024 * 1024;
+constexpr int32_t CURRENT_IMAGE = -1;
+
+enum class Command : uint8_t {
+	Open = 1, Activate, Close, Reload, SetZoom, Status, Show, Push,
+};
+
+enum class Result : uint8_t {
+	Ok, Failed, Duplicate, Cancelled, Loading,
+};
+
+const char* GetResultName(Result result);
+
+struct Request {
+	uint64_t client = 0; // Filled in by the server
+	bool legacy = false; // Version 1 message, don't reply
+	uint32_t id = 0;
+	Command command = Command::Open;
+	std::vector<std::string> paths;
+	int32_t index = CURRENT_IMAGE;
+	float zoom = 1;
+	std::string slot;
+	int fd = -1; // Push only, owned by whoever handles the request
+};
+
+struct ReplyEntry {
+	Result result = Result::Ok;
+	std::string text;
+};
+
+struct Reply {
+	uint32_t id = 0;
+	std::vector<ReplyEntry> entries;
+};
+
+// Growable circular byte buffer so that consuming a message doesn't
+// have to move the rest of the buffered data to the front.
+struct RingBuffer {
+	void Write(const uint8_t* data, size_t size);
+	void Peek(uint8_t* dst, size_t offset, size_t size) const;
+	void Discard(size_t size);
+	size_t Size() const;
+private:
+	std::vector<uint8_t> buffer; // Capacity is always a power of two
+	size_t head = 0;
+	size_t size = 0;
+};
+
+std::vector<uint8_t> EncodeRequest(const Request& request);
+std::vector<uint8_t> EncodeReply(const Reply& reply);
+
+// Consume every complete frame in the buffer. Returns false if the stream is malformed.
+bool DecodeRequests(RingBuffer& buffer, std::vector<Request>& requests);
+bool DecodeReplies(RingBuffer& buffer, std::vector<Reply>& replies);
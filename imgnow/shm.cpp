@@ -0,0 +1,183 @@
+#include "shm.h"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <stdexcept>
+#include <new>
+
+constexpr uint64_t PIXEL_OFFSET = 64; // Keep rows aligned for SIMD
+constexpr uint64_t MAX_SHARED_PIXELS = 1 << 28; // 1 GB of RGBA8, larger headers are rejected before anything is allocated
+constexpr int REQUIRED_SEALS = F_SEAL_SHRINK | F_SEAL_WRITE; // Before the pixels are shown without copying
+
+static size_t GetBytesPerPixel(SharedPixelFormat format) {
+	return format == SharedPixelFormat::Rgba32F ? 16 : 4;
+}
+
+SharedImage::SharedImage(int width, int height, SharedPixelFormat format) {
+	fd = memfd_create("imgnow-shared-image", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd == -1)
+		throw std::runtime_error(std::strerror(errno));
+
+	SharedImageHeader header{};
+	std::memcpy(header.magic, SHARED_IMAGE_MAGIC, 4);
+	header.version = SHARED_IMAGE_VERSION;
+	header.width = (uint32_t)width;
+	header.height = (uint32_t)height;
+	header.format = format;
+	header.stride = (uint32_t)(width * GetBytesPerPixel(format));
+	header.offset = PIXEL_OFFSET;
+
+	size = (size_t)(PIXEL_OFFSET + (uint64_t)header.stride * height);
+	if (ftruncate(fd, (off_t)size) == -1) {
+		close(fd);
+		throw std::runtime_error(std::strerror(errno));
+	}
+	void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		close(fd);
+		throw std::runtime_error(std::strerror(errno));
+	}
+	mapping = (uint8_t*)p;
+	stride = header.stride;
+	std::memcpy(mapping, &header, sizeof(header));
+}
+
+SharedImage::~SharedImage() {
+	if (mapping) {
+		munmap(mapping, size);
+	}
+	close(fd);
+}
+
+uint8_t* SharedImage::GetPixels() const {
+	return mapping ? mapping + PIXEL_OFFSET : nullptr;
+}
+
+int SharedImage::GetStride() const {
+	return (int)stride;
+}
+
+void SharedImage::Seal() {
+	// Writes can't be sealed while a writable mapping exists
+	if (mapping) {
+		munmap(mapping, size);
+		mapping = nullptr;
+	}
+	if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1)
+		throw std::runtime_error(std::strerror(errno));
+}
+
+int SharedImage::GetFd() const {
+	return fd;
+}
+
+static uint8_t FloatToByte(float f) {
+	if (!(f > 0.0f)) // Also catches NaN
+		return 0;
+	if (f >= 1.0f)
+		return 255;
+	return (uint8_t)(f * 255.0f + 0.5f);
+}
+
+// Reads with pread rather than through a mapping, which would fault if the file shrank meanwhile
+static bool ReadAt(int fd, void* dst, size_t size, uint64_t offset) {
+	uint8_t* p = (uint8_t*)dst;
+	while (size > 0) {
+		ssize_t n = pread(fd, p, size, (off_t)offset);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		size -= (size_t)n;
+		offset += (uint64_t)n;
+	}
+	return true;
+}
+
+static void ConvertRow(const uint8_t* src, uint8_t* dst, int width, SharedPixelFormat format) {
+	if (format == SharedPixelFormat::Rgba8) {
+		std::memcpy(dst, src, (size_t)width * 4);
+		return;
+	}
+	for (int i = 0; i < width * 4; i++) {
+		float f;
+		std::memcpy(&f, src + i * 4, 4);
+		dst[i] = FloatToByte(f);
+	}
+}
+
+Image MapSharedImage(int fd) {
+	struct stat st {};
+	if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(SharedImageHeader))
+		return Image::FromError("shared memory is too small");
+	size_t size = (size_t)st.st_size;
+	int seals = fcntl(fd, F_GET_SEALS);
+	bool sealed = seals != -1 && (seals & REQUIRED_SEALS) == REQUIRED_SEALS;
+
+	SharedImageHeader header;
+	if (!ReadAt(fd, &header, sizeof(header), 0))
+		return Image::FromError("shared memory is too small");
+	if (std::memcmp(header.magic, SHARED_IMAGE_MAGIC, 4) != 0 || header.version != SHARED_IMAGE_VERSION)
+		return Image::FromError("invalid shared image header");
+	if (header.format != SharedPixelFormat::Rgba8 && header.format != SharedPixelFormat::Rgba32F)
+		return Image::FromError("unsupported shared image format");
+	if (header.width == 0 || header.height == 0 || header.width > 65536 || header.height > 65536)
+		return Image::FromError("invalid shared image dimensions");
+	uint64_t rowBytes = (uint64_t)header.width * GetBytesPerPixel(header.format);
+	if (header.stride < rowBytes || header.offset + (uint64_t)header.stride * header.height > size)
+		return Image::FromError("shared image is larger than the shared memory");
+
+	// The stride check above also bounds the copy below by the size of the shared memory
+	if ((uint64_t)header.width * header.height > MAX_SHARED_PIXELS)
+		return Image::FromError("shared image is too large");
+
+	int w = (int)header.width;
+	int h = (int)header.height;
+	std::shared_ptr<uint8_t> mapping;
+	if (sealed) {
+		// The file can no longer shrink or change, so it is safe to map
+		void* p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED)
+			return Image::FromError(std::strerror(errno));
+		mapping.reset((uint8_t*)p, [size](uint8_t* p) { munmap(p, size); });
+		if (header.format == SharedPixelFormat::Rgba8 && header.stride == rowBytes) {
+			// Zero copy, the image keeps the mapping alive
+			return Image(w, h, 4, std::shared_ptr<uint8_t>(mapping, mapping.get() + header.offset));
+		}
+	}
+
+	std::shared_ptr<uint8_t> data;
+	try {
+		data.reset(new uint8_t[(size_t)w * h * 4], std::default_delete<uint8_t[]>());
+	} catch (std::bad_alloc&) {
+		return Image::FromError("not enough memory for the shared image");
+	}
+	if (mapping) {
+		for (int y = 0; y < h; y++) {
+			ConvertRow(mapping.get() + header.offset + (size_t)y * header.stride, data.get() + (size_t)y * w * 4, w, header.format);
+		}
+		return Image(w, h, 4, std::move(data));
+	}
+	if (header.format == SharedPixelFormat::Rgba8 && header.stride == rowBytes) {
+		if (!ReadAt(fd, data.get(), (size_t)rowBytes * h, header.offset))
+			return Image::FromError("shared memory shrank while it was read");
+		return Image(w, h, 4, std::move(data));
+	}
+	std::vector<uint8_t> row(rowBytes);
+	for (int y = 0; y < h; y++) {
+		if (!ReadAt(fd, row.data(), row.size(), header.offset + (uint64_t)y * header.stride))
+			return Image::FromError("shared memory shrank while it was read");
+		ConvertRow(row.data(), data.get() + (size_t)y * w * 4, w, header.format);
+	}
+	return Image(w, h, 4, std::move(data));
+}
+#endif
@@ -0,0 +1,54 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include "image.h"
+
+// Shared memory images let another process show raw pixels without encoding them to a file.
+// The client writes a SharedImageHeader followed by the pixels into a memfd and passes the
+// descriptor to the running instance with MessageClient::Push. Pushing to the same slot again
+// replaces the displayed image in place.
+//
+// The pixels are only shown straight from the shared memory if the memfd is sealed with at least
+// F_SEAL_SHRINK and F_SEAL_WRITE, since the client could otherwise shrink the file or change the
+// pixels while they are in use. Anything else is copied when it is pushed.
+
+constexpr uint8_t SHARED_IMAGE_MAGIC[4] = { 'I', 'M', 'S', 'H' };
+constexpr uint32_t SHARED_IMAGE_VERSION = 1;
+
+enum class SharedPixelFormat : uint32_t {
+	Rgba8 = 0,   // 4 bytes per pixel, shown without copying
+	Rgba32F = 1, // 16 bytes per pixel, clamped to [0, 1] and converted to 8 bits
+};
+
+struct SharedImageHeader {
+	uint8_t magic[4];
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	SharedPixelFormat format;
+	uint32_t stride; // Bytes per row
+	uint64_t offset; // Offset of the first row from the start of the file
+};
+
+#ifdef __linux__
+// Client side helper which creates and maps a memfd with a header.
+struct SharedImage {
+	SharedImage(int width, int height, SharedPixelFormat format);
+	~SharedImage();
+	SharedImage(const SharedImage&) = delete;
+	SharedImage& operator=(const SharedImage&) = delete;
+	uint8_t* GetPixels() const; // Null once sealed
+	int GetStride() const;
+	int GetFd() const;
+	void Seal(); // Makes the memfd read only so that pushing it doesn't copy the pixels. Unmaps them.
+private:
+	int fd = -1;
+	uint8_t* mapping = nullptr;
+	size_t size = 0;
+	uint32_t stride = 0;
+};
+
+// Server side. Maps a sealed descriptor into an image, otherwise copies it. Does not take ownership of fd.
+Image MapSharedImage(int fd);
+#endif
@@ -0,0 +1,66 @@
+#pragma once
+#include <stdint.h>
+#include <deque>
+#include <vector>
+#include <optional>
+
+// Stores elements at fixed addresses and hands out handles to them. A handle packs the slot index
+// with the generation of the slot, so a handle to a removed element is never mistaken for a
+// later element in the same slot. Zero is never a valid handle.
+template <typename T>
+struct SlotMap {
+	uint64_t Insert(T value) {
+		uint32_t index;
+		if (!freeSlots.empty()) {
+			index = freeSlots.back();
+			freeSlots.pop_back();
+		} else {
+			index = (uint32_t)slots.size();
+			slots.emplace_back(); // Never moves the other slots
+		}
+		Slot& slot = slots[index];
+		slot.value.emplace(std::move(value));
+		count++;
+		return (uint64_t)slot.generation << 32 | index;
+	}
+
+	// Returns false if the handle is stale
+	bool Remove(uint64_t handle) {
+		if (!Get(handle))
+			return false;
+		Slot& slot = slots[(uint32_t)handle];
+		slot.value.reset();
+		if (++slot.generation == 0) {
+			slot.generation = 1;
+		}
+		freeSlots.push_back((uint32_t)handle);
+		count--;
+		return true;
+	}
+
+	T* Get(uint64_t handle) {
+		uint32_t index = (uint32_t)handle;
+		if (index >= slots.size() || slots[index].generation != handle >> 32 || !slots[index].value)
+			return nullptr;
+		return &*slots[index].value;
+	}
+
+	const T* Get(uint64_t handle) const {
+		uint32_t index = (uint32_t)handle;
+		if (index >= slots.size() || slots[index].generation != handle >> 32 || !slots[index].value)
+			return nullptr;
+		return &*slots[index].value;
+	}
+
+	size_t Size() const {
+		return count;
+	}
+private:
+	struct Slot {
+		std::optional<T> value;
+		uint32_t generation = 1;
+	};
+	std::deque<Slot> slots;
+	std::vector<uint32_t> freeSlots;
+	size_t count = 0;
+};
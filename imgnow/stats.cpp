@@ -0,0 +1,371 @@
+#include "stats.h"
+#include <cmath>
+#include <cstring> // memcpy
+#include <algorithm>
+#include <atomic>
+#include <bit>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMGNOW_SSE2
+#include <emmintrin.h>
+#endif
+
+constexpr int TILE_SIZE = 128;
+constexpr int HLL_BITS = 10;
+constexpr int HLL_REGISTERS = 1 << HLL_BITS; // About 3% standard error
+constexpr int HISTOGRAM_BINS = 4 * 256;
+constexpr uint64_t EXACT_UNIQUE_LIMIT = 1 << 18; // Rects up to this size have their colours counted exactly
+
+// So that a tile's histogram fits in 16 bits
+static_assert(TILE_SIZE * TILE_SIZE <= 65535);
+
+using Histogram = std::array<std::array<uint32_t, 256>, 4>;
+static_assert(sizeof(Histogram) == HISTOGRAM_BINS * sizeof(uint32_t));
+
+struct StatsEngine::Tiles {
+	uint64_t key = 0;
+	int width = 0;
+	int height = 0;
+	int columns = 0;
+	int rows = 0;
+	std::vector<uint16_t> histograms; // HISTOGRAM_BINS per tile
+	std::vector<uint8_t> sketches; // HLL_REGISTERS per tile
+	std::atomic<bool> cancelled = false; // Replaced by the tiles of another image
+};
+
+// Finalizer of MurmurHash3, which spreads every input bit over the whole hash
+static uint32_t Mix(uint32_t h) {
+	h ^= h >> 16;
+	h *= 0x85EBCA6B;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35;
+	h ^= h >> 16;
+	return h;
+}
+
+#ifdef IMGNOW_SSE2
+// SSE2 has no 32 bit multiply, so the even and odd lanes are multiplied as 64 bit values
+static __m128i MulLo32(__m128i a, __m128i b) {
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(
+		_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+		_mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static __m128i Mix4(__m128i h) {
+	h = _mm_xor_si128(h, _mm_srli_epi32(h, 16));
+	h = MulLo32(h, _mm_set1_epi32((int)0x85EBCA6B));
+	h = _mm_xor_si128(h, _mm_srli_epi32(h, 13));
+	h = MulLo32(h, _mm_set1_epi32((int)0xC2B2AE35));
+	h = _mm_xor_si128(h, _mm_srli_epi32(h, 16));
+	return h;
+}
+#endif
+
+static void AddHash(uint8_t* sketch, uint32_t h) {
+	// The top bits pick a register, which keeps the longest run of leading zeros in the rest
+	uint32_t index = h >> (32 - HLL_BITS);
+	uint32_t rest = (h << HLL_BITS) | (1u << (HLL_BITS - 1));
+	uint8_t rank = (uint8_t)(std::countl_zero(rest) + 1);
+	sketch[index] = std::max(sketch[index], rank);
+}
+
+// Adds the pixels of rc to the histogram, and to the sketch if it isn't null
+static void Scan(const uint8_t* pixels, int width, const SDL_Rect& rc, Histogram& histogram, uint8_t* sketch) {
+	for (int y = rc.y; y < rc.y + rc.h; y++) {
+		const uint8_t* row = pixels + ((size_t)y * width + rc.x) * 4;
+		for (int x = 0; x < rc.w; x++) {
+			const uint8_t* p = row + x * 4;
+			histogram[0][p[0]]++;
+			histogram[1][p[1]]++;
+			histogram[2][p[2]]++;
+			histogram[3][p[3]]++;
+		}
+		if (!sketch)
+			continue;
+
+		int x = 0;
+#ifdef IMGNOW_SSE2
+		alignas(16) uint32_t hashes[4];
+		for (; x + 4 <= rc.w; x += 4) {
+			_mm_store_si128((__m128i*)hashes, Mix4(_mm_loadu_si128((const __m128i*)(row + x * 4))));
+			for (uint32_t h : hashes) {
+				AddHash(sketch, h);
+			}
+		}
+#endif
+		for (; x < rc.w; x++) {
+			uint32_t p;
+			std::memcpy(&p, row + x * 4, 4);
+			AddHash(sketch, Mix(p));
+		}
+	}
+}
+
+static SDL_Rect GetTileRect(int width, int height, int tx, int ty) {
+	int x = tx * TILE_SIZE;
+	int y = ty * TILE_SIZE;
+	return { x, y, std::min(TILE_SIZE, width - x), std::min(TILE_SIZE, height - y) };
+}
+
+static void AddTile(Histogram& histogram, const uint16_t* tile) {
+	uint32_t* dst = histogram[0].data();
+	int i = 0;
+#ifdef IMGNOW_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	for (; i < HISTOGRAM_BINS; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(tile + i));
+		__m128i lo = _mm_add_epi32(_mm_loadu_si128((const __m128i*)(dst + i)), _mm_unpacklo_epi16(v, zero));
+		__m128i hi = _mm_add_epi32(_mm_loadu_si128((const __m128i*)(dst + i + 4)), _mm_unpackhi_epi16(v, zero));
+		_mm_storeu_si128((__m128i*)(dst + i), lo);
+		_mm_storeu_si128((__m128i*)(dst + i + 4), hi);
+	}
+#endif
+	for (; i < HISTOGRAM_BINS; i++) {
+		dst[i] += tile[i];
+	}
+}
+
+static void MergeSketch(uint8_t* dst, const uint8_t* src) {
+	int i = 0;
+#ifdef IMGNOW_SSE2
+	for (; i < HLL_REGISTERS; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i*)(dst + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(src + i));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_max_epu8(a, b));
+	}
+#endif
+	for (; i < HLL_REGISTERS; i++) {
+		dst[i] = std::max(dst[i], src[i]);
+	}
+}
+
+static uint64_t EstimateUnique(const uint8_t* sketch) {
+	double sum = 0;
+	int zeros = 0;
+	for (int i = 0; i < HLL_REGISTERS; i++) {
+		sum += std::ldexp(1.0, -sketch[i]);
+		zeros += sketch[i] == 0;
+	}
+	constexpr double m = HLL_REGISTERS;
+	constexpr double hashRange = 4294967296.0;
+	double e = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+	if (e <= 2.5 * m && zeros) {
+		// Linear counting is more accurate for small counts
+		e = m * std::log(m / zeros);
+	} else if (e > hashRange / 30) {
+		// Correct for 32 bit hash collisions
+		e = -hashRange * std::log(1 - e / hashRange);
+	}
+	return (uint64_t)std::llround(e);
+}
+
+static uint64_t CountUnique(const uint8_t* pixels, int width, const SDL_Rect& rc) {
+	std::vector<uint32_t> colours((size_t)rc.w * rc.h);
+	for (int y = 0; y < rc.h; y++) {
+		std::memcpy(colours.data() + (size_t)y * rc.w, pixels + ((size_t)(rc.y + y) * width + rc.x) * 4, (size_t)rc.w * 4);
+	}
+	std::sort(colours.begin(), colours.end());
+	return (uint64_t)(std::unique(colours.begin(), colours.end()) - colours.begin());
+}
+
+void StatsEngine::BuildTileRow(Tiles& tiles, const uint8_t* pixels, int ty) {
+	for (int tx = 0; tx < tiles.columns; tx++) {
+		if (tiles.cancelled)
+			return;
+		size_t index = (size_t)ty * tiles.columns + tx;
+		Histogram histogram{};
+		Scan(pixels, tiles.width, GetTileRect(tiles.width, tiles.height, tx, ty), histogram, &tiles.sketches[index * HLL_REGISTERS]);
+		uint16_t* dst = &tiles.histograms[index * HISTOGRAM_BINS];
+		const uint32_t* src = histogram[0].data();
+		for (int i = 0; i < HISTOGRAM_BINS; i++) {
+			dst[i] = (uint16_t)src[i];
+		}
+	}
+}
+
+PixelStats StatsEngine::Compute(const Job& job, const Tiles* tiles) {
+	PixelStats stats;
+	const SDL_Rect& rc = job.rect;
+	const uint8_t* pixels = job.pixels.get();
+	stats.key = job.key;
+	stats.rect = rc;
+	stats.pixelCount = (uint64_t)rc.w * rc.h;
+	Histogram& histogram = stats.histogram;
+
+	// Whole tiles inside the rect, including partial tiles along the image's edges
+	int tx0 = (rc.x + TILE_SIZE - 1) / TILE_SIZE;
+	int ty0 = (rc.y + TILE_SIZE - 1) / TILE_SIZE;
+	int tx1 = 0;
+	int ty1 = 0;
+	if (tiles) {
+		tx1 = rc.x + rc.w == job.width ? tiles->columns : (rc.x + rc.w) / TILE_SIZE;
+		ty1 = rc.y + rc.h == job.height ? tiles->rows : (rc.y + rc.h) / TILE_SIZE;
+	}
+
+	stats.uniqueExact = stats.pixelCount <= EXACT_UNIQUE_LIMIT;
+	std::array<uint8_t, HLL_REGISTERS> sketch{};
+	uint8_t* sketchPtr = stats.uniqueExact ? nullptr : sketch.data();
+	if (tiles && tx1 > tx0 && ty1 > ty0 && !stats.uniqueExact) {
+		for (int ty = ty0; ty < ty1; ty++) {
+			for (int tx = tx0; tx < tx1; tx++) {
+				size_t index = (size_t)ty * tiles->columns + tx;
+				AddTile(histogram, &tiles->histograms[index * HISTOGRAM_BINS]);
+				MergeSketch(sketch.data(), &tiles->sketches[index * HLL_REGISTERS]);
+			}
+		}
+
+		// Strips along the edges of the rect that only partly cover tiles
+		int x0 = tx0 * TILE_SIZE;
+		int y0 = ty0 * TILE_SIZE;
+		int x1 = std::min(tx1 * TILE_SIZE, job.width);
+		int y1 = std::min(ty1 * TILE_SIZE, job.height);
+		Scan(pixels, job.width, { rc.x, rc.y, rc.w, y0 - rc.y }, histogram, sketchPtr);
+		Scan(pixels, job.width, { rc.x, y1, rc.w, rc.y + rc.h - y1 }, histogram, sketchPtr);
+		Scan(pixels, job.width, { rc.x, y0, x0 - rc.x, y1 - y0 }, histogram, sketchPtr);
+		Scan(pixels, job.width, { x1, y0, rc.x + rc.w - x1, y1 - y0 }, histogram, sketchPtr);
+	} else {
+		Scan(pixels, job.width, rc, histogram, sketchPtr);
+	}
+
+	stats.uniqueColours = stats.uniqueExact
+		? CountUnique(pixels, job.width, rc)
+		: EstimateUnique(sketch.data());
+	stats.transparentCount = histogram[3][0];
+
+	if (stats.pixelCount == 0)
+		return stats;
+	for (int c = 0; c < 4; c++) {
+		ChannelStats& ch = stats.channels[c];
+		ch.min = 255;
+		ch.max = 0;
+		double sum = 0;
+		double sumSquares = 0;
+		for (int v = 0; v < 256; v++) {
+			uint32_t n = histogram[c][v];
+			if (n) {
+				ch.min = std::min(ch.min, v);
+				ch.max = std::max(ch.max, v);
+				sum += (double)n * v;
+				sumSquares += (double)n * v * v;
+			}
+		}
+		ch.mean = sum / stats.pixelCount;
+		ch.stddev = std::sqrt(std::max(0.0, sumSquares / stats.pixelCount - ch.mean * ch.mean));
+	}
+	return stats;
+}
+
+StatsEngine::StatsEngine(std::shared_ptr<ThreadPool> pool) :
+	pool(std::move(pool)) {
+}
+
+void StatsEngine::Request(uint64_t key, int width, int height, std::shared_ptr<const uint8_t> pixels, SDL_Rect rect) {
+	SDL_Rect bounds = { 0, 0, width, height };
+	SDL_Rect clipped{};
+	if (!SDL_IntersectRect(&rect, &bounds, &clipped)) {
+		clipped = {};
+	}
+
+	// Already computed or being computed
+	if (last && last->key == key && SDL_RectEquals(&last->rect, &clipped)) {
+		pending.reset();
+		return;
+	}
+	if (pending && pending->key == key && SDL_RectEquals(&pending->rect, &clipped))
+		return;
+
+	// Tiles are only worth building when a rect can be too big to scan quickly
+	if ((uint64_t)width * height > EXACT_UNIQUE_LIMIT && (!tiles || tiles->key != key)) {
+		if (tiles) {
+			tiles->cancelled = true;
+		}
+		tiles = std::make_shared<Tiles>();
+		tiles->key = key;
+		tiles->width = width;
+		tiles->height = height;
+		tiles->columns = (width + TILE_SIZE - 1) / TILE_SIZE;
+		tiles->rows = (height + TILE_SIZE - 1) / TILE_SIZE;
+		size_t count = (size_t)tiles->columns * tiles->rows;
+		tiles->histograms.resize(count * HISTOGRAM_BINS);
+		tiles->sketches.resize(count * HLL_REGISTERS);
+		tileJobs.clear();
+		for (int ty = 0; ty < tiles->rows; ty++) {
+			tileJobs.push_back(pool->Submit([t = tiles, pixels, ty] {
+				BuildTileRow(*t, pixels.get(), ty);
+				}));
+		}
+	} else if ((uint64_t)width * height <= EXACT_UNIQUE_LIMIT && tiles) {
+		tiles->cancelled = true;
+		tiles.reset();
+		tileJobs.clear();
+	}
+
+	pending = Job{ key, width, height, std::move(pixels), clipped };
+	Update();
+}
+
+void StatsEngine::Update() {
+	if (running.valid() && running.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+		try {
+			result = running.get();
+			sequence++;
+		} catch (std::future_error&) {
+			// Discarded by ThreadPool::Clear
+			last.reset();
+		}
+	}
+	if (running.valid() || !pending)
+		return;
+
+	// Wait until every tile has been built
+	bool tilesFailed = false;
+	for (auto& job : tileJobs) {
+		if (job.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			return;
+	}
+	for (auto& job : tileJobs) {
+		try {
+			job.get();
+		} catch (std::future_error&) {
+			tilesFailed = true;
+		}
+	}
+	tileJobs.clear();
+	if (tilesFailed) {
+		// Scan every pixel instead
+		tiles.reset();
+	}
+
+	last = pending;
+	running = pool->Submit([job = std::move(*pending), t = tiles] {
+		return Compute(job, t.get());
+		});
+	pending.reset();
+}
+
+const PixelStats* StatsEngine::Get() const {
+	return result ? &*result : nullptr;
+}
+
+uint64_t StatsEngine::GetSequence() const {
+	return sequence;
+}
+
+bool StatsEngine::Busy() const {
+	return running.valid() || pending.has_value();
+}
+
+void StatsEngine::Clear() {
+	if (tiles) {
+		tiles->cancelled = true;
+	}
+	tiles.reset();
+	tileJobs.clear();
+	pending.reset();
+	last.reset();
+	running = {};
+	result.reset();
+	sequence++;
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <stdint.h>
+#include <array>
+#include <vector>
+#include <memory>
+#include <future>
+#include <optional>
+#include "SDL.h"
+#include "threadpool.h"
+
+struct ChannelStats {
+	int min = 0;
+	int max = 0;
+	double mean = 0;
+	double stddev = 0;
+};
+
+// Statistics of a rect of RGBA8 pixels
+struct PixelStats {
+	uint64_t key = 0; // Of the request
+	SDL_Rect rect{}; // In image pixels
+	uint64_t pixelCount = 0;
+	std::array<std::array<uint32_t, 256>, 4> histogram{}; // Red, green, blue, alpha
+	std::array<ChannelStats, 4> channels{};
+	uint64_t transparentCount = 0; // Alpha 0
+	uint64_t uniqueColours = 0;
+	bool uniqueExact = false; // Otherwise a HyperLogLog estimate, within a few percent
+};
+
+// Computes PixelStats for rects of an image on a thread pool, fast enough to follow a selection
+// while it is dragged. The image is split into tiles whose histograms and unique colour sketches
+// are computed once in parallel. A rect then only needs its whole tiles merged and the pixels
+// along its edges scanned. Only the latest request is kept while a computation is running.
+struct StatsEngine {
+	explicit StatsEngine(std::shared_ptr<ThreadPool> pool);
+	StatsEngine(const StatsEngine&) = delete;
+	StatsEngine& operator=(const StatsEngine&) = delete;
+	// key identifies the pixels, which are kept alive until the computation finishes
+	void Request(uint64_t key, int width, int height, std::shared_ptr<const uint8_t> pixels, SDL_Rect rect);
+	void Update(); // Call every frame to collect finished work and start pending work
+	const PixelStats* Get() const; // The latest result, null if none has finished
+	uint64_t GetSequence() const; // Incremented whenever Get changes
+	bool Busy() const;
+	void Clear(); // Forget the image and any results
+private:
+	struct Tiles;
+	struct Job {
+		uint64_t key = 0;
+		int width = 0;
+		int height = 0;
+		std::shared_ptr<const uint8_t> pixels;
+		SDL_Rect rect{};
+	};
+	static void BuildTileRow(Tiles& tiles, const uint8_t* pixels, int ty);
+	static PixelStats Compute(const Job& job, const Tiles* tiles); // tiles may be null
+	std::shared_ptr<ThreadPool> pool;
+	std::shared_ptr<Tiles> tiles; // Of the image in the last request
+	std::vector<std::future<void>> tileJobs;
+	std::optional<Job> pending;
+	std::optional<Job> last; // The request that produced or is producing the current result
+	std::future<PixelStats> running;
+	std::optional<PixelStats> result;
+	uint64_t sequence = 0;
+};
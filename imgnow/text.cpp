@@ -0,0 +1,234 @@
+#include "text.h"
+#include <algorithm>
+#include <iterator> // std::size
+#include "window.h" // SDLException
+
+constexpr int GLYPH_WIDTH = 5;
+constexpr int GLYPH_HEIGHT = 7;
+constexpr int CELL_WIDTH = GLYPH_WIDTH + 1; // Glyphs are padded so that filtering never bleeds
+constexpr int CELL_HEIGHT = GLYPH_HEIGHT + 1;
+constexpr int ATLAS_COLUMNS = 16;
+constexpr int ATLAS_ROWS = 6;
+constexpr int FIRST_CHAR = ' ';
+constexpr int LAST_CHAR = '~';
+constexpr int SOLID_CELL = LAST_CHAR - FIRST_CHAR + 1; // Filled block used by FillRect
+
+// Printable ASCII, one byte per column from left to right with the top row in the lowest bit
+static const uint8_t FONT[][GLYPH_WIDTH] = {
+	{ 0x00, 0x00, 0x00, 0x00, 0x00 }, // ' '
+	{ 0x00, 0x00, 0x5F, 0x00, 0x00 }, // !
+	{ 0x00, 0x07, 0x00, 0x07, 0x00 }, // "
+	{ 0x14, 0x7F, 0x14, 0x7F, 0x14 }, // #
+	{ 0x24, 0x2A, 0x7F, 0x2A, 0x12 }, // $
+	{ 0x23, 0x13, 0x08, 0x64, 0x62 }, // %
+	{ 0x36, 0x49, 0x55, 0x22, 0x50 }, // &
+	{ 0x00, 0x05, 0x03, 0x00, 0x00 }, // '
+	{ 0x00, 0x1C, 0x22, 0x41, 0x00 }, // (
+	{ 0x00, 0x41, 0x22, 0x1C, 0x00 }, // )
+	{ 0x14, 0x08, 0x3E, 0x08, 0x14 }, // *
+	{ 0x08, 0x08, 0x3E, 0x08, 0x08 }, // +
+	{ 0x00, 0x50, 0x30, 0x00, 0x00 }, // ,
+	{ 0x08, 0x08, 0x08, 0x08, 0x08 }, // -
+	{ 0x00, 0x60, 0x60, 0x00, 0x00 }, // .
+	{ 0x20, 0x10, 0x08, 0x04, 0x02 }, // /
+	{ 0x3E, 0x51, 0x49, 0x45, 0x3E }, // 0
+	{ 0x00, 0x42, 0x7F, 0x40, 0x00 }, // 1
+	{ 0x42, 0x61, 0x51, 0x49, 0x46 }, // 2
+	{ 0x21, 0x41, 0x45, 0x4B, 0x31 }, // 3
+	{ 0x18, 0x14, 0x12, 0x7F, 0x10 }, // 4
+	{ 0x27, 0x45, 0x45, 0x45, 0x39 }, // 5
+	{ 0x3C, 0x4A, 0x49, 0x49, 0x30 }, // 6
+	{ 0x01, 0x71, 0x09, 0x05, 0x03 }, // 7
+	{ 0x36, 0x49, 0x49, 0x49, 0x36 }, // 8
+	{ 0x06, 0x49, 0x49, 0x29, 0x1E }, // 9
+	{ 0x00, 0x36, 0x36, 0x00, 0x00 }, // :
+	{ 0x00, 0x56, 0x36, 0x00, 0x00 }, // ;
+	{ 0x08, 0x14, 0x22, 0x41, 0x00 }, // <
+	{ 0x14, 0x14, 0x14, 0x14, 0x14 }, // =
+	{ 0x00, 0x41, 0x22, 0x14, 0x08 }, // >
+	{ 0x02, 0x01, 0x51, 0x09, 0x06 }, // ?
+	{ 0x32, 0x49, 0x79, 0x41, 0x3E }, // @
+	{ 0x7E, 0x11, 0x11, 0x11, 0x7E }, // A
+	{ 0x7F, 0x49, 0x49, 0x49, 0x36 }, // B
+	{ 0x3E, 0x41, 0x41, 0x41, 0x22 }, // C
+	{ 0x7F, 0x41, 0x41, 0x22, 0x1C }, // D
+	{ 0x7F, 0x49, 0x49, 0x49, 0x41 }, // E
+	{ 0x7F, 0x09, 0x09, 0x09, 0x01 }, // F
+	{ 0x3E, 0x41, 0x49, 0x49, 0x7A }, // G
+	{ 0x7F, 0x08, 0x08, 0x08, 0x7F }, // H
+	{ 0x00, 0x41, 0x7F, 0x41, 0x00 }, // I
+	{ 0x20, 0x40, 0x41, 0x3F, 0x01 }, // J
+	{ 0x7F, 0x08, 0x14, 0x22, 0x41 }, // K
+	{ 0x7F, 0x40, 0x40, 0x40, 0x40 }, // L
+	{ 0x7F, 0x02, 0x0C, 0x02, 0x7F }, // M
+	{ 0x7F, 0x04, 0x08, 0x10, 0x7F }, // N
+	{ 0x3E, 0x41, 0x41, 0x41, 0x3E }, // O
+	{ 0x7F, 0x09, 0x09, 0x09, 0x06 }, // P
+	{ 0x3E, 0x41, 0x51, 0x21, 0x5E }, // Q
+	{ 0x7F, 0x09, 0x19, 0x29, 0x46 }, // R
+	{ 0x46, 0x49, 0x49, 0x49, 0x31 }, // S
+	{ 0x01, 0x01, 0x7F, 0x01, 0x01 }, // T
+	{ 0x3F, 0x40, 0x40, 0x40, 0x3F }, // U
+	{ 0x1F, 0x20, 0x40, 0x20, 0x1F }, // V
+	{ 0x3F, 0x40, 0x38, 0x40, 0x3F }, // W
+	{ 0x63, 0x14, 0x08, 0x14, 0x63 }, // X
+	{ 0x07, 0x08, 0x70, 0x08, 0x07 }, // Y
+	{ 0x61, 0x51, 0x49, 0x45, 0x43 }, // Z
+	{ 0x00, 0x7F, 0x41, 0x41, 0x00 }, // [
+	{ 0x02, 0x04, 0x08, 0x10, 0x20 }, // Backslash
+	{ 0x00, 0x41, 0x41, 0x7F, 0x00 }, // ]
+	{ 0x04, 0x02, 0x01, 0x02, 0x04 }, // ^
+	{ 0x40, 0x40, 0x40, 0x40, 0x40 }, // _
+	{ 0x00, 0x01, 0x02, 0x04, 0x00 }, // `
+	{ 0x20, 0x54, 0x54, 0x54, 0x78 }, // a
+	{ 0x7F, 0x48, 0x44, 0x44, 0x38 }, // b
+	{ 0x38, 0x44, 0x44, 0x44, 0x20 }, // c
+	{ 0x38, 0x44, 0x44, 0x48, 0x7F }, // d
+	{ 0x38, 0x54, 0x54, 0x54, 0x18 }, // e
+	{ 0x08, 0x7E, 0x09, 0x01, 0x02 }, // f
+	{ 0x08, 0x54, 0x54, 0x54, 0x3C }, // g
+	{ 0x7F, 0x08, 0x04, 0x04, 0x78 }, // h
+	{ 0x00, 0x44, 0x7D, 0x40, 0x00 }, // i
+	{ 0x20, 0x40, 0x44, 0x3D, 0x00 }, // j
+	{ 0x7F, 0x10, 0x28, 0x44, 0x00 }, // k
+	{ 0x00, 0x41, 0x7F, 0x40, 0x00 }, // l
+	{ 0x7C, 0x04, 0x18, 0x04, 0x78 }, // m
+	{ 0x7C, 0x08, 0x04, 0x04, 0x78 }, // n
+	{ 0x38, 0x44, 0x44, 0x44, 0x38 }, // o
+	{ 0x7C, 0x14, 0x14, 0x14, 0x08 }, // p
+	{ 0x08, 0x14, 0x14, 0x14, 0x7C }, // q
+	{ 0x7C, 0x08, 0x04, 0x04, 0x08 }, // r
+	{ 0x48, 0x54, 0x54, 0x54, 0x20 }, // s
+	{ 0x04, 0x3F, 0x44, 0x40, 0x20 }, // t
+	{ 0x3C, 0x40, 0x40, 0x20, 0x7C }, // u
+	{ 0x1C, 0x20, 0x40, 0x20, 0x1C }, // v
+	{ 0x3C, 0x40, 0x30, 0x40, 0x3C }, // w
+	{ 0x44, 0x28, 0x10, 0x28, 0x44 }, // x
+	{ 0x0C, 0x50, 0x50, 0x50, 0x3C }, // y
+	{ 0x44, 0x64, 0x54, 0x4C, 0x44 }, // z
+	{ 0x00, 0x08, 0x36, 0x41, 0x00 }, // {
+	{ 0x00, 0x00, 0x7F, 0x00, 0x00 }, // |
+	{ 0x00, 0x41, 0x36, 0x08, 0x00 }, // }
+	{ 0x08, 0x04, 0x04, 0x08, 0x04 }, // ~
+};
+
+static_assert(std::size(FONT) == LAST_CHAR - FIRST_CHAR + 1);
+static_assert(SOLID_CELL < ATLAS_COLUMNS * ATLAS_ROWS);
+
+TextRenderer::TextRenderer(SDL_Renderer* renderer) :
+	renderer(renderer) {
+	// White glyphs on transparent texels so that the vertex colour tints them
+	constexpr int width = ATLAS_COLUMNS * CELL_WIDTH;
+	constexpr int height = ATLAS_ROWS * CELL_HEIGHT;
+	std::vector<uint32_t> pixels(width * height, 0);
+	for (int cell = 0; cell <= SOLID_CELL; cell++) {
+		int cx = cell % ATLAS_COLUMNS * CELL_WIDTH;
+		int cy = cell / ATLAS_COLUMNS * CELL_HEIGHT;
+		for (int y = 0; y < CELL_HEIGHT; y++) {
+			for (int x = 0; x < CELL_WIDTH; x++) {
+				bool set = cell == SOLID_CELL
+					|| (x < GLYPH_WIDTH && y < GLYPH_HEIGHT && ((FONT[cell][x] >> y) & 1));
+				if (set) {
+					pixels[(cy + y) * width + cx + x] = 0xFFFFFFFF;
+				}
+			}
+		}
+	}
+
+	atlas = SDL_CreateTexture(
+		renderer,
+		SDL_PixelFormatEnum::SDL_PIXELFORMAT_ABGR8888,
+		SDL_TEXTUREACCESS_STATIC,
+		width,
+		height);
+	if (!atlas)
+		throw SDLException();
+	SDL_UpdateTexture(atlas, nullptr, pixels.data(), width * 4);
+	SDL_SetTextureScaleMode(atlas, SDL_ScaleModeNearest);
+	SDL_SetTextureBlendMode(atlas, SDL_BLENDMODE_BLEND);
+}
+
+TextRenderer::~TextRenderer() {
+	SDL_DestroyTexture(atlas);
+}
+
+void TextRenderer::SetScale(int scale) {
+	this->scale = std::max(1, scale);
+}
+
+int TextRenderer::GetLineHeight() const {
+	return (CELL_HEIGHT + 2) * scale;
+}
+
+int TextRenderer::GetAdvance() const {
+	return CELL_WIDTH * scale;
+}
+
+int TextRenderer::GetLineSpacing() const {
+	return CELL_HEIGHT * scale;
+}
+
+int TextRenderer::Measure(std::string_view text) const {
+	return (int)text.size() * CELL_WIDTH * scale;
+}
+
+void TextRenderer::DrawString(std::string_view text, int x, int y, SDL_Colour colour) {
+	float top = (float)y;
+	float left = (float)x;
+	for (char c : text) {
+		int ch = (unsigned char)c;
+		if (ch < FIRST_CHAR || ch > LAST_CHAR) {
+			ch = '?';
+		}
+		if (ch != ' ') {
+			int cell = ch - FIRST_CHAR;
+			SDL_FRect src = {
+				(float)(cell % ATLAS_COLUMNS * CELL_WIDTH),
+				(float)(cell / ATLAS_COLUMNS * CELL_HEIGHT),
+				(float)GLYPH_WIDTH,
+				(float)GLYPH_HEIGHT,
+			};
+			AddQuad({ left, top, (float)(GLYPH_WIDTH * scale), (float)(GLYPH_HEIGHT * scale) }, src, colour);
+		}
+		left += CELL_WIDTH * scale;
+	}
+}
+
+void TextRenderer::FillRect(const SDL_Rect& rc, SDL_Colour colour) {
+	if (rc.w <= 0 || rc.h <= 0)
+		return;
+	// Sample the inside of the solid block so that its edges are never reached
+	SDL_FRect src = {
+		(float)(SOLID_CELL % ATLAS_COLUMNS * CELL_WIDTH + 1),
+		(float)(SOLID_CELL / ATLAS_COLUMNS * CELL_HEIGHT + 1),
+		(float)(CELL_WIDTH - 2),
+		(float)(CELL_HEIGHT - 2),
+	};
+	AddQuad({ (float)rc.x, (float)rc.y, (float)rc.w, (float)rc.h }, src, colour);
+}
+
+void TextRenderer::AddQuad(const SDL_FRect& dst, const SDL_FRect& src, SDL_Colour colour) {
+	constexpr float du = 1.0f / (ATLAS_COLUMNS * CELL_WIDTH);
+	constexpr float dv = 1.0f / (ATLAS_ROWS * CELL_HEIGHT);
+	float u0 = src.x * du;
+	float v0 = src.y * dv;
+	float u1 = (src.x + src.w) * du;
+	float v1 = (src.y + src.h) * dv;
+	int first = (int)vertices.size();
+	vertices.push_back({ { dst.x, dst.y }, colour, { u0, v0 } });
+	vertices.push_back({ { dst.x + dst.w, dst.y }, colour, { u1, v0 } });
+	vertices.push_back({ { dst.x, dst.y + dst.h }, colour, { u0, v1 } });
+	vertices.push_back({ { dst.x + dst.w, dst.y + dst.h }, colour, { u1, v1 } });
+	for (int i : { 0, 1, 2, 2, 1, 3 }) {
+		indices.push_back(first + i);
+	}
+}
+
+void TextRenderer::Flush() {
+	if (!indices.empty()) {
+		SDL_RenderGeometry(renderer, atlas, vertices.data(), (int)vertices.size(), indices.data(), (int)indices.size());
+	}
+	// Keeps the capacity, so nothing is allocated once the buffers have grown to fit a frame
+	vertices.clear();
+	indices.clear();
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <stdint.h>
+#include <string_view>
+#include <vector>
+#include "SDL.h"
+
+// Draws text from a 5x7 bitmap font that is baked into one small atlas texture.
+// Glyphs and filled rects are queued as quads into buffers that are reused between
+// frames, then drawn together with a single SDL_RenderGeometry call in Flush.
+struct TextRenderer {
+	explicit TextRenderer(SDL_Renderer* renderer);
+	~TextRenderer();
+	TextRenderer(const TextRenderer&) = delete;
+	TextRenderer& operator=(const TextRenderer&) = delete;
+	void SetScale(int scale); // Whole screen pixels per font pixel
+	int GetLineHeight() const; // Height of a bar of text with some space above and below
+	int GetAdvance() const; // From one character to the next
+	int GetLineSpacing() const; // Glyph height plus one font pixel between lines
+	int Measure(std::string_view text) const; // Width in pixels, for a single line
+	// y is the top of the glyphs. Characters outside ASCII are drawn as '?'.
+	void DrawString(std::string_view text, int x, int y, SDL_Colour colour);
+	void FillRect(const SDL_Rect& rc, SDL_Colour colour);
+	void Flush(); // Draws everything queued since the last flush
+private:
+	void AddQuad(const SDL_FRect& dst, const SDL_FRect& src, SDL_Colour colour); // src is in atlas texels
+	SDL_Renderer* renderer;
+	SDL_Texture* atlas = nullptr;
+	int scale = 1;
+	std::vector<SDL_Vertex> vertices;
+	std::vector<int> indices;
+};
@@ -0,0 +1,164 @@
+#include "texture.h"
+#include "window.h" // SDLException
+
+TextureManager::TextureManager(SDL_Renderer* renderer) :
+	renderer(renderer) {
+}
+
+TextureManager::~TextureManager() {
+	for (auto& [id, entry] : entries) {
+		for (SDL_Texture* tex : entry.frames) {
+			SDL_DestroyTexture(tex);
+		}
+		if (entry.thumbnail) {
+			SDL_DestroyTexture(entry.thumbnail);
+		}
+	}
+}
+
+void TextureManager::Upload(uint64_t id, const Image& image) {
+	Entry& entry = entries[id];
+	if (entry.frames.size() == 1 && image.GetFrameCount() == 1
+		&& entry.width == image.GetWidth() && entry.height == image.GetHeight()) {
+		// Update in place so that live updates don't reallocate the texture
+		SDL_UpdateTexture(entry.frames[0], nullptr, image.GetPixels(), image.GetWidth() * 4);
+		SDL_SetTextureBlendMode(entry.frames[0], GetBlendMode(image, 0));
+		return;
+	}
+
+	for (SDL_Texture* tex : entry.frames) {
+		SDL_DestroyTexture(tex);
+	}
+	entry.frames.clear();
+	entry.width = image.GetWidth();
+	entry.height = image.GetHeight();
+	for (size_t n = 0; n < image.GetFrameCount(); n++) {
+		SDL_Texture* tex = CreateTexture(image, n);
+		SDL_SetTextureScaleMode(tex, entry.scaleMode);
+		entry.frames.push_back(tex);
+	}
+}
+
+void TextureManager::UploadThumbnail(uint64_t id, const Image& thumbnail) {
+	Entry& entry = entries[id];
+	if (entry.thumbnail) {
+		SDL_DestroyTexture(entry.thumbnail);
+	}
+	entry.thumbnail = CreateTexture(thumbnail, 0);
+	SDL_SetTextureScaleMode(entry.thumbnail, SDL_ScaleModeLinear);
+}
+
+void TextureManager::Allocate(uint64_t id, const Image& image) {
+	Entry& entry = entries[id];
+	for (SDL_Texture* tex : entry.frames) {
+		SDL_DestroyTexture(tex);
+	}
+	entry.frames.clear();
+	entry.width = image.GetWidth();
+	entry.height = image.GetHeight();
+	SDL_Texture* tex = SDL_CreateTexture(
+		renderer,
+		SDL_PixelFormatEnum::SDL_PIXELFORMAT_ABGR8888,
+		SDL_TEXTUREACCESS_STATIC,
+		image.GetWidth(),
+		image.GetHeight());
+	if (!tex)
+		throw SDLException();
+	SDL_SetTextureBlendMode(tex, GetBlendMode(image, 0));
+	SDL_SetTextureScaleMode(tex, entry.scaleMode);
+	entry.frames.push_back(tex);
+}
+
+void TextureManager::UpdateRect(uint64_t id, const Image& image, const SDL_Rect& rect) {
+	SDL_Texture* tex = Get(id, 0);
+	if (!tex)
+		return;
+	const uint8_t* pixels = image.GetPixels() + ((size_t)rect.y * image.GetWidth() + rect.x) * 4;
+	SDL_UpdateTexture(tex, &rect, pixels, image.GetWidth() * 4);
+}
+
+void TextureManager::ReleaseFrames(uint64_t id) {
+	auto it = entries.find(id);
+	if (it == entries.end())
+		return;
+	for (SDL_Texture* tex : it->second.frames) {
+		SDL_DestroyTexture(tex);
+	}
+	it->second.frames.clear();
+}
+
+void TextureManager::Release(uint64_t id) {
+	auto it = entries.find(id);
+	if (it == entries.end())
+		return;
+	for (SDL_Texture* tex : it->second.frames) {
+		SDL_DestroyTexture(tex);
+	}
+	if (it->second.thumbnail) {
+		SDL_DestroyTexture(it->second.thumbnail);
+	}
+	entries.erase(it);
+}
+
+bool TextureManager::HasFrames(uint64_t id) const {
+	auto it = entries.find(id);
+	return it != entries.end() && !it->second.frames.empty();
+}
+
+SDL_Texture* TextureManager::Get(uint64_t id, size_t frame) const {
+	auto it = entries.find(id);
+	if (it == entries.end() || frame >= it->second.frames.size())
+		return nullptr;
+	return it->second.frames[frame];
+}
+
+SDL_Texture* TextureManager::GetThumbnail(uint64_t id) const {
+	auto it = entries.find(id);
+	return it == entries.end() ? nullptr : it->second.thumbnail;
+}
+
+void TextureManager::SetScaleMode(uint64_t id, SDL_ScaleMode mode) {
+	auto it = entries.find(id);
+	if (it == entries.end() || it->second.scaleMode == mode)
+		return;
+	it->second.scaleMode = mode;
+	for (SDL_Texture* tex : it->second.frames) {
+		SDL_SetTextureScaleMode(tex, mode);
+	}
+}
+
+void TextureManager::UpdateBlendMode(uint64_t id, const Image& image) {
+	auto it = entries.find(id);
+	if (it == entries.end())
+		return;
+	for (size_t i = 0; i < it->second.frames.size(); i++) {
+		SDL_SetTextureBlendMode(it->second.frames[i], GetBlendMode(image, i));
+	}
+}
+
+SDL_BlendMode TextureManager::GetBlendMode(const Image& image, size_t frame) {
+	// Copying is much cheaper than blending, especially on the software renderer
+	return image.GetAlphaType(frame) == AlphaType::Opaque ? SDL_BLENDMODE_NONE : SDL_BLENDMODE_BLEND;
+}
+
+SDL_Texture* TextureManager::CreateTexture(const Image& img, size_t frame) const {
+	// Create surface
+	SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormatFrom(
+		(void*)(img.GetPixels() + (size_t)img.GetWidth() * (size_t)img.GetHeight() * frame * 4),
+		img.GetWidth(),
+		img.GetHeight(),
+		32,
+		img.GetWidth() * 4,
+		SDL_PixelFormatEnum::SDL_PIXELFORMAT_ABGR8888);
+	if (!surface)
+		throw SDLException();
+
+	// Create texture
+	SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
+	SDL_FreeSurface(surface);
+	if (!texture)
+		throw SDLException();
+	SDL_SetTextureBlendMode(texture, GetBlendMode(img, frame));
+
+	return texture;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <unordered_map>
+#include "SDL.h"
+#include "image.h"
+
+// Owns the GPU textures of open images, keyed by image id, separately from the decoded
+// pixels. Since the scale mode is set per texture, changing the filtering doesn't need
+// the textures to be recreated or the images to be decoded again.
+// Each image has a small thumbnail texture which lives as long as the image, and full
+// resolution frame textures which are only uploaded while the image might be shown.
+struct TextureManager {
+	explicit TextureManager(SDL_Renderer* renderer);
+	~TextureManager();
+	TextureManager(const TextureManager&) = delete;
+	TextureManager& operator=(const TextureManager&) = delete;
+	void Upload(uint64_t id, const Image& image); // Replaces any existing frame textures for id
+	void UploadThumbnail(uint64_t id, const Image& thumbnail);
+	// Single frame texture whose contents are undefined until they are filled in with UpdateRect,
+	// for images derived from others that are only ever partly up to date
+	void Allocate(uint64_t id, const Image& image);
+	void UpdateRect(uint64_t id, const Image& image, const SDL_Rect& rect); // Uploads part of the first frame
+	void ReleaseFrames(uint64_t id); // Keeps the thumbnail
+	void Release(uint64_t id);
+	bool HasFrames(uint64_t id) const;
+	SDL_Texture* Get(uint64_t id, size_t frame) const; // Null if the frames aren't resident
+	SDL_Texture* GetThumbnail(uint64_t id) const;
+	void SetScaleMode(uint64_t id, SDL_ScaleMode mode); // Applies to every frame
+	void UpdateBlendMode(uint64_t id, const Image& image); // After the alpha type of an allocated image changes
+private:
+	struct Entry {
+		std::vector<SDL_Texture*> frames;
+		SDL_Texture* thumbnail = nullptr;
+		int width = 0;
+		int height = 0;
+		SDL_ScaleMode scaleMode = SDL_ScaleModeLinear;
+	};
+	static SDL_BlendMode GetBlendMode(const Image& image, size_t frame);
+	SDL_Texture* CreateTexture(const Image& image, size_t frame) const;
+	SDL_Renderer* renderer;
+	std::unordered_map<uint64_t, Entry> entries;
+};
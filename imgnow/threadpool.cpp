@@ -0,0 +1,97 @@
+#include "threadpool.h"
+#include <thread>
+#include <algorithm>
+
+ThreadPool::ThreadPool(int threadCount) :
+	state(std::make_shared<State>()),
+	threadCount(std::max(1, threadCount)) {
+	for (int i = 0; i < this->threadCount; i++) {
+		std::thread(&ThreadPool::Work, state).detach();
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(state->mutex);
+		state->stopping = true;
+		state->jobs.clear();
+	}
+	state->cv.notify_all();
+}
+
+int ThreadPool::GetThreadCount() const {
+	return threadCount;
+}
+
+bool ThreadPool::Busy() const {
+	std::lock_guard<std::mutex> lock(state->mutex);
+	return !state->jobs.empty() || state->running > 0;
+}
+
+void ThreadPool::SetNotify(std::function<void()> notify) {
+	std::lock_guard<std::mutex> lock(state->mutex);
+	state->notify = std::move(notify);
+}
+
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)>& f) {
+	struct Shared {
+		std::atomic<size_t> next = 0;
+		std::atomic<size_t> finished = 0;
+		std::mutex mutex;
+		std::condition_variable cv;
+	};
+	auto shared = std::make_shared<Shared>();
+	const std::function<void(size_t)>* body = &f; // Only called while this function is waiting
+	auto run = [shared, body, count] {
+		size_t done = 0;
+		for (size_t i = shared->next++; i < count; i = shared->next++) {
+			(*body)(i);
+			done++;
+		}
+		if (done && shared->finished.fetch_add(done) + done == count) {
+			std::lock_guard<std::mutex> lock(shared->mutex);
+			shared->cv.notify_all();
+		}
+	};
+
+	size_t helpers = std::min((size_t)threadCount, count ? count - 1 : 0);
+	for (size_t i = 0; i < helpers; i++) {
+		Push(run);
+	}
+	run();
+	std::unique_lock<std::mutex> lock(shared->mutex);
+	shared->cv.wait(lock, [&] { return shared->finished == count; });
+}
+
+void ThreadPool::Push(std::function<void()> job) {
+	{
+		std::lock_guard<std::mutex> lock(state->mutex);
+		state->jobs.push_back(std::move(job));
+	}
+	state->cv.notify_one();
+}
+
+void ThreadPool::Work(std::shared_ptr<State> state) {
+	while (true) {
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(state->mutex);
+			state->cv.wait(lock, [&] { return state->stopping || !state->jobs.empty(); });
+			if (state->stopping)
+				return;
+			job = std::move(state->jobs.front());
+			state->jobs.pop_front();
+			state->running++;
+		}
+		job();
+		std::function<void()> notify;
+		{
+			std::lock_guard<std::mutex> lock(state->mutex);
+			state->running--;
+			notify = state->notify;
+		}
+		if (notify) {
+			notify();
+		}
+	}
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <functional>
+#include <future>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <atomic>
+#include <type_traits>
+
+// Fixed size pool of worker threads. The workers are detached and share ownership of
+// the job queue, so destroying the pool never waits for a job that is still running.
+// This allows quick termination in the same way as leaking a std::future would.
+struct ThreadPool {
+	explicit ThreadPool(int threadCount);
+	~ThreadPool();
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+	int GetThreadCount() const;
+	bool Busy() const; // Some job is queued or running
+	void SetNotify(std::function<void()> notify); // Called from the worker after each job finishes
+	// Runs f(i) for every i below count on the calling thread and any workers that are free, and
+	// returns once every call has finished. This never waits behind queued jobs, since workers
+	// that only get to their share after the caller has done everything find nothing left to do.
+	void ParallelFor(size_t count, const std::function<void(size_t)>& f);
+
+	template <typename F>
+	std::future<std::invoke_result_t<F>> Submit(F f) {
+		using R = std::invoke_result_t<F>;
+		auto task = std::make_shared<std::packaged_task<R()>>(std::move(f));
+		std::future<R> future = task->get_future();
+		Push([task] { (*task)(); });
+		return future;
+	}
+private:
+	struct State {
+		std::mutex mutex;
+		std::condition_variable cv;
+		std::deque<std::function<void()>> jobs;
+		int running = 0;
+		std::function<void()> notify;
+		bool stopping = false;
+	};
+	std::shared_ptr<State> state;
+	int threadCount;
+	void Push(std::function<void()> job);
+	static void Work(std::shared_ptr<State> state);
+};
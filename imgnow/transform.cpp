@@ -0,0 +1,137 @@
+#include "transform.h"
+#include <cstring> // memcpy
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMGNOW_SSE2
+#include <emmintrin.h>
+#endif
+
+// Destination columns per tile when transposing. The source rows a tile reads and the
+// destination rows it writes then both stay in cache while it is filled.
+constexpr int TRANSPOSE_TILE = 64;
+
+// Every result pixel comes from one source pixel. Without transposing, dst(x, y) = src(x', y')
+// and otherwise dst(x, y) = src(y', x'), where a primed coordinate counts from the far edge if reversed.
+struct Mapping {
+	const uint8_t* src;
+	size_t srcStride;
+	int width; // Of the source
+	int height;
+	uint8_t* dst; // Result row firstRow
+	int firstRow;
+	bool transpose;
+	bool reverseColumns; // Source columns run backwards
+	bool reverseRows;
+};
+
+static Mapping GetMapping(const uint8_t* src, size_t srcStride, int width, int height, const Orientation& orientation, uint8_t* dst, int firstRow) {
+	Mapping m = { src, srcStride, width, height, dst, firstRow, false, false, false };
+	bool h = orientation.flipHorizontal;
+	bool v = orientation.flipVertical;
+	switch ((orientation.rotation % 4 + 4) % 4) {
+	case 0: m.reverseColumns = h; m.reverseRows = v; break;
+	case 1: m.transpose = true; m.reverseColumns = h; m.reverseRows = !v; break;
+	case 2: m.reverseColumns = !h; m.reverseRows = !v; break;
+	case 3: m.transpose = true; m.reverseColumns = !h; m.reverseRows = v; break;
+	}
+	return m;
+}
+
+static const uint8_t* SourceRow(const Mapping& m, int row) {
+	return m.src + 4 * m.srcStride * (m.reverseRows ? m.height - 1 - row : row);
+}
+
+static int SourceColumn(const Mapping& m, int column) {
+	return m.reverseColumns ? m.width - 1 - column : column;
+}
+
+static void CopyRow(const Mapping& m, int y) {
+	const uint8_t* src = SourceRow(m, y);
+	uint8_t* dst = m.dst + 4 * (size_t)m.width * (y - m.firstRow);
+	if (!m.reverseColumns) {
+		std::memcpy(dst, src, 4 * (size_t)m.width);
+		return;
+	}
+	int x = 0;
+#ifdef IMGNOW_SSE2
+	for (; x + 4 <= m.width; x += 4) {
+		__m128i p = _mm_loadu_si128((const __m128i*)(src + 4 * (m.width - 4 - x)));
+		_mm_storeu_si128((__m128i*)(dst + 4 * x), _mm_shuffle_epi32(p, _MM_SHUFFLE(0, 1, 2, 3)));
+	}
+#endif
+	for (; x < m.width; x++) {
+		std::memcpy(dst + 4 * x, src + 4 * (m.width - 1 - x), 4);
+	}
+}
+
+// Result pixel (x, y) when transposed, which comes from source row x and column y
+static void TransposePixel(const Mapping& m, int x, int y) {
+	std::memcpy(m.dst + 4 * ((size_t)m.height * (y - m.firstRow) + x), SourceRow(m, x) + 4 * SourceColumn(m, y), 4);
+}
+
+#ifdef IMGNOW_SSE2
+// Four source rows of four pixels each become four result rows
+static void Transpose4x4(const Mapping& m, int x, int y) {
+	int column = m.reverseColumns ? m.width - 4 - y : y;
+	__m128i r[4];
+	for (int i = 0; i < 4; i++) {
+		r[i] = _mm_loadu_si128((const __m128i*)(SourceRow(m, x + i) + 4 * column));
+		if (m.reverseColumns) {
+			r[i] = _mm_shuffle_epi32(r[i], _MM_SHUFFLE(0, 1, 2, 3));
+		}
+	}
+	__m128i t0 = _mm_unpacklo_epi32(r[0], r[1]);
+	__m128i t1 = _mm_unpacklo_epi32(r[2], r[3]);
+	__m128i t2 = _mm_unpackhi_epi32(r[0], r[1]);
+	__m128i t3 = _mm_unpackhi_epi32(r[2], r[3]);
+	uint8_t* dst = m.dst + 4 * ((size_t)m.height * (y - m.firstRow) + x);
+	size_t stride = 4 * (size_t)m.height;
+	_mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi64(t0, t1));
+	_mm_storeu_si128((__m128i*)(dst + stride), _mm_unpackhi_epi64(t0, t1));
+	_mm_storeu_si128((__m128i*)(dst + 2 * stride), _mm_unpacklo_epi64(t2, t3));
+	_mm_storeu_si128((__m128i*)(dst + 3 * stride), _mm_unpackhi_epi64(t2, t3));
+}
+#endif
+
+static void TransposeRows(const Mapping& m, int rowBegin, int rowEnd) {
+	// The result is as wide as the source is tall
+	for (int tileX = 0; tileX < m.height; tileX += TRANSPOSE_TILE) {
+		int tileEnd = std::min(tileX + TRANSPOSE_TILE, m.height);
+		int y = rowBegin;
+#ifdef IMGNOW_SSE2
+		for (; y + 4 <= rowEnd; y += 4) {
+			int x = tileX;
+			for (; x + 4 <= tileEnd; x += 4) {
+				Transpose4x4(m, x, y);
+			}
+			for (; x < tileEnd; x++) {
+				for (int i = 0; i < 4; i++) {
+					TransposePixel(m, x, y + i);
+				}
+			}
+		}
+#endif
+		for (; y < rowEnd; y++) {
+			for (int x = tileX; x < tileEnd; x++) {
+				TransposePixel(m, x, y);
+			}
+		}
+	}
+}
+
+bool Orientation::Transposed() const {
+	return rotation % 2 != 0;
+}
+
+void TransformRows(const uint8_t* src, size_t srcStride, int width, int height,
+	const Orientation& orientation, uint8_t* dst, int rowBegin, int rowEnd) {
+	Mapping m = GetMapping(src, srcStride, width, height, orientation, dst, rowBegin);
+	if (m.transpose) {
+		TransposeRows(m, rowBegin, rowEnd);
+	} else {
+		for (int y = rowBegin; y < rowEnd; y++) {
+			CopyRow(m, y);
+		}
+	}
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Flips and rotation of an image as shown by the view, the flips are applied first
+struct Orientation {
+	bool flipHorizontal = false;
+	bool flipVertical = false;
+	int rotation = 0; // In 90 degree anti-clockwise units
+	bool Transposed() const; // Whether the width and height swap
+};
+
+// Writes rows rowBegin to rowEnd of a width by height block of RGBA pixels as it is shown with the orientation,
+// tightly packed into dst. The result has the width and height swapped if transposed. srcStride is in pixels.
+// Rows are independent so bands of them can be transformed on different threads.
+void TransformRows(const uint8_t* src, size_t srcStride, int width, int height,
+	const Orientation& orientation, uint8_t* dst, int rowBegin, int rowEnd);
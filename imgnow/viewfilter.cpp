@@ -0,0 +1,404 @@
+#include "viewfilter.h"
+#include <cmath>
+#include <cstring> // memcpy
+#include <algorithm>
+#include <array>
+#include <chrono>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMGNOW_SSE2
+#include <emmintrin.h>
+#endif
+
+constexpr int TILE_SIZE = 256;
+constexpr size_t SYNC_FILTER_PIXELS = 1 << 22; // Out of date pixels in view that are filtered straight away, more go to jobs
+
+bool ViewFilter::IsIdentity() const {
+	return channel == ViewChannel::All && black == 0 && white == 255 && !falseColour;
+}
+
+// Colour ramp from dark purple through blue, green and yellow to red
+static const std::array<uint32_t, 256>& GetFalseColourPalette() {
+	static const std::array<uint32_t, 256> palette = [] {
+		struct Stop { float t, r, g, b; };
+		static const Stop STOPS[] = {
+			{ 0.0f, 30, 15, 60 },
+			{ 0.2f, 50, 100, 230 },
+			{ 0.4f, 30, 200, 200 },
+			{ 0.6f, 150, 230, 50 },
+			{ 0.8f, 250, 150, 30 },
+			{ 1.0f, 180, 20, 20 },
+		};
+		std::array<uint32_t, 256> palette{};
+		for (int v = 0; v < 256; v++) {
+			float t = v / 255.0f;
+			int i = 0;
+			while (i < 4 && t > STOPS[i + 1].t) {
+				i++;
+			}
+			const Stop& lo = STOPS[i];
+			const Stop& hi = STOPS[i + 1];
+			float f = (t - lo.t) / (hi.t - lo.t);
+			uint32_t r = (uint32_t)std::lerp(lo.r, hi.r, f);
+			uint32_t g = (uint32_t)std::lerp(lo.g, hi.g, f);
+			uint32_t b = (uint32_t)std::lerp(lo.b, hi.b, f);
+			palette[v] = b << 16 | g << 8 | r; // Alpha is added by the caller
+		}
+		return palette;
+	}();
+	return palette;
+}
+
+// Levels in fixed point, within one of exact and mapping black to 0 and white to 255
+struct Levels {
+	int black;
+	int range;
+	uint32_t scale;
+	explicit Levels(const ViewFilter& filter) :
+		black(filter.black),
+		range(std::max(1, filter.white - filter.black)),
+		scale((255 * 256 + range - 1) / range) {
+	}
+	uint8_t Apply(int v) const {
+		return (uint8_t)(((uint32_t)std::clamp(v - black, 0, range) * 256 * scale) >> 16);
+	}
+};
+
+static uint32_t FalseColour(uint32_t pixel, bool grey, const std::array<uint32_t, 256>& palette) {
+	uint32_t r = pixel & 0xFF;
+	uint32_t g = pixel >> 8 & 0xFF;
+	uint32_t b = pixel >> 16 & 0xFF;
+	uint32_t luma = grey ? r : (77 * r + 150 * g + 29 * b + 128) >> 8;
+	return palette[luma] | (pixel & 0xFF000000);
+}
+
+void ApplyViewFilter(const ViewFilter& filter, const uint8_t* src, uint8_t* dst, size_t count) {
+	int channel = filter.channel == ViewChannel::All ? -1 : (int)filter.channel - 1;
+	Levels levels(filter);
+	const auto& palette = GetFalseColourPalette();
+	size_t i = 0;
+#ifdef IMGNOW_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i alphaMask = _mm_set1_epi32((int)0xFF000000);
+	const __m128i byteMask = _mm_set1_epi32(0xFF);
+	const __m128i shift = _mm_cvtsi32_si128(std::max(channel, 0) * 8);
+	const __m128i black = _mm_set1_epi8((char)levels.black);
+	const __m128i range = _mm_set1_epi8((char)levels.range);
+	const __m128i scale = _mm_set1_epi16((short)levels.scale);
+	alignas(16) uint32_t lanes[4];
+	for (; i + 4 <= count; i += 4) {
+		__m128i p = _mm_loadu_si128((const __m128i*)(src + i * 4));
+		__m128i alpha = alphaMask;
+		if (channel >= 0) {
+			// Broadcast the channel to red, green and blue
+			__m128i v = _mm_and_si128(_mm_srl_epi32(p, shift), byteMask);
+			p = _mm_or_si128(v, _mm_or_si128(_mm_slli_epi32(v, 8), _mm_slli_epi32(v, 16)));
+		} else {
+			alpha = _mm_and_si128(p, alphaMask);
+		}
+
+		// Unpacking with zero in the low byte multiplies by 256 for free
+		__m128i d = _mm_min_epu8(_mm_subs_epu8(p, black), range);
+		__m128i lo = _mm_mulhi_epu16(_mm_unpacklo_epi8(zero, d), scale);
+		__m128i hi = _mm_mulhi_epu16(_mm_unpackhi_epi8(zero, d), scale);
+		p = _mm_or_si128(_mm_andnot_si128(alphaMask, _mm_packus_epi16(lo, hi)), alpha);
+
+		if (!filter.falseColour) {
+			_mm_storeu_si128((__m128i*)(dst + i * 4), p);
+			continue;
+		}
+		// SSE2 has no gather, so the palette is looked up per pixel
+		_mm_store_si128((__m128i*)lanes, p);
+		for (int k = 0; k < 4; k++) {
+			uint32_t out = FalseColour(lanes[k], channel >= 0, palette);
+			std::memcpy(dst + (i + k) * 4, &out, 4);
+		}
+	}
+#endif
+	for (; i < count; i++) {
+		const uint8_t* s = src + i * 4;
+		uint8_t* d = dst + i * 4;
+		if (channel >= 0) {
+			uint8_t v = levels.Apply(s[channel]);
+			d[0] = d[1] = d[2] = v;
+			d[3] = 255;
+		} else {
+			d[0] = levels.Apply(s[0]);
+			d[1] = levels.Apply(s[1]);
+			d[2] = levels.Apply(s[2]);
+			d[3] = s[3];
+		}
+		if (filter.falseColour) {
+			uint32_t pixel;
+			std::memcpy(&pixel, d, 4);
+			pixel = FalseColour(pixel, channel >= 0, palette);
+			std::memcpy(d, &pixel, 4);
+		}
+	}
+}
+
+static SDL_Point FindRowRange(int channel, const uint8_t* row, int count) {
+	int lo = 255;
+	int hi = 0;
+	int x = 0;
+#ifdef IMGNOW_SSE2
+	const __m128i alphaMask = _mm_set1_epi32((int)0xFF000000);
+	const __m128i byteMask = _mm_set1_epi32(0xFF);
+	const __m128i shift = _mm_cvtsi32_si128(std::max(channel, 0) * 8);
+	__m128i minV = _mm_set1_epi8((char)0xFF);
+	__m128i maxV = _mm_setzero_si128();
+	for (; x + 4 <= count; x += 4) {
+		__m128i p = _mm_loadu_si128((const __m128i*)(row + x * 4));
+		if (channel >= 0) {
+			// Other bytes are set so that they don't affect the result
+			__m128i v = _mm_and_si128(_mm_srl_epi32(p, shift), byteMask);
+			minV = _mm_min_epu8(minV, _mm_or_si128(v, _mm_andnot_si128(byteMask, _mm_set1_epi8((char)0xFF))));
+			maxV = _mm_max_epu8(maxV, v);
+		} else {
+			minV = _mm_min_epu8(minV, _mm_or_si128(p, alphaMask));
+			maxV = _mm_max_epu8(maxV, _mm_andnot_si128(alphaMask, p));
+		}
+	}
+	alignas(16) uint8_t bytes[16];
+	_mm_store_si128((__m128i*)bytes, minV);
+	lo = *std::min_element(bytes, bytes + 16);
+	_mm_store_si128((__m128i*)bytes, maxV);
+	hi = *std::max_element(bytes, bytes + 16);
+#endif
+	for (; x < count; x++) {
+		const uint8_t* p = row + x * 4;
+		if (channel >= 0) {
+			lo = std::min(lo, (int)p[channel]);
+			hi = std::max(hi, (int)p[channel]);
+		} else {
+			lo = std::min({ lo, (int)p[0], (int)p[1], (int)p[2] });
+			hi = std::max({ hi, (int)p[0], (int)p[1], (int)p[2] });
+		}
+	}
+	return { lo, hi };
+}
+
+SDL_Point ChannelRanges::Find(uint64_t key, ViewChannel channel, const uint8_t* pixels, int width, int height, const SDL_Rect& rect, ThreadPool& pool) {
+	if (key != this->key || channel != this->channel || width != this->width || height != this->height) {
+		this->key = key;
+		this->channel = channel;
+		this->width = width;
+		this->height = height;
+		columns = (width + TILE_SIZE - 1) / TILE_SIZE;
+		tiles.assign((size_t)columns * ((height + TILE_SIZE - 1) / TILE_SIZE), SDL_Point{ -1, -1 });
+	}
+	SDL_Rect bounds = { 0, 0, width, height };
+	SDL_Rect area{};
+	if (!SDL_IntersectRect(&rect, &bounds, &area))
+		return { 0, 255 };
+
+	// Whole tiles that haven't been measured yet are kept, tiles cut by the edges of area are measured every time
+	struct Piece {
+		SDL_Rect rect;
+		size_t tile; // Only for whole tiles
+		bool whole;
+	};
+	std::vector<Piece> pieces;
+	std::vector<size_t> whole;
+	for (int ty = area.y / TILE_SIZE; ty <= (area.y + area.h - 1) / TILE_SIZE; ty++) {
+		for (int tx = area.x / TILE_SIZE; tx <= (area.x + area.w - 1) / TILE_SIZE; tx++) {
+			size_t tile = (size_t)ty * columns + tx;
+			SDL_Rect rc = { tx * TILE_SIZE, ty * TILE_SIZE, std::min(TILE_SIZE, width - tx * TILE_SIZE), std::min(TILE_SIZE, height - ty * TILE_SIZE) };
+			SDL_Rect part{};
+			SDL_IntersectRect(&rc, &area, &part);
+			if (!SDL_RectEquals(&part, &rc)) {
+				pieces.push_back({ part, tile, false });
+				continue;
+			}
+			whole.push_back(tile);
+			if (tiles[tile].x < 0) {
+				pieces.push_back({ rc, tile, true });
+			}
+		}
+	}
+
+	int c = channel == ViewChannel::All ? -1 : (int)channel - 1;
+	std::vector<SDL_Point> ranges(pieces.size(), SDL_Point{ 255, 0 });
+	pool.ParallelFor(pieces.size(), [&](size_t i) {
+		const SDL_Rect& rc = pieces[i].rect;
+		for (int y = rc.y; y < rc.y + rc.h; y++) {
+			SDL_Point r = FindRowRange(c, pixels + ((size_t)y * width + rc.x) * 4, rc.w);
+			ranges[i].x = std::min(ranges[i].x, r.x);
+			ranges[i].y = std::max(ranges[i].y, r.y);
+		}
+	});
+
+	SDL_Point range = { 255, 0 };
+	for (size_t i = 0; i < pieces.size(); i++) {
+		if (pieces[i].whole) {
+			tiles[pieces[i].tile] = ranges[i];
+		} else {
+			range.x = std::min(range.x, ranges[i].x);
+			range.y = std::max(range.y, ranges[i].y);
+		}
+	}
+	for (size_t tile : whole) {
+		range.x = std::min(range.x, tiles[tile].x);
+		range.y = std::max(range.y, tiles[tile].y);
+	}
+	return range;
+}
+
+void ChannelRanges::Reset() {
+	tiles.clear();
+	key = 0;
+	width = 0;
+	height = 0;
+	columns = 0;
+}
+
+bool FilteredFrame::SetSource(uint64_t key, int width, int height) {
+	if (pixels && width == this->width && height == this->height) {
+		if (key != this->key) {
+			Invalidate();
+			this->key = key;
+		}
+		return false;
+	}
+	Invalidate();
+	jobs.clear(); // They write to their own buffers, so they can be left to finish
+	this->key = key;
+	this->width = width;
+	this->height = height;
+	columns = (width + TILE_SIZE - 1) / TILE_SIZE;
+	rows = (height + TILE_SIZE - 1) / TILE_SIZE;
+	valid.assign((size_t)columns * rows, 0);
+	written.assign((size_t)columns * rows, 0);
+	queued.assign((size_t)columns * rows, 0);
+	pixels = std::shared_ptr<uint8_t>(new uint8_t[(size_t)width * height * 4], std::default_delete<uint8_t[]>());
+	return true;
+}
+
+void FilteredFrame::Invalidate() {
+	std::fill(valid.begin(), valid.end(), 0);
+	(*generation)++;
+}
+
+SDL_Rect FilteredFrame::GetTileRect(size_t tile) const {
+	int x = (int)(tile % columns) * TILE_SIZE;
+	int y = (int)(tile / columns) * TILE_SIZE;
+	return SDL_Rect{ x, y, std::min(TILE_SIZE, width - x), std::min(TILE_SIZE, height - y) };
+}
+
+std::vector<SDL_Rect> FilteredFrame::Update(const ViewFilter& filter, std::shared_ptr<const uint8_t> source, const SDL_Rect& visible, ThreadPool& pool) {
+	std::vector<SDL_Rect> changed;
+	if (!pixels)
+		return changed;
+	if (!(filter == this->filter)) {
+		Invalidate();
+		this->filter = filter;
+	}
+
+	// Tiles filtered for an older filter or source are still better than nothing, but stay out of date
+	uint64_t current = *generation;
+	for (auto it = jobs.begin(); it != jobs.end(); ) {
+		if (it->pixels.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+			++it;
+			continue;
+		}
+		std::vector<uint8_t> tile;
+		try {
+			tile = it->pixels.get();
+		} catch (std::future_error&) {}
+		if (!tile.empty()) {
+			SDL_Rect rc = GetTileRect(it->tile);
+			for (int y = 0; y < rc.h; y++) {
+				std::memcpy(pixels.get() + ((size_t)(rc.y + y) * width + rc.x) * 4, tile.data() + (size_t)y * rc.w * 4, (size_t)rc.w * 4);
+			}
+			written[it->tile] = 1;
+			valid[it->tile] = it->generation == current;
+			changed.push_back(rc);
+		}
+		queued[it->tile] = 0;
+		it = jobs.erase(it);
+	}
+
+	SDL_Rect bounds = { 0, 0, width, height };
+	SDL_Rect area{};
+	if (!SDL_IntersectRect(&visible, &bounds, &area))
+		return changed;
+	std::vector<size_t> tiles;
+	size_t count = 0; // Pixels
+	for (int ty = area.y / TILE_SIZE; ty <= (area.y + area.h - 1) / TILE_SIZE; ty++) {
+		for (int tx = area.x / TILE_SIZE; tx <= (area.x + area.w - 1) / TILE_SIZE; tx++) {
+			size_t tile = (size_t)ty * columns + tx;
+			if (!valid[tile] && !queued[tile]) {
+				tiles.push_back(tile);
+				SDL_Rect rc = GetTileRect(tile);
+				count += (size_t)rc.w * rc.h;
+			}
+		}
+	}
+	if (tiles.empty())
+		return changed;
+
+	if (count > SYNC_FILTER_PIXELS) {
+		for (size_t tile : tiles) {
+			SDL_Rect rc = GetTileRect(tile);
+			auto job = pool.Submit([filter, source, width = width, rc, generation = generation, current] {
+				std::vector<uint8_t> out;
+				if (*generation != current)
+					return out;
+				out.resize((size_t)rc.w * rc.h * 4);
+				for (int y = 0; y < rc.h; y++) {
+					size_t offset = ((size_t)(rc.y + y) * width + rc.x) * 4;
+					ApplyViewFilter(filter, source.get() + offset, out.data() + (size_t)y * rc.w * 4, rc.w);
+				}
+				return out;
+				});
+			jobs.push_back({ tile, current, std::move(job) });
+			queued[tile] = 1;
+		}
+		return changed;
+	}
+
+	uint8_t* dst = pixels.get();
+	pool.ParallelFor(tiles.size(), [&](size_t i) {
+		SDL_Rect rc = GetTileRect(tiles[i]);
+		for (int y = rc.y; y < rc.y + rc.h; y++) {
+			size_t offset = ((size_t)y * width + rc.x) * 4;
+			ApplyViewFilter(filter, source.get() + offset, dst + offset, rc.w);
+		}
+	});
+	for (size_t tile : tiles) {
+		valid[tile] = 1;
+		written[tile] = 1;
+		changed.push_back(GetTileRect(tile));
+	}
+	return changed;
+}
+
+bool FilteredFrame::Covers(const SDL_Rect& visible) const {
+	SDL_Rect bounds = { 0, 0, width, height };
+	SDL_Rect area{};
+	if (!pixels || !SDL_IntersectRect(&visible, &bounds, &area))
+		return false;
+	for (int ty = area.y / TILE_SIZE; ty <= (area.y + area.h - 1) / TILE_SIZE; ty++) {
+		for (int tx = area.x / TILE_SIZE; tx <= (area.x + area.w - 1) / TILE_SIZE; tx++) {
+			if (!written[(size_t)ty * columns + tx])
+				return false;
+		}
+	}
+	return true;
+}
+
+void FilteredFrame::Reset() {
+	Invalidate();
+	jobs.clear();
+	pixels.reset();
+	valid.clear();
+	written.clear();
+	queued.clear();
+	width = 0;
+	height = 0;
+	key = 0;
+}
+
+const std::shared_ptr<uint8_t>& FilteredFrame::GetPixels() const {
+	return pixels;
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <stdint.h>
+#include <memory>
+#include <vector>
+#include "SDL.h"
+#include "threadpool.h"
+
+enum class ViewChannel {
+	All,
+	Red,   // Single channels are shown as opaque greyscale
+	Green,
+	Blue,
+	Alpha,
+	Count,
+};
+
+// How pixels are remapped for display. The image itself is never changed.
+struct ViewFilter {
+	ViewChannel channel = ViewChannel::All;
+	uint8_t black = 0; // Levels, values from black to white are stretched over the full range
+	uint8_t white = 255;
+	bool falseColour = false; // Shows the brightness of the result as a colour ramp
+	bool IsIdentity() const;
+	bool operator==(const ViewFilter&) const = default;
+};
+
+// Filters count RGBA pixels from src into dst
+void ApplyViewFilter(const ViewFilter& filter, const uint8_t* src, uint8_t* dst, size_t count);
+
+// Smallest and largest values of the channels shown by channel within a rect of a frame,
+// ignoring alpha unless it is the channel shown. The ranges of whole tiles are kept while
+// the frame and channel stay the same, so panning only measures the tiles cut by the edges.
+struct ChannelRanges {
+	SDL_Point Find(uint64_t key, ViewChannel channel, const uint8_t* pixels, int width, int height, const SDL_Rect& rect, ThreadPool& pool);
+	void Reset();
+private:
+	uint64_t key = 0;
+	ViewChannel channel = ViewChannel::All;
+	int width = 0;
+	int height = 0;
+	int columns = 0;
+	std::vector<SDL_Point> tiles; // Negative until measured
+};
+
+// Filtered copy of one frame, which is brought up to date one tile at a time
+// as tiles become visible so that changing the filter only costs what is on screen.
+// A few tiles are filtered straight away. Larger areas, such as a big image zoomed out,
+// are filtered by jobs and their tiles are copied in as they finish.
+struct FilteredFrame {
+	// Returns true when the pixels were reallocated and the whole texture has to be uploaded again.
+	// Changing the source with the same size only marks every tile as out of date.
+	bool SetSource(uint64_t key, int width, int height);
+	// Filters or queues the tiles within visible that are out of date and collects finished jobs,
+	// returning the tiles whose pixels changed. source is the frame given to SetSource.
+	std::vector<SDL_Rect> Update(const ViewFilter& filter, std::shared_ptr<const uint8_t> source, const SDL_Rect& visible, ThreadPool& pool);
+	bool Covers(const SDL_Rect& visible) const; // Every tile within visible has been filtered, maybe with an older filter
+	void Reset(); // Frees the pixels
+	const std::shared_ptr<uint8_t>& GetPixels() const;
+private:
+	struct Job {
+		size_t tile;
+		uint64_t generation;
+		std::future<std::vector<uint8_t>> pixels; // Empty if it was skipped
+	};
+	SDL_Rect GetTileRect(size_t tile) const;
+	void Invalidate(); // Marks every tile out of date and skips the jobs that haven't started
+	uint64_t key = 0;
+	int width = 0;
+	int height = 0;
+	int columns = 0;
+	int rows = 0;
+	ViewFilter filter;
+	std::vector<uint8_t> valid; // Per tile, up to date with the filter and source
+	std::vector<uint8_t> written; // Per tile, filtered at least once since the pixels were allocated
+	std::vector<uint8_t> queued; // Per tile, a job is filtering it
+	std::vector<Job> jobs;
+	// Incremented whenever the filter or source changes, shared with the jobs
+	std::shared_ptr<std::atomic<uint64_t>> generation = std::make_shared<std::atomic<uint64_t>>(0);
+	std::shared_ptr<uint8_t> pixels;
+};
@@ -0,0 +1,205 @@
+#include "watcher.h"
+#include <filesystem>
+#include <fstream>
+#include <chrono>
+#include <cstring> // memcpy
+#include "image.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <limits.h> // NAME_MAX
+#endif
+
+namespace fs = std::filesystem;
+
+// A file is reloaded once it has been closed after writing and no other event arrived for this long
+constexpr uint64_t CLOSED_QUIET_MS = 100;
+// Writers that keep the file open (or mmap it) never close it, so fall back to a longer quiet period
+constexpr uint64_t OPEN_QUIET_MS = 1000;
+// Set in the timestamp of a dirty file once the writer has closed it
+constexpr uint64_t CLOSED_FLAG = 1ull << 63;
+
+static uint64_t NowMs() {
+	using namespace std::chrono;
+	return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t HashFile(const std::string& path, bool& ok) {
+	std::ifstream file(path, std::ios::binary);
+	ok = (bool)file;
+	uint64_t h = 0xcbf29ce484222325;
+	std::vector<char> buffer(1 << 16);
+	while (file) {
+		file.read(buffer.data(), buffer.size());
+		size_t n = (size_t)file.gcount();
+		size_t i = 0;
+		for (; i + 8 <= n; i += 8) {
+			uint64_t w;
+			std::memcpy(&w, buffer.data() + i, 8);
+			h = (h ^ w) * 0x9e3779b97f4a7c15;
+			h ^= h >> 32;
+		}
+		for (; i < n; i++) {
+			h = (h ^ (uint8_t)buffer[i]) * 0x100000001b3;
+		}
+	}
+	return h;
+}
+
+FileSignature GetFileSignature(const std::string& path, const FileSignature& previous) {
+	std::error_code ec;
+	FileSignature sig{};
+	auto mtime = fs::last_write_time(path, ec);
+	if (ec)
+		return sig;
+	sig.size = fs::file_size(path, ec);
+	if (ec)
+		return sig;
+	sig.mtime = std::chrono::duration_cast<std::chrono::nanoseconds>(mtime.time_since_epoch()).count();
+
+	if (previous.valid && previous.mtime == sig.mtime && previous.size == sig.size) {
+		return previous;
+	}
+	bool ok = false;
+	sig.hash = HashFile(path, ok);
+	sig.valid = ok;
+	return sig;
+}
+
+#ifdef __linux__
+
+FileWatcher::FileWatcher() {
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+}
+
+FileWatcher::~FileWatcher() {
+	if (fd != -1) {
+		close(fd);
+	}
+}
+
+void FileWatcher::AddDirectory(const std::string& dir, bool reportCreated, bool addRef) {
+	std::unique_lock lock(mutex);
+	auto& entry = directories[dir];
+	entry.reportCreated |= reportCreated;
+	entry.refs += addRef ? 1 : 0;
+	if (entry.wd != -1 || fd == -1)
+		return;
+
+	// Looking up the directory can block, so other threads can poll meanwhile.
+	// Adding the same directory twice returns the same descriptor.
+	lock.unlock();
+	int wd = inotify_add_watch(fd, dir.c_str(), IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR);
+	lock.lock();
+	if (wd == -1)
+		return;
+	// The entry may have been removed while unlocked
+	auto it = directories.find(dir);
+	if (it == directories.end()) {
+		inotify_rm_watch(fd, wd);
+		return;
+	}
+	it->second.wd = wd;
+	directoryNames[wd] = dir;
+}
+
+void FileWatcher::RemoveDirectory(const std::string& dir) {
+	auto it = directories.find(dir);
+	if (it == directories.end() || it->second.refs > 0 || it->second.reportCreated)
+		return;
+	if (it->second.wd != -1) {
+		inotify_rm_watch(fd, it->second.wd);
+		directoryNames.erase(it->second.wd);
+	}
+	directories.erase(it);
+}
+
+void FileWatcher::Watch(const std::string& path) {
+	{
+		std::lock_guard lock(mutex);
+		if (files[path]++ > 0)
+			return;
+	}
+	AddDirectory(fs::path(path).parent_path().string(), false, true);
+}
+
+void FileWatcher::Unwatch(const std::string& path) {
+	std::lock_guard lock(mutex);
+	auto it = files.find(path);
+	if (it == files.end() || --it->second > 0)
+		return;
+	files.erase(it);
+	dirty.erase(path);
+	std::string dir = fs::path(path).parent_path().string();
+	directories[dir].refs--;
+	RemoveDirectory(dir);
+}
+
+void FileWatcher::WatchDirectory(const std::string& path) {
+	std::error_code ec;
+	fs::path dir = fs::canonical(path, ec);
+	AddDirectory(ec ? path : dir.string(), true, false);
+}
+
+void FileWatcher::Poll(std::vector<std::string>& changed, std::vector<std::string>& created) {
+	if (fd == -1)
+		return;
+
+	std::lock_guard lock(mutex);
+	uint64_t now = NowMs();
+	alignas(inotify_event) char buffer[16 * (sizeof(inotify_event) + NAME_MAX + 1)];
+	ssize_t n = 0;
+	while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+		for (char* p = buffer; p < buffer + n; ) {
+			auto* event = reinterpret_cast<const inotify_event*>(p);
+			p += sizeof(inotify_event) + event->len;
+
+			auto dir = directoryNames.find(event->wd);
+			if (dir == directoryNames.end())
+				continue;
+			if (event->mask & IN_IGNORED) {
+				// The directory was deleted or unmounted
+				directories[dir->second].wd = -1;
+				directoryNames.erase(dir);
+				continue;
+			}
+			if (event->len == 0 || (event->mask & IN_ISDIR))
+				continue;
+
+			std::string path = (fs::path(dir->second) / event->name).string();
+			if (!files.contains(path)) {
+				if (!directories[dir->second].reportCreated || !Image::HasImageExtension(path))
+					continue;
+			}
+			bool closed = (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) != 0;
+			dirty[path] = now | (closed ? CLOSED_FLAG : 0);
+		}
+	}
+
+	for (auto it = dirty.begin(); it != dirty.end(); ) {
+		uint64_t time = it->second & ~CLOSED_FLAG;
+		uint64_t quiet = (it->second & CLOSED_FLAG) ? CLOSED_QUIET_MS : OPEN_QUIET_MS;
+		if (now - time < quiet) {
+			++it;
+			continue;
+		}
+		if (files.contains(it->first)) {
+			changed.push_back(it->first);
+		} else if (reported.insert(it->first).second) {
+			created.push_back(it->first);
+		}
+		it = dirty.erase(it);
+	}
+}
+
+#else
+
+FileWatcher::FileWatcher() {}
+FileWatcher::~FileWatcher() {}
+void FileWatcher::Watch(const std::string&) {}
+void FileWatcher::Unwatch(const std::string&) {}
+void FileWatcher::WatchDirectory(const std::string&) {}
+void FileWatcher::Poll(std::vector<std::string>&, std::vector<std::string>&) {}
+
+#endif
@@ -0,0 +1,56 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+
+// Identifies the contents of a file on disk so that a change notification
+// for a file that was only touched, or rewritten with the same bytes, can be ignored.
+struct FileSignature {
+	int64_t mtime = 0; // Nanoseconds
+	uint64_t size = 0;
+	uint64_t hash = 0;
+	bool valid = false;
+	bool operator==(const FileSignature&) const = default;
+};
+
+// Stats the file and hashes its contents. The hash is only recomputed if the
+// modification time or size differ from previous. Blocking, call from a loader thread.
+FileSignature GetFileSignature(const std::string& path, const FileSignature& previous);
+
+// Watches open files and directories for changes with inotify.
+// On other platforms nothing is ever reported.
+// Files are watched through their parent directory so that editors which save by writing a
+// temporary file and renaming it over the original are picked up as well.
+// Thread safe. Watch can block on slow file systems, so it is best called from an I/O thread.
+struct FileWatcher {
+	FileWatcher();
+	~FileWatcher();
+	FileWatcher(const FileWatcher&) = delete;
+	FileWatcher& operator=(const FileWatcher&) = delete;
+	void Watch(const std::string& path); // Reference counted, each Watch needs an Unwatch
+	void Unwatch(const std::string& path);
+	void WatchDirectory(const std::string& path); // Report images that are written into the directory
+	// Returns files that have been written and left alone for the debounce period.
+	// Watched files are added to changed, other images in watched directories to created.
+	void Poll(std::vector<std::string>& changed, std::vector<std::string>& created);
+private:
+#ifdef __linux__
+	struct Directory {
+		int wd = -1;
+		int refs = 0; // Number of watched files in the directory
+		bool reportCreated = false;
+	};
+	void AddDirectory(const std::string& dir, bool reportCreated, bool addRef); // addRef counts a watched file in it
+	void RemoveDirectory(const std::string& dir);
+	int fd = -1;
+	std::mutex mutex; // Not held while inotify looks up a directory
+	std::unordered_map<std::string, Directory> directories;
+	std::unordered_map<int, std::string> directoryNames; // By watch descriptor
+	std::unordered_map<std::string, int> files; // Watched files and their reference counts
+	std::unordered_map<std::string, uint64_t> dirty; // Written files and the time of the last event
+	std::unordered_set<std::string> reported; // Created files that have already been reported
+#endif
+};
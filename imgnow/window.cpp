@@ -2,15 +2,29 @@
 #include "image.h"
 #include "SDL_syswm.h"
 #include <chrono>
+#include <atomic>
+
+// Event type used by Wake. Zero until SDL has been initialized.
+static std::atomic<Uint32> wakeEventType = 0;
+// Set while a wake event is queued, so that many threads finishing at once only queue one
+static std::atomic_bool wakePending = false;
 
 const char* SDLException::what() const noexcept {
 	return SDL_GetError();
 }
 
 Window::Window(int width, int height) {
+	// Closing the window is handled by CloseRequested instead
+	SDL_SetHint(SDL_HINT_QUIT_ON_LAST_WINDOW_CLOSE, "0");
+
 	if (SDL_Init(SDL_INIT_VIDEO))
 		throw SDLException();
 
+	Uint32 eventType = SDL_RegisterEvents(1);
+	if (eventType != (Uint32)-1) {
+		wakeEventType = eventType;
+	}
+
 	window = SDL_CreateWindow(
 		"",
 		SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
@@ -30,6 +44,7 @@ Window::Window(int width, int height) {
 }
 
 Window::~Window() {
+	wakeEventType = 0;
 	SDL_DestroyRenderer(renderer);
 	SDL_DestroyWindow(window);
 	SDL_Quit();
@@ -37,11 +52,14 @@ Window::~Window() {
 
 bool Window::ProcessMessages() {
 	scrollDelta = {};
+	// Any wake event queued before this is handled by the loop below
+	wakePending = false;
 	SDL_Event ev{};
 	while (SDL_PollEvent(&ev)) {
 		switch (ev.type) {
 		case SDL_QUIT:
-			return false;
+			Quit();
+			break;
 		case SDL_KEYDOWN:
 			keyStates[ev.key.keysym.scancode] = KeyState::Pressed;
 			break;
@@ -82,11 +100,26 @@ bool Window::ProcessMessages() {
 			case SDL_WINDOWEVENT_MOVED:
 				Moved(ev.window.data1, ev.window.data2);
 				break;
+			case SDL_WINDOWEVENT_CLOSE:
+				CloseRequested();
+				break;
+			case SDL_WINDOWEVENT_EXPOSED:
+			case SDL_WINDOWEVENT_SHOWN:
+			case SDL_WINDOWEVENT_SIZE_CHANGED:
+			case SDL_WINDOWEVENT_RESTORED:
+			case SDL_WINDOWEVENT_MAXIMIZED:
+				Exposed();
+				break;
 			}
 			break;
+		case SDL_RENDER_TARGETS_RESET:
+		case SDL_RENDER_DEVICE_RESET:
+			// Render target textures lost their contents
+			Exposed();
+			break;
 		}
 	}
-	return true;
+	return !quit;
 }
 
 void Window::UpdateInput() {
@@ -192,7 +225,11 @@ void Window::Run() {
 		Update();
 		UpdateInput();
 
-		SDL_Delay(5);
+		if (uint32_t sleepTime = GetSleepTime()) {
+			SDL_WaitEventTimeout(nullptr, (int)sleepTime);
+		} else {
+			SDL_Delay(5);
+		}
 	}
 }
 
@@ -207,3 +244,29 @@ void Window::Moved(int x, int y) {
 
 void Window::FileDropped(const char* path) {
 }
+
+void Window::CloseRequested() {
+	Quit();
+}
+
+uint32_t Window::GetSleepTime() const {
+	return 0;
+}
+
+void Window::Exposed() {
+}
+
+void Window::Quit() {
+	quit = true;
+}
+
+void Window::Wake() {
+	Uint32 type = wakeEventType;
+	if (!type || wakePending.exchange(true))
+		return;
+	SDL_Event ev{};
+	ev.type = type;
+	if (SDL_PushEvent(&ev) != 1) {
+		wakePending = false;
+	}
+}
@@ -23,6 +23,11 @@ struct Window {
 	virtual void Moved(int x, int y);
 	virtual void Resized(int width, int height);
 	virtual void FileDropped(const char* path);
+	virtual void CloseRequested(); // The window's close button was pressed. Quits by default.
+	virtual uint32_t GetSleepTime() const; // Block for up to this many milliseconds until an event arrives, 0 runs every frame
+	virtual void Exposed(); // The window's contents were lost or resized and need to be redrawn
+	void Quit();
+	static void Wake(); // Thread safe. Interrupts the wait between frames.
 	bool GetKeyDown(SDL_Scancode key) const;
 	bool GetKeyPressed(SDL_Scancode key) const;
 	bool GetKeyReleased(SDL_Scancode key) const;